@@ -0,0 +1,248 @@
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <glm.hpp>
+
+// Counting operator new, for allocations per operation (before anything includes the header)
+#define HEAP_COUNTERS_IMPLEMENTATION
+#include "heapCounters.h"
+
+#include "model.h"
+#include "camera.h"
+#include "bounds.h"
+#include "normalMatrix.h"
+#include "sceneGraph.h"
+#include "rideKinematics.h"
+#include "benchmark.h"
+
+// stb_image allocates with malloc, which the counting operator new never sees
+#define STBI_MALLOC(size) HeapCounters::countedMalloc(size)
+#define STBI_REALLOC(memory, size) HeapCounters::countedRealloc(memory, size)
+#define STBI_FREE(memory) HeapCounters::countedFree(memory)
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+// Microbenchmarks of the engine's CPU hot paths. Nothing here needs a GL context: meshes are
+// converted without being uploaded and textures decoded without being uploaded.
+//
+//   bench [--filter TEXT] [--json FILE] [--baseline FILE] [--threshold PERCENT] [--min-time SECONDS]
+//         [--resources DIR]
+//
+// With --baseline, exits with 1 when any benchmark got slower than the threshold allows.
+
+// Collision test points (a sweep over all of them is one operation)
+const unsigned int COLLISION_POINTS = 1 << 20;
+
+// Instances composed per operation in the model matrix benchmark
+const unsigned int MATRIX_INSTANCES = 1024;
+
+// Wheels and carts for the kinematics benchmark
+const unsigned int KINEMATICS_RIDES = 1024;
+const unsigned int KINEMATICS_CARTS = 16;
+
+// Resource files under dir with one of the extensions, in a stable order
+std::vector<std::filesystem::path> findFiles(const std::string& dir, std::initializer_list<const char*> extensions) {
+    std::vector<std::filesystem::path> files;
+    std::error_code error;
+    for (auto it = std::filesystem::recursive_directory_iterator(dir, error); !error && it != std::filesystem::recursive_directory_iterator(); it.increment(error)) {
+        if (!it->is_regular_file()) continue;
+        std::string extension = it->path().extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        for (const char* wanted : extensions) {
+            if (extension == wanted) files.push_back(it->path());
+        }
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+std::string benchmarkName(const char* group, const std::filesystem::path& file, const std::string& resources) {
+    return std::string(group) + "/" + std::filesystem::relative(file, resources).generic_string();
+}
+
+void benchmarkModels(BenchmarkRunner& runner, const std::string& resources) {
+    for (const std::filesystem::path& file : findFiles(resources, {".obj"})) {
+        std::string path = file.string();
+
+        // OBJ import, with the post-processing steps Model uses
+        runner.run(benchmarkName("obj_import", file, resources), [&] {
+            Assimp::Importer importer;
+            doNotOptimize(importer.ReadFile(path, Model::IMPORT_FLAGS));
+        });
+
+        // Conversion of every imported mesh into Model's vertex and index arrays (processMesh
+        // without the materials and the GL upload)
+        Assimp::Importer importer;
+        const aiScene* scene = importer.ReadFile(path, Model::IMPORT_FLAGS);
+        if (!scene || !scene->mRootNode) {
+            logger.log(LOG_ERROR, "ERROR::ASSIMP::%s", importer.GetErrorString());
+            continue;
+        }
+        double vertexCount = 0.0;
+        for (unsigned int m = 0; m < scene->mNumMeshes; m++) {
+            vertexCount += scene->mMeshes[m]->mNumVertices;
+        }
+        runner.run(benchmarkName("process_mesh", file, resources), [&] {
+            for (unsigned int m = 0; m < scene->mNumMeshes; m++) {
+                vector<Vertex> vertices;
+                vector<unsigned int> indices;
+                Model::extractGeometry(scene->mMeshes[m], vertices, indices);
+                doNotOptimize(vertices.data());
+                doNotOptimize(indices.data());
+            }
+        }, vertexCount);
+    }
+}
+
+// Decode only: the file is read into memory first
+void benchmarkTextures(BenchmarkRunner& runner, const std::string& resources) {
+    for (const std::filesystem::path& file : findFiles(resources, {".png", ".jpg", ".jpeg"})) {
+        std::ifstream in(file, std::ios::binary);
+        std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+        int width = 0, height = 0, components = 0;
+        if (!stbi_info_from_memory(bytes.data(), (int)bytes.size(), &width, &height, &components)) continue;
+
+        runner.run(benchmarkName("texture_decode", file, resources), [&] {
+            int w, h, n;
+            unsigned char* data = stbi_load_from_memory(bytes.data(), (int)bytes.size(), &w, &h, &n, 0);
+            doNotOptimize(data);
+            stbi_image_free(data);
+        }, (double)width * height);
+    }
+}
+
+// Model matrix and normal matrix, as Model::Draw builds them for an unattached model
+void benchmarkModelMatrix(BenchmarkRunner& runner) {
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> coordinate(-50.0f, 50.0f);
+    std::uniform_real_distribution<float> angle(0.0f, 360.0f);
+    std::vector<glm::vec3> positions(MATRIX_INSTANCES), rotations(MATRIX_INSTANCES);
+    for (unsigned int i = 0; i < MATRIX_INSTANCES; i++) {
+        positions[i] = glm::vec3(coordinate(random), coordinate(random), coordinate(random));
+        rotations[i] = glm::vec3(angle(random), angle(random), angle(random));
+    }
+
+    runner.run("model_matrix/" + std::to_string(MATRIX_INSTANCES), [&] {
+        for (unsigned int i = 0; i < MATRIX_INSTANCES; i++) {
+            glm::mat4 model = Model::composeMatrix(positions[i], rotations[i]);
+            glm::mat3 normalMatrix = computeNormalMatrix(model);
+            doNotOptimize(model);
+            doNotOptimize(normalMatrix);
+        }
+    }, MATRIX_INSTANCES);
+}
+
+// updateCameraVectors through a mouse move (the only way in; the angle update is trivial)
+void benchmarkCamera(BenchmarkRunner& runner) {
+    Camera camera(glm::vec3(0.0f, 10.0f, 0.0f));
+    float direction = 1.0f;
+    runner.run("camera_update_vectors", [&] {
+        direction = -direction;
+        camera.ProcessMouseMovement(direction * 3.0f, direction * 2.0f);
+        doNotOptimize(camera.Front);
+    });
+}
+
+// Every wheel turns a little, then the scene graph and the carts follow
+void benchmarkKinematics(BenchmarkRunner& runner) {
+    SceneGraph graph;
+    RideKinematics kinematics;
+    std::vector<unsigned int> wheels;
+    for (unsigned int r = 0; r < KINEMATICS_RIDES; r++) {
+        unsigned int base = graph.addNode();
+        graph.setTranslation(base, glm::vec3(40.0f * (r % 32), 0.0f, 40.0f * (r / 32)));
+        unsigned int wheel = graph.addNode(base);
+        unsigned int firstCart = graph.addDrivenNodes(wheel, KINEMATICS_CARTS);
+        kinematics.addRide(wheel, firstCart, KINEMATICS_CARTS, 12.0f, 0.0f, 1.0f);
+        wheels.push_back(wheel);
+    }
+    graph.update();
+    kinematics.update(graph);
+
+    float rideAngle = 0.0f;
+    runner.run("cart_kinematics/" + std::to_string(KINEMATICS_RIDES) + "x" + std::to_string(KINEMATICS_CARTS), [&] {
+        rideAngle += 0.5f;
+        glm::quat rotation = SceneGraph::eulerRotation(glm::vec3(rideAngle, 0.0f, 0.0f));
+        for (unsigned int wheel : wheels) {
+            graph.setRotation(wheel, rotation);
+        }
+        graph.update();
+        kinematics.update(graph);
+        doNotOptimize(graph.drivenWorlds(0));
+    }, (double)KINEMATICS_RIDES * KINEMATICS_CARTS);
+}
+
+// The camera collision box test over many points, a fifth of them inside
+void benchmarkCollision(BenchmarkRunner& runner) {
+    const glm::vec3 boxMin(-15.5f, -3.0f, -20.5f);
+    const glm::vec3 boxMax(15.5f, 3.0f, 20.5f);
+
+    std::mt19937 random(2);
+    std::uniform_real_distribution<float> x(-25.0f, 25.0f), y(-5.0f, 5.0f), z(-35.0f, 35.0f);
+    std::vector<glm::vec3> points(COLLISION_POINTS);
+    for (glm::vec3& point : points) {
+        point = glm::vec3(x(random), y(random), z(random));
+    }
+
+    runner.run("is_inside_box/" + std::to_string(COLLISION_POINTS), [&] {
+        unsigned int inside = 0;
+        for (const glm::vec3& point : points) {
+            inside += isInsideBox(point, boxMin, boxMax);
+        }
+        doNotOptimize(inside);
+    }, COLLISION_POINTS);
+}
+
+int main(int argc, char* argv[]) {
+    BenchmarkRunner runner;
+    std::string output = "bench.json";
+    std::string baseline;
+    std::string resources = "Resources/Models";
+    double threshold = 10.0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc) {
+            runner.filter = argv[++i];
+        }
+        else if (arg == "--json" && i + 1 < argc) {
+            output = argv[++i];
+        }
+        else if (arg == "--baseline" && i + 1 < argc) {
+            baseline = argv[++i];
+        }
+        else if (arg == "--threshold" && i + 1 < argc) {
+            threshold = std::atof(argv[++i]);
+        }
+        else if (arg == "--min-time" && i + 1 < argc) {
+            runner.minSeconds = std::max(std::atof(argv[++i]), 0.001);
+        }
+        else if (arg == "--resources" && i + 1 < argc) {
+            resources = argv[++i];
+        }
+    }
+
+    benchmarkModels(runner, resources);
+    benchmarkTextures(runner, resources);
+    benchmarkModelMatrix(runner);
+    benchmarkCamera(runner);
+    benchmarkKinematics(runner);
+    benchmarkCollision(runner);
+
+    if (!runner.writeJson(output.c_str())) return 1;
+    if (!baseline.empty()) {
+        int regressions = runner.compare(baseline.c_str(), threshold);
+        if (regressions != 0) return 1;
+    }
+    return 0;
+}
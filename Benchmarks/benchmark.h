@@ -0,0 +1,180 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <heapCounters.h>
+#include <logger.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Keeps the compiler from optimising away a value nothing else reads
+template<typename T>
+inline void doNotOptimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
+
+struct BenchmarkResult {
+    std::string name;
+    unsigned long long iterations = 0;  // Per repetition
+    double nsPerOp = 0.0;               // Median over the repetitions
+    double minNsPerOp = 0.0;
+    double allocationsPerOp = 0.0;
+    double itemsPerSecond = 0.0;        // 0 when the benchmark has no item count
+};
+
+// Small timing harness for the bench target. Each benchmark first finds an iteration count
+// that runs for at least minSeconds, then times that many iterations repetitions times and
+// keeps the median. Heap allocations per operation come from HeapCounters: the counting
+// operator new, plus malloc wherever a library is routed through the counted functions.
+//
+// Results are written as JSON, one benchmark per line, and a file from an earlier run can be
+// read back as a baseline: compare() reports each benchmark's change against it.
+class BenchmarkRunner {
+public:
+    double minSeconds = 0.2;
+    unsigned int repetitions = 5;
+    std::string filter;                 // Only names containing this
+
+    // body() is one operation; itemsPerOp (vertices, points...) gives a throughput
+    template<typename Body>
+    void run(const std::string& name, Body body, double itemsPerOp = 0.0) {
+        if (!filter.empty() && name.find(filter) == std::string::npos) return;
+
+        unsigned long long iterations = 1;
+        while (true) {
+            double seconds = time(body, iterations);
+            if (seconds >= minSeconds || iterations >= (1ull << 40)) break;
+            double scale = seconds > 0.0 ? minSeconds / seconds * 1.2 : 10.0;
+            iterations = (unsigned long long)(iterations * std::min(std::max(scale, 1.5), 10.0));
+        }
+
+        std::vector<double> samples;
+        samples.reserve(repetitions);
+        unsigned long long allocationsBefore = HeapCounters::allocations.load(std::memory_order_relaxed);
+        for (unsigned int r = 0; r < repetitions; r++) {
+            samples.push_back(time(body, iterations) * 1e9 / iterations);
+        }
+        unsigned long long allocations = HeapCounters::allocations.load(std::memory_order_relaxed) - allocationsBefore;
+        std::sort(samples.begin(), samples.end());
+
+        BenchmarkResult result;
+        result.name = name;
+        result.iterations = iterations;
+        result.nsPerOp = samples[samples.size() / 2];
+        result.minNsPerOp = samples.front();
+        result.allocationsPerOp = (double)allocations / ((double)iterations * repetitions);
+        result.itemsPerSecond = itemsPerOp > 0.0 ? itemsPerOp * 1e9 / result.nsPerOp : 0.0;
+        benchmarkResults.push_back(result);
+
+        std::printf("%-56s %14.1f ns/op %12.2f allocs/op", name.c_str(), result.nsPerOp, result.allocationsPerOp);
+        if (result.itemsPerSecond > 0.0) std::printf(" %12.3g items/s", result.itemsPerSecond);
+        std::printf("\n");
+        std::fflush(stdout);
+    }
+
+    const std::vector<BenchmarkResult>& results() const {
+        return benchmarkResults;
+    }
+
+    bool writeJson(const char* path) const {
+        std::ofstream file(path);
+        if (!file) {
+            logger.log(LOG_ERROR, "ERROR::BENCH::FILE_NOT_WRITABLE: %s", path);
+            return false;
+        }
+
+        file << "{\n  \"benchmarks\": [\n";
+        for (size_t i = 0; i < benchmarkResults.size(); i++) {
+            const BenchmarkResult& result = benchmarkResults[i];
+            char line[512];
+            std::snprintf(line, sizeof(line),
+                          "    {\"name\": \"%s\", \"iterations\": %llu, \"nsPerOp\": %.3f, \"minNsPerOp\": %.3f, "
+                          "\"allocationsPerOp\": %.3f, \"itemsPerSecond\": %.6g}",
+                          result.name.c_str(), result.iterations, result.nsPerOp, result.minNsPerOp,
+                          result.allocationsPerOp, result.itemsPerSecond);
+            file << line << (i + 1 < benchmarkResults.size() ? ",\n" : "\n");
+        }
+        file << "  ]\n}\n";
+        return true;
+    }
+
+    // Prints each benchmark against a baseline from writeJson(); returns how many got slower
+    // by more than thresholdPercent (-1 if the baseline can't be read)
+    int compare(const char* baselinePath, double thresholdPercent) const {
+        std::ifstream file(baselinePath);
+        if (!file) {
+            logger.log(LOG_ERROR, "ERROR::BENCH::BASELINE_NOT_READABLE: %s", baselinePath);
+            return -1;
+        }
+
+        std::vector<std::pair<std::string, double>> baseline;
+        std::string line;
+        while (std::getline(file, line)) {
+            std::string name;
+            double nsPerOp = 0.0;
+            if (field(line, "name", name) && field(line, "nsPerOp", nsPerOp)) baseline.push_back({name, nsPerOp});
+        }
+
+        std::printf("\n%-56s %14s %14s %9s\n", "vs baseline", "baseline ns", "current ns", "change");
+        int regressions = 0;
+        for (const BenchmarkResult& result : benchmarkResults) {
+            auto match = std::find_if(baseline.begin(), baseline.end(),
+                                      [&](const std::pair<std::string, double>& entry) { return entry.first == result.name; });
+            if (match == baseline.end()) {
+                std::printf("%-56s %14s %14.1f %9s\n", result.name.c_str(), "-", result.nsPerOp, "new");
+                continue;
+            }
+
+            double change = match->second > 0.0 ? (result.nsPerOp / match->second - 1.0) * 100.0 : 0.0;
+            bool regressed = change > thresholdPercent;
+            if (regressed) regressions++;
+            std::printf("%-56s %14.1f %14.1f %+8.1f%%%s\n", result.name.c_str(), match->second, result.nsPerOp, change,
+                        regressed ? "  REGRESSION" : "");
+        }
+        std::printf("%d of %zu benchmarks slower than the baseline by more than %.1f%%\n",
+                    regressions, benchmarkResults.size(), thresholdPercent);
+        return regressions;
+    }
+
+private:
+    std::vector<BenchmarkResult> benchmarkResults;
+
+    template<typename Body>
+    static double time(Body& body, unsigned long long iterations) {
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned long long i = 0; i < iterations; i++) {
+            body();
+        }
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // "key": "value" / "key": number, from one line of our own JSON
+    static bool field(const std::string& line, const char* key, std::string& value) {
+        std::string quotedKey = std::string("\"") + key + "\": \"";
+        size_t start = line.find(quotedKey);
+        if (start == std::string::npos) return false;
+        start += quotedKey.size();
+        size_t end = line.find('"', start);
+        if (end == std::string::npos) return false;
+        value = line.substr(start, end - start);
+        return true;
+    }
+
+    static bool field(const std::string& line, const char* key, double& value) {
+        std::string quotedKey = std::string("\"") + key + "\": ";
+        size_t start = line.find(quotedKey);
+        if (start == std::string::npos) return false;
+        return std::sscanf(line.c_str() + start + quotedKey.size(), "%lf", &value) == 1;
+    }
+};
+
+#endif
@@ -5,6 +5,9 @@
 #include <glm.hpp>
 #include <gtc/matrix_transform.hpp>
 
+#include <frustum.h>
+#include <inputRecorder.h>
+
 enum Camera_Movement {
     FORWARD,
     BACKWARD,
@@ -76,6 +79,12 @@ public:
         return glm::lookAt(Position, Position + Front, Up);
     }
 
+    // Culling volume for this camera's view with the given projection
+    Frustum GetFrustum(const glm::mat4& projection) const
+    {
+        return Frustum(projection * GetViewMatrix());
+    }
+
     void setPosition(const glm::vec3& position) {
         Position = position;
     }
@@ -123,7 +132,7 @@ public:
 
     void ProcessMouseScroll(float yoffset, GLFWwindow* window)
     {
-        if(glfwGetKey(window, GLFW_KEY_C) != GLFW_RELEASE){
+        if(inputRecorder.getKey(window, GLFW_KEY_C) != GLFW_RELEASE){
             Fov -= (float) yoffset;
         }
         if (Fov < 1.0f)
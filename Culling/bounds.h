@@ -0,0 +1,74 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+
+struct BoundingSphere {
+    glm::vec3 center;
+    float radius;
+};
+
+struct AABB {
+    glm::vec3 min;
+    glm::vec3 max;
+
+    AABB() : min(FLT_MAX), max(-FLT_MAX) {}
+    AABB(const glm::vec3& min, const glm::vec3& max) : min(min), max(max) {}
+
+    bool valid() const {
+        return min.x <= max.x && min.y <= max.y && min.z <= max.z;
+    }
+
+    glm::vec3 center() const {
+        return (min + max) * 0.5f;
+    }
+
+    glm::vec3 extents() const {
+        return (max - min) * 0.5f;
+    }
+
+    void expand(const glm::vec3& point) {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    void expand(const AABB& other) {
+        if (!other.valid()) return;
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    // Box around this box after an affine transform (Arvo's method)
+    AABB transformed(const glm::mat4& m) const {
+        if (!valid()) return *this;
+
+        glm::vec3 newMin(m[3]);
+        glm::vec3 newMax(m[3]);
+        for (int col = 0; col < 3; col++) {
+            for (int row = 0; row < 3; row++) {
+                float a = m[col][row] * min[col];
+                float b = m[col][row] * max[col];
+                newMin[row] += std::min(a, b);
+                newMax[row] += std::max(a, b);
+            }
+        }
+        return AABB(newMin, newMax);
+    }
+
+    // Sphere around this box after an affine transform
+    BoundingSphere sphere(const glm::mat4& m) const {
+        float scale = std::max(glm::length(glm::vec3(m[0])), std::max(glm::length(glm::vec3(m[1])), glm::length(glm::vec3(m[2]))));
+        return BoundingSphere{glm::vec3(m * glm::vec4(center(), 1.0f)), glm::length(extents()) * scale};
+    }
+};
+
+// Point inside (or on) the box from boxMin to boxMax
+inline bool isInsideBox(glm::vec3 position, glm::vec3 boxMin, glm::vec3 boxMax) {
+    return position.x >= boxMin.x && position.y >= boxMin.y && position.z >= boxMin.z
+           && position.x <= boxMax.x && position.y <= boxMax.y && position.z <= boxMax.z;
+}
+
+#endif
@@ -0,0 +1,394 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm.hpp>
+
+#include "bounds.h"
+#include "frustum.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+
+// Bounding volume hierarchy over world-space instance bounds.
+// Built top-down with the binned surface area heuristic; moving instances are handled by
+// refitting the boxes on their path to the root, and the tree is rebuilt once refitting has
+// made it noticeably worse than a fresh build.
+class BVH {
+public:
+    static const unsigned int MAX_LEAF_SIZE = 4;
+    static const unsigned int SAH_BINS = 12;
+    static const unsigned int MAX_DEPTH = 48;   // Keeps the fixed traversal stacks safe
+
+    struct Node {
+        AABB bounds;
+        int left = -1;          // Children (internal nodes only)
+        int right = -1;
+        int parent = -1;
+        unsigned int first = 0; // Range of items covered by this subtree
+        unsigned int count = 0;
+
+        bool isLeaf() const {
+            return left < 0;
+        }
+    };
+
+    void build(const std::vector<AABB>& objectBounds) {
+        bounds = objectBounds;
+        nodes.clear();
+        items.resize(bounds.size());
+        leafOf.assign(bounds.size(), -1);
+        for (unsigned int i = 0; i < items.size(); i++) {
+            items[i] = i;
+        }
+        dirty.clear();
+
+        if (!items.empty()) {
+            nodes.reserve(items.size() * 2);
+            nodes.push_back(Node());
+            buildNode(0, 0, (unsigned int)items.size(), 0);
+        }
+
+        // Leaf spheres in item order, for the SIMD test of partially visible leaves
+        spheres.clear();
+        for (unsigned int item : items) {
+            spheres.add(sphereOf(bounds[item]));
+        }
+
+        weightedArea = 0.0;
+        for (const Node& node : nodes) {
+            weightedArea += weightedAreaOf(node);
+        }
+        builtCost = cost();
+    }
+
+    unsigned int size() const {
+        return (unsigned int)bounds.size();
+    }
+
+    const AABB& objectBounds(unsigned int object) const {
+        return bounds[object];
+    }
+
+    // Record new bounds for a moving object; call refit() once all objects are updated
+    void update(unsigned int object, const AABB& newBounds) {
+        bounds[object] = newBounds;
+        if (leafOf[object] >= 0) {
+            dirty.push_back(leafOf[object]);
+        }
+    }
+
+    // Propagate updated leaves up to the root, rebuilding if the tree has degraded
+    void refit() {
+        if (dirty.empty()) return;
+
+        for (int node : dirty) {
+            refitLeaf(node);
+            for (int parent = nodes[node].parent; parent >= 0; parent = nodes[parent].parent) {
+                AABB merged = nodes[nodes[parent].left].bounds;
+                merged.expand(nodes[nodes[parent].right].bounds);
+                if (merged.min == nodes[parent].bounds.min && merged.max == nodes[parent].bounds.max) {
+                    break;
+                }
+                setBounds(parent, merged);
+            }
+        }
+        dirty.clear();
+
+        if (cost() > builtCost * REBUILD_RATIO) {
+            std::vector<AABB> current = bounds;
+            build(current);
+        }
+    }
+
+    // Objects whose bounds touch the frustum. The query functions append to any vector of
+    // unsigned int (a FrameVector for per-frame lists).
+    template<typename IndexList>
+    void queryFrustum(const Frustum& frustum, IndexList& out) const {
+        PROFILE_SCOPE("BVH Frustum Query");
+        if (nodes.empty()) return;
+
+        int stack[64];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const Node& node = nodes[stack[--top]];
+            Frustum_Result result = frustum.classifyAABB(node.bounds);
+            if (result == FRUSTUM_OUTSIDE) {
+                continue;
+            }
+            if (result == FRUSTUM_INSIDE) {
+                out.insert(out.end(), items.begin() + node.first, items.begin() + node.first + node.count);
+                continue;
+            }
+            if (node.isLeaf()) {
+                size_t start = out.size();
+                spheres.cullRange(frustum, node.first, node.first + node.count, out);
+                for (size_t i = start; i < out.size(); i++) {
+                    out[i] = items[out[i]];
+                }
+                continue;
+            }
+            stack[top++] = node.right;
+            stack[top++] = node.left;
+        }
+    }
+
+    // Objects whose bounds overlap the box
+    template<typename IndexList>
+    void queryAABB(const AABB& box, IndexList& out) const {
+        query(out, [&](const AABB& b) {
+            return overlaps(b, box);
+        });
+    }
+
+    // Objects whose bounds overlap the sphere
+    template<typename IndexList>
+    void querySphere(const glm::vec3& center, float radius, IndexList& out) const {
+        query(out, [&](const AABB& b) {
+            glm::vec3 closest = glm::clamp(center, b.min, b.max);
+            glm::vec3 offset = closest - center;
+            return glm::dot(offset, offset) <= radius * radius;
+        });
+    }
+
+    // Nearest object whose bounds the ray hits within maxDistance; returns false on a miss
+    bool raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance,
+                 unsigned int& hitObject, float& hitDistance) const {
+        if (nodes.empty()) return false;
+
+        glm::vec3 inverse(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        hitDistance = maxDistance;
+        bool hit = false;
+
+        int stack[64];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const Node& node = nodes[stack[--top]];
+            float entry;
+            if (!rayBox(origin, inverse, node.bounds, hitDistance, entry)) {
+                continue;
+            }
+            if (node.isLeaf()) {
+                for (unsigned int i = node.first; i < node.first + node.count; i++) {
+                    if (rayBox(origin, inverse, bounds[items[i]], hitDistance, entry)) {
+                        hitDistance = entry;
+                        hitObject = items[i];
+                        hit = true;
+                    }
+                }
+                continue;
+            }
+
+            // Visit the nearer child first so later boxes are clipped by its hits
+            float leftEntry = FLT_MAX, rightEntry = FLT_MAX;
+            bool hitLeft = rayBox(origin, inverse, nodes[node.left].bounds, hitDistance, leftEntry);
+            bool hitRight = rayBox(origin, inverse, nodes[node.right].bounds, hitDistance, rightEntry);
+            if (hitLeft && hitRight) {
+                if (leftEntry < rightEntry) {
+                    stack[top++] = node.right;
+                    stack[top++] = node.left;
+                } else {
+                    stack[top++] = node.left;
+                    stack[top++] = node.right;
+                }
+            } else if (hitLeft) {
+                stack[top++] = node.left;
+            } else if (hitRight) {
+                stack[top++] = node.right;
+            }
+        }
+        return hit;
+    }
+
+private:
+    // Rebuild when refitting makes the tree this much more expensive than when built
+    static constexpr float REBUILD_RATIO = 1.5f;
+
+    std::vector<Node> nodes;
+    std::vector<AABB> bounds;         // Per object
+    std::vector<unsigned int> items;  // Object ids in leaf order
+    std::vector<int> leafOf;          // Per object
+    std::vector<int> dirty;           // Leaves touched since the last refit
+    CullingSet spheres;               // Per item
+    float builtCost = 0.0f;
+    double weightedArea = 0.0;        // Sum of weightedAreaOf() over all nodes, kept up to date by refits
+
+    static BoundingSphere sphereOf(const AABB& box) {
+        // Empty boxes get a sphere that fails every plane test
+        if (!box.valid()) return BoundingSphere{glm::vec3(0.0f), -FLT_MAX};
+        return BoundingSphere{box.center(), glm::length(box.extents())};
+    }
+
+    static float area(const AABB& box) {
+        if (!box.valid()) return 0.0f;
+        glm::vec3 d = box.max - box.min;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    static bool overlaps(const AABB& a, const AABB& b) {
+        return a.min.x <= b.max.x && a.max.x >= b.min.x
+               && a.min.y <= b.max.y && a.max.y >= b.min.y
+               && a.min.z <= b.max.z && a.max.z >= b.min.z;
+    }
+
+    static bool rayBox(const glm::vec3& origin, const glm::vec3& inverse, const AABB& box, float maxDistance, float& entry) {
+        glm::vec3 t0 = (box.min - origin) * inverse;
+        glm::vec3 t1 = (box.max - origin) * inverse;
+        glm::vec3 slabNear = glm::min(t0, t1);
+        glm::vec3 slabFar = glm::max(t0, t1);
+        float tNear = std::max(std::max(slabNear.x, slabNear.y), std::max(slabNear.z, 0.0f));
+        float tFar = std::min(std::min(slabFar.x, slabFar.y), std::min(slabFar.z, maxDistance));
+        entry = tNear;
+        return tNear <= tFar;
+    }
+
+    // A node's share of the SAH cost, before dividing by the root area
+    static double weightedAreaOf(const Node& node) {
+        return (double)area(node.bounds) * (node.isLeaf() ? (double)node.count : 1.0);
+    }
+
+    // SAH cost of the whole tree, relative to the root area. O(1): refits only adjust the
+    // sum for the nodes they change.
+    float cost() const {
+        if (nodes.empty() || area(nodes[0].bounds) <= 0.0f) return 0.0f;
+        return (float)(weightedArea / area(nodes[0].bounds));
+    }
+
+    void setBounds(int index, const AABB& box) {
+        weightedArea -= weightedAreaOf(nodes[index]);
+        nodes[index].bounds = box;
+        weightedArea += weightedAreaOf(nodes[index]);
+    }
+
+    void refitLeaf(int index) {
+        Node& node = nodes[index];
+        AABB box;
+        for (unsigned int i = node.first; i < node.first + node.count; i++) {
+            box.expand(bounds[items[i]]);
+            spheres.set(i, sphereOf(bounds[items[i]]));
+        }
+        setBounds(index, box);
+    }
+
+    void buildNode(int index, unsigned int first, unsigned int count, unsigned int depth) {
+        AABB box, centroids;
+        for (unsigned int i = first; i < first + count; i++) {
+            box.expand(bounds[items[i]]);
+            centroids.expand(bounds[items[i]].center());
+        }
+        nodes[index].bounds = box;
+        nodes[index].first = first;
+        nodes[index].count = count;
+
+        unsigned int split = (count <= MAX_LEAF_SIZE || depth >= MAX_DEPTH) ? 0 : findSplit(first, count, box, centroids);
+        if (split == 0) {
+            for (unsigned int i = first; i < first + count; i++) {
+                leafOf[items[i]] = index;
+            }
+            return;
+        }
+
+        int left = (int)nodes.size();
+        nodes.push_back(Node());
+        nodes.push_back(Node());
+        nodes[index].left = left;
+        nodes[index].right = left + 1;
+        nodes[left].parent = index;
+        nodes[left + 1].parent = index;
+
+        buildNode(left, first, split, depth + 1);
+        buildNode(left + 1, first + split, count - split, depth + 1);
+    }
+
+    // Partitions items [first, first + count) and returns the size of the left half, or 0 for a leaf
+    unsigned int findSplit(unsigned int first, unsigned int count, const AABB& box, const AABB& centroids) {
+        glm::vec3 extent = centroids.max - centroids.min;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+        // All centroids in one spot: split down the middle
+        if (extent[axis] <= 0.0f) {
+            return count / 2;
+        }
+
+        AABB binBounds[SAH_BINS];
+        unsigned int binCount[SAH_BINS] = {};
+        float scale = (float)SAH_BINS / extent[axis];
+        auto binOf = [&](unsigned int item) {
+            int bin = (int)((bounds[item].center()[axis] - centroids.min[axis]) * scale);
+            return (unsigned int)std::min(std::max(bin, 0), (int)SAH_BINS - 1);
+        };
+        for (unsigned int i = first; i < first + count; i++) {
+            unsigned int bin = binOf(items[i]);
+            binBounds[bin].expand(bounds[items[i]]);
+            binCount[bin]++;
+        }
+
+        // Sweep from the right, then from the left, to price every bin boundary
+        float rightArea[SAH_BINS];
+        unsigned int rightCount[SAH_BINS];
+        AABB sweep;
+        unsigned int sweepCount = 0;
+        for (int b = SAH_BINS - 1; b > 0; b--) {
+            sweep.expand(binBounds[b]);
+            sweepCount += binCount[b];
+            rightArea[b] = area(sweep);
+            rightCount[b] = sweepCount;
+        }
+
+        float bestCost = FLT_MAX;
+        unsigned int bestBin = 0;
+        sweep = AABB();
+        sweepCount = 0;
+        for (unsigned int b = 1; b < SAH_BINS; b++) {
+            sweep.expand(binBounds[b - 1]);
+            sweepCount += binCount[b - 1];
+            if (sweepCount == 0 || rightCount[b] == 0) continue;
+            float splitCost = area(sweep) * sweepCount + rightArea[b] * rightCount[b];
+            if (splitCost < bestCost) {
+                bestCost = splitCost;
+                bestBin = b;
+            }
+        }
+
+        // Traversal cost of one extra node against testing everything in a single leaf
+        float leafCost = area(box) * count;
+        if (bestBin == 0 || bestCost + area(box) >= leafCost) {
+            return 0;
+        }
+
+        auto middle = std::partition(items.begin() + first, items.begin() + first + count, [&](unsigned int item) {
+            return binOf(item) < bestBin;
+        });
+        return (unsigned int)(middle - (items.begin() + first));
+    }
+
+    template<typename IndexList, typename Test>
+    void query(IndexList& out, Test test) const {
+        if (nodes.empty()) return;
+
+        int stack[64];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const Node& node = nodes[stack[--top]];
+            if (!test(node.bounds)) {
+                continue;
+            }
+            if (node.isLeaf()) {
+                for (unsigned int i = node.first; i < node.first + node.count; i++) {
+                    if (test(bounds[items[i]])) {
+                        out.push_back(items[i]);
+                    }
+                }
+                continue;
+            }
+            stack[top++] = node.right;
+            stack[top++] = node.left;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm.hpp>
+
+#include "bounds.h"
+
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRUSTUM_SSE 1
+#endif
+
+enum Frustum_Result {
+    FRUSTUM_OUTSIDE,
+    FRUSTUM_INTERSECTS,
+    FRUSTUM_INSIDE
+};
+
+enum Frustum_Plane {
+    PLANE_LEFT,
+    PLANE_RIGHT,
+    PLANE_BOTTOM,
+    PLANE_TOP,
+    PLANE_NEAR,
+    PLANE_FAR
+};
+
+// Six planes (xyz = inward normal, w = distance) pulled out of a view-projection matrix
+struct Frustum {
+    glm::vec4 planes[6];
+
+    Frustum() = default;
+
+    explicit Frustum(const glm::mat4& viewProjection) {
+        // Gribb-Hartmann: combine the rows of the clip matrix
+        glm::vec4 row0(viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0]);
+        glm::vec4 row1(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1]);
+        glm::vec4 row2(viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2]);
+        glm::vec4 row3(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+
+        planes[PLANE_LEFT]   = row3 + row0;
+        planes[PLANE_RIGHT]  = row3 - row0;
+        planes[PLANE_BOTTOM] = row3 + row1;
+        planes[PLANE_TOP]    = row3 - row1;
+        planes[PLANE_NEAR]   = row3 + row2;
+        planes[PLANE_FAR]    = row3 - row2;
+
+        for (glm::vec4& plane : planes) {
+            plane /= glm::length(glm::vec3(plane));
+        }
+    }
+
+    bool containsSphere(const BoundingSphere& sphere) const {
+        for (const glm::vec4& plane : planes) {
+            if (glm::dot(glm::vec3(plane), sphere.center) + plane.w < -sphere.radius) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool intersectsAABB(const AABB& box) const {
+        for (const glm::vec4& plane : planes) {
+            // Corner furthest along the plane normal
+            glm::vec3 positive(plane.x >= 0.0f ? box.max.x : box.min.x,
+                               plane.y >= 0.0f ? box.max.y : box.min.y,
+                               plane.z >= 0.0f ? box.max.z : box.min.z);
+            if (glm::dot(glm::vec3(plane), positive) + plane.w < 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Like intersectsAABB, but also reports boxes that are entirely inside
+    Frustum_Result classifyAABB(const AABB& box) const {
+        Frustum_Result result = FRUSTUM_INSIDE;
+        for (const glm::vec4& plane : planes) {
+            glm::vec3 positive(plane.x >= 0.0f ? box.max.x : box.min.x,
+                               plane.y >= 0.0f ? box.max.y : box.min.y,
+                               plane.z >= 0.0f ? box.max.z : box.min.z);
+            if (glm::dot(glm::vec3(plane), positive) + plane.w < 0.0f) {
+                return FRUSTUM_OUTSIDE;
+            }
+
+            glm::vec3 negative(plane.x >= 0.0f ? box.min.x : box.max.x,
+                               plane.y >= 0.0f ? box.min.y : box.max.y,
+                               plane.z >= 0.0f ? box.min.z : box.max.z);
+            if (glm::dot(glm::vec3(plane), negative) + plane.w < 0.0f) {
+                result = FRUSTUM_INTERSECTS;
+            }
+        }
+        return result;
+    }
+};
+
+// Bounding spheres of every instance in a view, stored as separate x/y/z/radius arrays so
+// four spheres are tested per plane in one go
+class CullingSet {
+public:
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> radius;
+
+    void clear() {
+        x.clear();
+        y.clear();
+        z.clear();
+        radius.clear();
+    }
+
+    unsigned int size() const {
+        return (unsigned int)x.size();
+    }
+
+    unsigned int add(const BoundingSphere& sphere) {
+        x.push_back(sphere.center.x);
+        y.push_back(sphere.center.y);
+        z.push_back(sphere.center.z);
+        radius.push_back(sphere.radius);
+        return size() - 1;
+    }
+
+    void set(unsigned int index, const BoundingSphere& sphere) {
+        x[index] = sphere.center.x;
+        y[index] = sphere.center.y;
+        z[index] = sphere.center.z;
+        radius[index] = sphere.radius;
+    }
+
+    // Appends the indices of spheres that touch the frustum to visible (any vector of unsigned int)
+    template<typename IndexList>
+    void cull(const Frustum& frustum, IndexList& visible) const {
+        cullRange(frustum, 0, size(), visible);
+    }
+
+    // Same as cull, limited to spheres [first, last)
+    template<typename IndexList>
+    void cullRange(const Frustum& frustum, unsigned int first, unsigned int last, IndexList& visible) const {
+        unsigned int count = last;
+        unsigned int i = first;
+
+#ifdef FRUSTUM_SSE
+        __m128 px[6], py[6], pz[6], pw[6];
+        for (int p = 0; p < 6; p++) {
+            px[p] = _mm_set1_ps(frustum.planes[p].x);
+            py[p] = _mm_set1_ps(frustum.planes[p].y);
+            pz[p] = _mm_set1_ps(frustum.planes[p].z);
+            pw[p] = _mm_set1_ps(frustum.planes[p].w);
+        }
+
+        for (; i + 4 <= count; i += 4) {
+            __m128 cx = _mm_loadu_ps(&x[i]);
+            __m128 cy = _mm_loadu_ps(&y[i]);
+            __m128 cz = _mm_loadu_ps(&z[i]);
+            __m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&radius[i]));
+
+            __m128 outside = _mm_setzero_ps();
+            for (int p = 0; p < 6; p++) {
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px[p], cx), _mm_mul_ps(py[p], cy)),
+                                             _mm_add_ps(_mm_mul_ps(pz[p], cz), pw[p]));
+                outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, negRadius));
+            }
+
+            int mask = ~_mm_movemask_ps(outside) & 0xF;
+            while (mask) {
+                int lane = lowestLane(mask);
+                visible.push_back(i + lane);
+                mask &= mask - 1;
+            }
+        }
+#endif
+
+        // Remainder (or everything without SSE)
+        for (; i < count; i++) {
+            if (frustum.containsSphere(BoundingSphere{glm::vec3(x[i], y[i], z[i]), radius[i]})) {
+                visible.push_back(i);
+            }
+        }
+    }
+
+private:
+    static int lowestLane(int mask) {
+        int lane = 0;
+        while (!(mask & 1)) {
+            mask >>= 1;
+            lane++;
+        }
+        return lane;
+    }
+};
+
+#endif
@@ -0,0 +1,366 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <glm.hpp>
+
+#include "bounds.h"
+#include "jobSystem.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OCCLUSION_SSE 1
+#endif
+
+// Software occlusion culling: designated occluder meshes are rasterised into a small depth
+// buffer by a job, reduced to a max-depth (hierarchical Z) pyramid, and instance
+// boxes are tested against it before anything is submitted to the GPU.
+class OcclusionCuller {
+public:
+    static const int WIDTH = 256;   // Multiple of 4 for the SIMD row loop
+    static const int HEIGHT = 144;
+
+    // Counters for the last finished frame
+    unsigned int rasterizedTriangles = 0;
+    unsigned int testedBoxes = 0;
+    unsigned int occludedBoxes = 0;
+
+    explicit OcclusionCuller(JobSystem& jobSystem) : jobs(jobSystem) {
+        int w = WIDTH, h = HEIGHT;
+        while (true) {
+            levels.push_back(Level{w, h, std::vector<float>((size_t)w * h, 1.0f)});
+            if (w == 1 && h == 1) break;
+            w = std::max(1, (w + 1) / 2);
+            h = std::max(1, (h + 1) / 2);
+        }
+    }
+
+    ~OcclusionCuller() {
+        jobs.wait(rasterized);
+    }
+
+    OcclusionCuller(const OcclusionCuller&) = delete;
+    OcclusionCuller& operator=(const OcclusionCuller&) = delete;
+
+    // Occluders are gathered each frame; the vertex data must stay alive until finishFrame()
+    void clearOccluders() {
+        occluders.clear();
+    }
+
+    void addOccluder(const float* positions, size_t stride, const unsigned int* indices, size_t indexCount, const glm::mat4& model) {
+        occluders.push_back(Occluder{positions, stride, indices, indexCount, model});
+    }
+
+    // Start rasterising this frame's occluders as a job
+    void beginFrame(const glm::mat4& viewProjection) {
+        jobs.wait(rasterized);
+        this->viewProjection = viewProjection;
+        jobs.run([this] { rasterize(); }, &rasterized);
+    }
+
+    // Wait (running other jobs meanwhile) until the hierarchical Z buffer for this frame is ready
+    void finishFrame() {
+        PROFILE_SCOPE("Occlusion Wait");
+        jobs.wait(rasterized);
+        testedBoxes = 0;
+        occludedBoxes = 0;
+    }
+
+    // False only if the box is certainly hidden behind the occluders
+    bool isVisible(const AABB& box) {
+        testedBoxes++;
+        if (!box.valid()) return true;
+
+        float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+        float nearest = FLT_MAX;
+        for (int corner = 0; corner < 8; corner++) {
+            glm::vec4 clip = viewProjection * glm::vec4(corner & 1 ? box.max.x : box.min.x,
+                                                        corner & 2 ? box.max.y : box.min.y,
+                                                        corner & 4 ? box.max.z : box.min.z, 1.0f);
+            // Crosses the near plane: cannot be judged in screen space
+            if (clip.w <= NEAR_W || clip.z < -clip.w) return true;
+
+            float invW = 1.0f / clip.w;
+            float x = (clip.x * invW * 0.5f + 0.5f) * WIDTH;
+            float y = (clip.y * invW * 0.5f + 0.5f) * HEIGHT;
+            minX = std::min(minX, x);
+            maxX = std::max(maxX, x);
+            minY = std::min(minY, y);
+            maxY = std::max(maxY, y);
+            nearest = std::min(nearest, clip.z * invW * 0.5f + 0.5f);
+        }
+
+        int x0 = std::max(0, (int)std::floor(minX));
+        int y0 = std::max(0, (int)std::floor(minY));
+        int x1 = std::min(WIDTH - 1, (int)std::floor(maxX));
+        int y1 = std::min(HEIGHT - 1, (int)std::floor(maxY));
+        if (x0 > x1 || y0 > y1) return true;  // Off-screen; the frustum test decides
+
+        // Coarsest level where the rectangle still spans at most two texels per axis
+        int span = std::max(x1 - x0, y1 - y0);
+        int level = 0;
+        while (span > 1 && level + 1 < (int)levels.size()) {
+            span >>= 1;
+            level++;
+        }
+
+        const Level& lvl = levels[level];
+        float farthest = 0.0f;
+        for (int y = y0 >> level; y <= std::min(lvl.height - 1, y1 >> level); y++) {
+            for (int x = x0 >> level; x <= std::min(lvl.width - 1, x1 >> level); x++) {
+                farthest = std::max(farthest, lvl.depth[(size_t)y * lvl.width + x]);
+            }
+        }
+
+        if (nearest > farthest + DEPTH_BIAS) {
+            occludedBoxes++;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static constexpr float NEAR_W = 1e-4f;
+    static constexpr float DEPTH_BIAS = 1e-4f;
+
+    struct Occluder {
+        const float* positions;
+        size_t stride;
+        const unsigned int* indices;
+        size_t indexCount;
+        glm::mat4 model;
+    };
+
+    struct Level {
+        int width;
+        int height;
+        std::vector<float> depth;   // Max (farthest) depth of the texels below
+    };
+
+    std::vector<Occluder> occluders;
+    std::vector<Level> levels;
+    std::vector<glm::vec4> screen;  // Per-vertex scratch: x, y, depth, w
+    std::vector<int> facing;        // Per-triangle scratch
+    std::unordered_map<const unsigned int*, std::vector<int>> adjacency;
+    glm::mat4 viewProjection = glm::mat4(1.0f);
+
+    JobSystem& jobs;
+    JobCounter rasterized;
+
+    void rasterize() {
+        PROFILE_SCOPE("Occlusion Rasterize");
+        std::vector<float>& depth = levels[0].depth;
+        std::fill(depth.begin(), depth.end(), 1.0f);
+        rasterizedTriangles = 0;
+
+        for (const Occluder& occluder : occluders) {
+            glm::mat4 mvp = viewProjection * occluder.model;
+
+            // Index range tells us how many vertices are referenced
+            unsigned int vertexCount = 0;
+            for (size_t i = 0; i < occluder.indexCount; i++) {
+                vertexCount = std::max(vertexCount, occluder.indices[i] + 1);
+            }
+            screen.resize(vertexCount);
+            for (unsigned int v = 0; v < vertexCount; v++) {
+                const float* p = (const float*)((const char*)occluder.positions + v * occluder.stride);
+                glm::vec4 clip = mvp * glm::vec4(p[0], p[1], p[2], 1.0f);
+                if (clip.w <= NEAR_W || clip.z < -clip.w) {
+                    screen[v] = glm::vec4(0.0f, 0.0f, 0.0f, -1.0f);
+                    continue;
+                }
+                float invW = 1.0f / clip.w;
+                screen[v] = glm::vec4((clip.x * invW * 0.5f + 0.5f) * WIDTH,
+                                      (clip.y * invW * 0.5f + 0.5f) * HEIGHT,
+                                      clip.z * invW * 0.5f + 0.5f,
+                                      clip.w);
+            }
+
+            // Winding of every triangle on screen (0 when dropped), so edges between two
+            // triangles facing the same way can be drawn without the conservative shrink
+            const std::vector<int>& neighbours = adjacencyFor(occluder);
+            size_t triangleCount = occluder.indexCount / 3;
+            facing.assign(triangleCount, 0);
+            for (size_t t = 0; t < triangleCount; t++) {
+                const glm::vec4& a = screen[occluder.indices[t * 3]];
+                const glm::vec4& b = screen[occluder.indices[t * 3 + 1]];
+                const glm::vec4& c = screen[occluder.indices[t * 3 + 2]];
+
+                // Triangles touching the near plane are dropped; losing occluders is always safe
+                if (a.w < 0.0f || b.w < 0.0f || c.w < 0.0f) continue;
+                float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+                facing[t] = area > 0.0f ? 1 : (area < 0.0f ? -1 : 0);
+            }
+
+            for (size_t t = 0; t < triangleCount; t++) {
+                if (facing[t] == 0) continue;
+
+                int shrink = 0;
+                for (int edge = 0; edge < 3; edge++) {
+                    int other = neighbours[t * 3 + edge];
+                    if (other < 0 || facing[other] != facing[t]) {
+                        shrink |= 1 << edge;
+                    }
+                }
+                drawTriangle(screen[occluder.indices[t * 3]], screen[occluder.indices[t * 3 + 1]],
+                             screen[occluder.indices[t * 3 + 2]], shrink, depth);
+            }
+        }
+
+        buildPyramid();
+    }
+
+    // Edge 0 is b-c, edge 1 is c-a, edge 2 is a-b; bits set in shrink mark edges that are
+    // silhouettes or open borders
+    void drawTriangle(glm::vec4 a, glm::vec4 b, glm::vec4 c, int shrink, std::vector<float>& depth) {
+        float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+        if (std::fabs(area) < 1e-8f) return;
+        if (area < 0.0f) {
+            // Swapping b and c turns edge c-a into a-b and vice versa
+            std::swap(b, c);
+            area = -area;
+            shrink = (shrink & 1) | ((shrink & 2) << 1) | ((shrink & 4) >> 1);
+        }
+
+        int minX = std::max(0, (int)std::floor(std::min(a.x, std::min(b.x, c.x))));
+        int maxX = std::min(WIDTH - 1, (int)std::ceil(std::max(a.x, std::max(b.x, c.x))));
+        int minY = std::max(0, (int)std::floor(std::min(a.y, std::min(b.y, c.y))));
+        int maxY = std::min(HEIGHT - 1, (int)std::ceil(std::max(a.y, std::max(b.y, c.y))));
+        if (minX > maxX || minY > maxY) return;
+        if (a.z > 1.0f && b.z > 1.0f && c.z > 1.0f) return;
+        rasterizedTriangles++;
+
+        // Edge functions E(x, y) = A x + B y + C, positive inside
+        float A0 = b.y - c.y, B0 = c.x - b.x, C0 = b.x * c.y - b.y * c.x;
+        float A1 = c.y - a.y, B1 = a.x - c.x, C1 = c.x * a.y - c.y * a.x;
+        float A2 = a.y - b.y, B2 = b.x - a.x, C2 = a.x * b.y - a.y * b.x;
+
+        // Screen-space depth plane z(x, y) = dzdx x + dzdy y + z0
+        float invArea = 1.0f / area;
+        float dzdx = (A0 * a.z + A1 * b.z + A2 * c.z) * invArea;
+        float dzdy = (B0 * a.z + B1 * b.z + B2 * c.z) * invArea;
+        float z0 = (C0 * a.z + C1 * b.z + C2 * c.z) * invArea;
+
+        // Stay conservative at this low resolution: across silhouette and border edges only
+        // pixels the triangle covers completely are written, and always with the farthest depth
+        // found anywhere inside the pixel. Thin geometry such as the wheel's lattice then hides
+        // nothing it does not really hide.
+        if (shrink & 1) C0 -= 0.5f * (std::fabs(A0) + std::fabs(B0));
+        if (shrink & 2) C1 -= 0.5f * (std::fabs(A1) + std::fabs(B1));
+        if (shrink & 4) C2 -= 0.5f * (std::fabs(A2) + std::fabs(B2));
+        z0 += 0.5f * (std::fabs(dzdx) + std::fabs(dzdy));
+
+        int startX = minX & ~3;
+        for (int y = minY; y <= maxY; y++) {
+            float py = y + 0.5f;
+            float* row = &depth[(size_t)y * WIDTH];
+#ifdef OCCLUSION_SSE
+            __m128 px = _mm_add_ps(_mm_set1_ps(startX + 0.5f), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
+            __m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(A0), px), _mm_set1_ps(B0 * py + C0));
+            __m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(A1), px), _mm_set1_ps(B1 * py + C1));
+            __m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(A2), px), _mm_set1_ps(B2 * py + C2));
+            __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(dzdx), px), _mm_set1_ps(dzdy * py + z0));
+            __m128 e0Step = _mm_set1_ps(A0 * 4.0f), e1Step = _mm_set1_ps(A1 * 4.0f), e2Step = _mm_set1_ps(A2 * 4.0f);
+            __m128 zStep = _mm_set1_ps(dzdx * 4.0f);
+            __m128 zero = _mm_setzero_ps();
+
+            for (int x = startX; x <= maxX; x += 4) {
+                __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+                if (_mm_movemask_ps(inside)) {
+                    __m128 current = _mm_loadu_ps(row + x);
+                    __m128 nearer = _mm_min_ps(current, z);
+                    _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, current)));
+                }
+                e0 = _mm_add_ps(e0, e0Step);
+                e1 = _mm_add_ps(e1, e1Step);
+                e2 = _mm_add_ps(e2, e2Step);
+                z = _mm_add_ps(z, zStep);
+            }
+#else
+            for (int x = startX; x <= maxX; x++) {
+                float px = x + 0.5f;
+                if (A0 * px + B0 * py + C0 >= 0.0f && A1 * px + B1 * py + C1 >= 0.0f && A2 * px + B2 * py + C2 >= 0.0f) {
+                    row[x] = std::min(row[x], dzdx * px + dzdy * py + z0);
+                }
+            }
+#endif
+        }
+    }
+
+    // Neighbouring triangle across each edge (-1 for none), matched on vertex positions since
+    // loaded meshes duplicate vertices per face. Built once per index buffer.
+    const std::vector<int>& adjacencyFor(const Occluder& occluder) {
+        std::vector<int>& neighbours = adjacency[occluder.indices];
+        size_t triangleCount = occluder.indexCount / 3;
+        if (neighbours.size() == triangleCount * 3) {
+            return neighbours;
+        }
+
+        auto positionKey = [&](unsigned int index) {
+            const float* p = (const float*)((const char*)occluder.positions + index * occluder.stride);
+            return glm::vec3(p[0], p[1], p[2]);
+        };
+        auto lessThan = [](const glm::vec3& l, const glm::vec3& r) {
+            if (l.x != r.x) return l.x < r.x;
+            if (l.y != r.y) return l.y < r.y;
+            return l.z < r.z;
+        };
+
+        struct Edge {
+            glm::vec3 from, to;
+            size_t slot;
+        };
+        std::vector<Edge> edges;
+        edges.reserve(triangleCount * 3);
+        for (size_t t = 0; t < triangleCount; t++) {
+            for (int edge = 0; edge < 3; edge++) {
+                glm::vec3 from = positionKey(occluder.indices[t * 3 + (edge + 1) % 3]);
+                glm::vec3 to = positionKey(occluder.indices[t * 3 + (edge + 2) % 3]);
+                if (lessThan(to, from)) std::swap(from, to);
+                edges.push_back(Edge{from, to, t * 3 + edge});
+            }
+        }
+        std::sort(edges.begin(), edges.end(), [&](const Edge& l, const Edge& r) {
+            if (l.from != r.from) return lessThan(l.from, r.from);
+            return lessThan(l.to, r.to);
+        });
+
+        // Only edges shared by exactly two triangles are interior
+        neighbours.assign(triangleCount * 3, -1);
+        for (size_t i = 0; i < edges.size();) {
+            size_t j = i + 1;
+            while (j < edges.size() && edges[j].from == edges[i].from && edges[j].to == edges[i].to) j++;
+            if (j - i == 2) {
+                neighbours[edges[i].slot] = (int)(edges[i + 1].slot / 3);
+                neighbours[edges[i + 1].slot] = (int)(edges[i].slot / 3);
+            }
+            i = j;
+        }
+        return neighbours;
+    }
+
+    void buildPyramid() {
+        for (size_t l = 1; l < levels.size(); l++) {
+            const Level& src = levels[l - 1];
+            Level& dst = levels[l];
+            for (int y = 0; y < dst.height; y++) {
+                int sy0 = std::min(src.height - 1, y * 2);
+                int sy1 = std::min(src.height - 1, y * 2 + 1);
+                for (int x = 0; x < dst.width; x++) {
+                    int sx0 = std::min(src.width - 1, x * 2);
+                    int sx1 = std::min(src.width - 1, x * 2 + 1);
+                    dst.depth[(size_t)y * dst.width + x] = std::max(
+                            std::max(src.depth[(size_t)sy0 * src.width + sx0], src.depth[(size_t)sy0 * src.width + sx1]),
+                            std::max(src.depth[(size_t)sy1 * src.width + sx0], src.depth[(size_t)sy1 * src.width + sx1]));
+                }
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,291 @@
+#ifndef INPUT_RECORDER_H
+#define INPUT_RECORDER_H
+
+#include <GLFW/glfw3.h>
+#include <logger.h>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+enum Input_Mode {
+    INPUT_LIVE,
+    INPUT_RECORD,
+    INPUT_REPLAY
+};
+
+// Keys the app polls; a frame stores their states as one bit each
+static const int INPUT_KEYS[] = {
+    GLFW_KEY_ESCAPE, GLFW_KEY_E, GLFW_KEY_P, GLFW_KEY_0, GLFW_KEY_W, GLFW_KEY_S, GLFW_KEY_A, GLFW_KEY_D,
+    GLFW_KEY_LEFT_SHIFT, GLFW_KEY_SPACE, GLFW_KEY_LEFT_CONTROL, GLFW_KEY_T, GLFW_KEY_C, GLFW_KEY_H,
+    GLFW_KEY_UP, GLFW_KEY_DOWN, GLFW_KEY_RIGHT, GLFW_KEY_LEFT
+};
+
+// Records everything that drives a frame (its time step, the polled keys and the cursor,
+// scroll and key callbacks) to a binary file, and plays it back. A replay steps exactly as
+// the recording did, whatever the real frame times, so two runs of the same recording
+// simulate and render the same frames and their frame stats can be compared directly.
+//
+// Key polling goes through getKey() instead of glfwGetKey(); callbacks are registered with
+// setCallbacks() instead of GLFW. While replaying, live input is ignored.
+//
+// File: "FWIR", version, key count, then per frame: time step (double), key bits (uint32),
+// event count (uint16) and the events (type byte + 16 bytes of arguments).
+class InputRecorder {
+public:
+    static const uint32_t VERSION = 1;
+    static const unsigned int KEY_COUNT = sizeof(INPUT_KEYS) / sizeof(INPUT_KEYS[0]);
+    static const size_t FLUSH_BYTES = 1 << 16;
+
+    ~InputRecorder() {
+        stop();
+    }
+
+    Input_Mode mode() const {
+        return inputMode;
+    }
+
+    bool isReplaying() const {
+        return inputMode == INPUT_REPLAY;
+    }
+
+    unsigned int replayFrames() const {
+        return (unsigned int)frameOffsets.size();
+    }
+
+    bool startRecording(const std::string& path) {
+        file.open(path, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            logger.log(LOG_ERROR, "ERROR::INPUT::FILE_NOT_WRITABLE %s", path.c_str());
+            return false;
+        }
+        buffer.reserve(FLUSH_BYTES * 2);
+        buffer.insert(buffer.end(), MAGIC, MAGIC + 4);
+        put(VERSION);
+        put((uint32_t)KEY_COUNT);
+        inputMode = INPUT_RECORD;
+        return true;
+    }
+
+    bool startReplay(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+        uint32_t version = 0, keyCount = 0;
+        readPosition = 4;
+        if (buffer.size() < 12 || std::memcmp(buffer.data(), MAGIC, 4) != 0 || !get(version) || !get(keyCount)
+            || version != VERSION || keyCount != KEY_COUNT) {
+            logger.log(LOG_ERROR, "ERROR::INPUT::RECORDING_NOT_READABLE %s", path.c_str());
+            buffer.clear();
+            return false;
+        }
+
+        // Index the frames up front; a cut-off last frame is dropped
+        while (true) {
+            size_t start = readPosition;
+            double frameSeconds;
+            uint32_t keys;
+            uint16_t events;
+            if (!get(frameSeconds) || !get(keys) || !get(events) || buffer.size() - readPosition < events * EVENT_BYTES) break;
+            readPosition += events * EVENT_BYTES;
+            frameOffsets.push_back(start);
+        }
+        nextFrame = 0;
+        inputMode = INPUT_REPLAY;
+        logger.log(LOG_INFO, "Input: replaying %u frames from %s", replayFrames(), path.c_str());
+        return true;
+    }
+
+    // Writes out what is left of a recording
+    void stop() {
+        if (inputMode == INPUT_RECORD) {
+            flush();
+            file.close();
+        }
+        inputMode = INPUT_LIVE;
+    }
+
+    void setCallbacks(GLFWwindow* window, GLFWcursorposfun cursor, GLFWscrollfun scroll, GLFWkeyfun key) {
+        cursorCallback = cursor;
+        scrollCallback = scroll;
+        keyCallback = key;
+        glfwSetCursorPosCallback(window, onCursor);
+        glfwSetScrollCallback(window, onScroll);
+        glfwSetKeyCallback(window, onKey);
+    }
+
+    // Call at the top of every frame with the measured step; a replay swaps in the recorded
+    // one. False once a replay has run out of frames.
+    bool beginFrame(double& frameSeconds) {
+        if (inputMode == INPUT_RECORD) {
+            frameStart = buffer.size();
+            frameOpen = true;
+            put(frameSeconds);
+            put((uint32_t)0);
+            put((uint16_t)0);
+        }
+        else if (inputMode == INPUT_REPLAY) {
+            if (nextFrame == frameOffsets.size()) return false;
+            readPosition = frameOffsets[nextFrame++];
+            uint16_t events = 0;
+            get(frameSeconds);
+            get(replayKeys);
+            get(events);
+            replayEvents = events;
+        }
+        return true;
+    }
+
+    // glfwGetKey() that records or replays
+    int getKey(GLFWwindow* window, int key) {
+        if (inputMode == INPUT_LIVE) return glfwGetKey(window, key);
+
+        int bit = keyBit(key);
+        if (inputMode == INPUT_REPLAY) {
+            return bit >= 0 && (replayKeys >> bit & 1u) ? GLFW_PRESS : GLFW_RELEASE;
+        }
+
+        int state = glfwGetKey(window, key);
+        if (bit >= 0 && state == GLFW_PRESS && frameOpen) {
+            uint32_t keys;
+            std::memcpy(&keys, buffer.data() + frameStart + sizeof(double), sizeof(keys));
+            keys |= 1u << bit;
+            std::memcpy(buffer.data() + frameStart + sizeof(double), &keys, sizeof(keys));
+        }
+        return state;
+    }
+
+    // Call after glfwPollEvents(): a replay delivers the frame's recorded callbacks here
+    void endFrame(GLFWwindow* window) {
+        if (inputMode == INPUT_RECORD) {
+            frameOpen = false;
+            if (buffer.size() >= FLUSH_BYTES) flush();
+            return;
+        }
+        if (inputMode != INPUT_REPLAY) return;
+
+        for (uint16_t i = 0; i < replayEvents; i++) {
+            uint8_t type = 0;
+            get(type);
+            if (type == EVENT_KEY) {
+                int32_t key = 0, scancode = 0, action = 0, mods = 0;
+                get(key); get(scancode); get(action); get(mods);
+                if (keyCallback) keyCallback(window, key, scancode, action, mods);
+            }
+            else {
+                double x = 0.0, y = 0.0;
+                get(x); get(y);
+                if (type == EVENT_CURSOR && cursorCallback) cursorCallback(window, x, y);
+                if (type == EVENT_SCROLL && scrollCallback) scrollCallback(window, x, y);
+            }
+        }
+        replayEvents = 0;
+    }
+
+private:
+    enum Event_Type : uint8_t {
+        EVENT_CURSOR,
+        EVENT_SCROLL,
+        EVENT_KEY
+    };
+
+    static constexpr char MAGIC[4] = {'F', 'W', 'I', 'R'};
+    static const size_t EVENT_BYTES = 1 + 16;
+
+    Input_Mode inputMode = INPUT_LIVE;
+    GLFWcursorposfun cursorCallback = nullptr;
+    GLFWscrollfun scrollCallback = nullptr;
+    GLFWkeyfun keyCallback = nullptr;
+
+    // Recording: frames build up here and go to the file in blocks
+    std::ofstream file;
+    std::vector<char> buffer;
+    size_t frameStart = 0;
+    bool frameOpen = false;     // Events outside a frame (before the loop) aren't kept
+
+    // Replay: the whole file, indexed by frame
+    std::vector<size_t> frameOffsets;
+    size_t nextFrame = 0;
+    size_t readPosition = 0;
+    uint32_t replayKeys = 0;
+    uint16_t replayEvents = 0;
+
+    static int keyBit(int key) {
+        for (unsigned int i = 0; i < KEY_COUNT; i++) {
+            if (INPUT_KEYS[i] == key) return (int)i;
+        }
+        return -1;
+    }
+
+    template<typename T>
+    void put(T value) {
+        const char* bytes = (const char*)&value;
+        buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+    }
+
+    template<typename T>
+    bool get(T& value) {
+        if (buffer.size() - readPosition < sizeof(T)) return false;
+        std::memcpy(&value, buffer.data() + readPosition, sizeof(T));
+        readPosition += sizeof(T);
+        return true;
+    }
+
+    void flush() {
+        file.write(buffer.data(), buffer.size());
+        file.flush();
+        buffer.clear();
+    }
+
+    void addEvent(uint8_t type, const char* arguments) {
+        if (!frameOpen) return;
+        uint16_t events;
+        size_t countOffset = frameStart + sizeof(double) + sizeof(uint32_t);
+        std::memcpy(&events, buffer.data() + countOffset, sizeof(events));
+        if (events == UINT16_MAX) return;
+        events++;
+        std::memcpy(buffer.data() + countOffset, &events, sizeof(events));
+
+        put(type);
+        buffer.insert(buffer.end(), arguments, arguments + 16);
+    }
+
+    // GLFW callbacks: live input is recorded and passed on, or dropped during a replay
+    static void onCursor(GLFWwindow* window, double x, double y);
+    static void onScroll(GLFWwindow* window, double x, double y);
+    static void onKey(GLFWwindow* window, int key, int scancode, int action, int mods);
+};
+
+inline InputRecorder inputRecorder;
+
+inline void InputRecorder::onCursor(GLFWwindow* window, double x, double y) {
+    if (inputRecorder.isReplaying()) return;
+    if (inputRecorder.inputMode == INPUT_RECORD) {
+        double arguments[2] = {x, y};
+        inputRecorder.addEvent(EVENT_CURSOR, (const char*)arguments);
+    }
+    if (inputRecorder.cursorCallback) inputRecorder.cursorCallback(window, x, y);
+}
+
+inline void InputRecorder::onScroll(GLFWwindow* window, double x, double y) {
+    if (inputRecorder.isReplaying()) return;
+    if (inputRecorder.inputMode == INPUT_RECORD) {
+        double arguments[2] = {x, y};
+        inputRecorder.addEvent(EVENT_SCROLL, (const char*)arguments);
+    }
+    if (inputRecorder.scrollCallback) inputRecorder.scrollCallback(window, x, y);
+}
+
+inline void InputRecorder::onKey(GLFWwindow* window, int key, int scancode, int action, int mods) {
+    if (inputRecorder.isReplaying()) return;
+    if (inputRecorder.inputMode == INPUT_RECORD) {
+        int32_t arguments[4] = {key, scancode, action, mods};
+        inputRecorder.addEvent(EVENT_KEY, (const char*)arguments);
+    }
+    if (inputRecorder.keyCallback) inputRecorder.keyCallback(window, key, scancode, action, mods);
+}
+
+#endif
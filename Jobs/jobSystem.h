@@ -0,0 +1,289 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include "profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobSystem;
+
+struct Job {
+    std::function<void()> work;
+    class JobCounter* counter = nullptr;
+    bool mainThread = false;
+};
+
+// Tracks a group of jobs. Waiting on it helps run queued work; jobs queued "after" it start
+// once every job counted on it has finished.
+class JobCounter {
+public:
+    bool done() const {
+        return pending.load(std::memory_order_acquire) == 0;
+    }
+
+private:
+    friend class JobSystem;
+
+    std::atomic<int> pending{0};
+    std::mutex mutex;
+    std::vector<Job> continuations;     // Queued when pending reaches zero
+};
+
+// Work-stealing scheduler. Every thread has its own deque: the owner pushes and pops at the
+// back (newest first, still warm in cache), idle threads steal from the front of the others.
+// The thread that created the system is thread 0; it runs jobs while it waits and is the only
+// thread that runs main-thread jobs (GL calls), drained by pumpMainThread() or wait().
+class JobSystem {
+public:
+    // Stats
+    std::atomic<unsigned long long> executedJobs{0};
+    std::atomic<unsigned long long> stolenJobs{0};
+
+    // One less than the cores: the main thread works too
+    static unsigned int defaultWorkerCount() {
+        unsigned int cores = std::thread::hardware_concurrency();
+        return cores > 1 ? cores - 1 : 0;
+    }
+
+    explicit JobSystem(unsigned int workerCount = defaultWorkerCount()) {
+        for (unsigned int i = 0; i <= workerCount; i++) {
+            queues.push_back(std::make_unique<Queue>());
+        }
+        mainThreadId = std::this_thread::get_id();
+        currentSystem = this;
+        currentIndex = 0;
+
+        for (unsigned int i = 1; i <= workerCount; i++) {
+            workers.emplace_back(&JobSystem::workerLoop, this, i);
+        }
+    }
+
+    ~JobSystem() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            quit = true;
+        }
+        sleep.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        if (currentSystem == this) currentSystem = nullptr;
+    }
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    unsigned int threadCount() const {
+        return (unsigned int)queues.size();
+    }
+
+    // Queue work on any thread. counter (optional) counts it until it finishes; with after,
+    // it waits for that counter to reach zero before it can start.
+    void run(std::function<void()> work, JobCounter* counter = nullptr, JobCounter* after = nullptr) {
+        schedule(Job{std::move(work), counter, false}, after);
+    }
+
+    // Same, but only ever run by the main thread
+    void runOnMainThread(std::function<void()> work, JobCounter* counter = nullptr, JobCounter* after = nullptr) {
+        schedule(Job{std::move(work), counter, true}, after);
+    }
+
+    // body(begin, end) over [0, count) in chunks of grain. Small ranges run inline; otherwise
+    // the chunks are counted on counter and the caller waits on it.
+    template<typename Body>
+    void parallelFor(unsigned int count, unsigned int grain, Body body, JobCounter& counter) {
+        grain = std::max(grain, 1u);
+        if (count <= grain) {
+            if (count > 0) body(0u, count);
+            return;
+        }
+        for (unsigned int begin = 0; begin < count; begin += grain) {
+            unsigned int end = std::min(begin + grain, count);
+            run([body, begin, end] { body(begin, end); }, &counter);
+        }
+    }
+
+    // Run jobs until counter reaches zero
+    void wait(JobCounter& counter) {
+        bool onMainThread = std::this_thread::get_id() == mainThreadId;
+        while (!counter.done()) {
+            if (onMainThread && pumpMainThread()) continue;
+
+            Job job;
+            if (take(indexOfThisThread(), job)) {
+                execute(job);
+            }
+            else {
+                std::this_thread::yield();
+            }
+        }
+
+        // The last job drops pending to zero under the mutex; taking it here means that job
+        // has finished with the counter before the caller can destroy it
+        std::lock_guard<std::mutex> lock(counter.mutex);
+    }
+
+    // Run the queued main-thread jobs; returns false if there were none
+    bool pumpMainThread() {
+        if (pumping) return false;
+        {
+            std::lock_guard<std::mutex> lock(mainMutex);
+            if (mainQueue.empty()) return false;
+            mainReady.swap(mainQueue);
+        }
+
+        // Swapping keeps both vectors' capacity, so pumping doesn't allocate
+        pumping = true;
+        for (Job& job : mainReady) {
+            execute(job);
+        }
+        mainReady.clear();
+        pumping = false;
+        return true;
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::thread::id mainThreadId;
+
+    std::mutex mainMutex;
+    std::vector<Job> mainQueue;
+    std::vector<Job> mainReady;     // Being run by pumpMainThread()
+    bool pumping = false;
+
+    // Idle workers sleep until something is queued
+    std::atomic<int> queuedJobs{0};
+    std::mutex sleepMutex;
+    std::condition_variable sleep;
+    bool quit = false;
+
+    static inline thread_local JobSystem* currentSystem = nullptr;
+    static inline thread_local unsigned int currentIndex = 0;
+
+    // Threads that aren't ours push onto the main thread's deque
+    unsigned int indexOfThisThread() const {
+        return currentSystem == this ? currentIndex : 0;
+    }
+
+    void schedule(Job job, JobCounter* after) {
+        if (job.counter) {
+            job.counter->pending.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (after) {
+            std::lock_guard<std::mutex> lock(after->mutex);
+            if (!after->done()) {
+                after->continuations.push_back(std::move(job));
+                return;
+            }
+        }
+        push(std::move(job));
+    }
+
+    void push(Job job) {
+        if (job.mainThread) {
+            std::lock_guard<std::mutex> lock(mainMutex);
+            mainQueue.push_back(std::move(job));
+            return;
+        }
+
+        Queue& queue = *queues[indexOfThisThread()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.jobs.push_back(std::move(job));
+        }
+        queuedJobs.fetch_add(1, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        sleep.notify_one();
+    }
+
+    // Own deque from the back, then steal from the front of the others
+    bool take(unsigned int index, Job& job) {
+        {
+            Queue& own = *queues[index];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.jobs.empty()) {
+                job = std::move(own.jobs.back());
+                own.jobs.pop_back();
+                queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+
+        for (unsigned int offset = 1; offset < queues.size(); offset++) {
+            Queue& victim = *queues[(index + offset) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.jobs.empty()) {
+                job = std::move(victim.jobs.front());
+                victim.jobs.pop_front();
+                queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+                stolenJobs.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void execute(Job& job) {
+        {
+            PROFILE_SCOPE("Job");
+            job.work();
+        }
+        executedJobs.fetch_add(1, std::memory_order_relaxed);
+
+        JobCounter* counter = job.counter;
+        if (counter) {
+            // Decrement and take the continuations under one lock, so a waiter can't see zero
+            // and free the counter while it is still being touched here
+            std::vector<Job> ready;
+            {
+                std::lock_guard<std::mutex> lock(counter->mutex);
+                if (counter->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    ready.swap(counter->continuations);
+                }
+            }
+            for (Job& next : ready) {
+                push(std::move(next));
+            }
+        }
+    }
+
+    void workerLoop(unsigned int index) {
+        currentSystem = this;
+        currentIndex = index;
+
+        char name[32];
+        std::snprintf(name, sizeof(name), "Worker %u", index);
+        profiler.setThreadName(name);
+
+        while (true) {
+            Job job;
+            if (take(index, job)) {
+                execute(job);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            sleep.wait(lock, [this] { return quit || queuedJobs.load(std::memory_order_acquire) > 0; });
+            if (quit) return;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,290 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include <glad/glad.h>
+#include <glm.hpp>
+
+#include <glState.h>
+#include <shader_s.h>
+#include <profiler.h>
+#include <gpuMemory.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+struct PointLight {
+    glm::vec3 position;
+
+    float constant;
+    float linear;
+    float quadratic;
+
+    glm::vec3 ambient;
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+
+    // Distance at which the brightest channel falls below LIGHT_CUTOFF
+    float range() const {
+        float peak = std::max(std::max(ambient.x, std::max(ambient.y, ambient.z)),
+                              std::max(std::max(diffuse.x, std::max(diffuse.y, diffuse.z)),
+                                       std::max(specular.x, std::max(specular.y, specular.z))));
+        float target = peak / LIGHT_CUTOFF;
+        if (target <= constant) return 0.0f;
+
+        // Solve quadratic * d^2 + linear * d + (constant - target) = 0
+        if (quadratic > 0.0f) {
+            float b = linear, c = constant - target;
+            return (-b + std::sqrt(b * b - 4.0f * quadratic * c)) / (2.0f * quadratic);
+        }
+        if (linear > 0.0f) return (target - constant) / linear;
+        return 1e30f;
+    }
+
+    static constexpr float LIGHT_CUTOFF = 1.0f / 256.0f;
+};
+
+// std430 layout shared with the fragment shader
+struct GpuPointLight {
+    glm::vec4 position;     // w = range
+    glm::vec4 attenuation;  // constant, linear, quadratic
+    glm::vec4 ambient;
+    glm::vec4 diffuse;
+    glm::vec4 specular;
+};
+
+// Clustered (froxel) light culling. The view frustum is cut into a 16x9 grid of screen tiles
+// and 24 exponential depth slices; every frame the CPU lists the point lights whose range
+// reaches each cluster, and the fragment shader only loops over its own cluster's list.
+class LightClusters {
+public:
+    static const unsigned int TILES_X = 16;
+    static const unsigned int TILES_Y = 9;
+    static const unsigned int SLICES = 24;
+    static const unsigned int CLUSTER_COUNT = TILES_X * TILES_Y * SLICES;
+    static const unsigned int MAX_LIGHTS_PER_CLUSTER = 128;   // Bounds the per-fragment loop
+
+    // Binding points used by the shaders
+    static const unsigned int LIGHT_BINDING = 0;
+    static const unsigned int CLUSTER_BINDING = 1;
+    static const unsigned int INDEX_BINDING = 2;
+
+    std::vector<PointLight> lights;
+
+    // Stats for the last build
+    unsigned int assignedLights = 0;
+    unsigned int maxLightsInCluster = 0;
+
+    LightClusters() {
+        glGenBuffers(1, &lightBuffer);
+        glGenBuffers(1, &clusterBuffer);
+        glGenBuffers(1, &indexBuffer);
+    }
+
+    ~LightClusters() {
+        glState.forgetBuffer(lightBuffer);
+        glState.forgetBuffer(clusterBuffer);
+        glState.forgetBuffer(indexBuffer);
+        glDeleteBuffers(1, &lightBuffer);
+        glDeleteBuffers(1, &clusterBuffer);
+        glDeleteBuffers(1, &indexBuffer);
+        GpuMemory::bufferBytes -= lightBufferBytes + clusterBufferBytes + indexBufferBytes;
+    }
+
+    LightClusters(const LightClusters&) = delete;
+    LightClusters& operator=(const LightClusters&) = delete;
+
+    // Assign this frame's lights to clusters and upload the lists
+    void build(const glm::mat4& view, const glm::mat4& projection, float nearPlane, float farPlane, int width, int height) {
+        PROFILE_SCOPE("Light Clusters");
+        if (projection != cachedProjection || nearPlane != zNear || farPlane != zFar) {
+            cachedProjection = projection;
+            zNear = nearPlane;
+            zFar = farPlane;
+            buildClusterBounds();
+        }
+        screenWidth = width;
+        screenHeight = height;
+
+        // Count pass
+        std::vector<unsigned int>& counts = clusterCounts;
+        counts.assign(CLUSTER_COUNT, 0);
+        assignments.clear();
+        gpuLights.resize(lights.size());
+
+        for (unsigned int l = 0; l < lights.size(); l++) {
+            const PointLight& light = lights[l];
+            float range = light.range();
+            gpuLights[l] = GpuPointLight{glm::vec4(light.position, range),
+                                         glm::vec4(light.constant, light.linear, light.quadratic, 0.0f),
+                                         glm::vec4(light.ambient, 0.0f),
+                                         glm::vec4(light.diffuse, 0.0f),
+                                         glm::vec4(light.specular, 0.0f)};
+
+            glm::vec3 center = glm::vec3(view * glm::vec4(light.position, 1.0f));
+            forEachCluster(center, range, [&](unsigned int cluster) {
+                if (counts[cluster] < MAX_LIGHTS_PER_CLUSTER) {
+                    counts[cluster]++;
+                    assignments.push_back(glm::uvec2(l, cluster));
+                }
+            });
+        }
+
+        // Offsets, then scatter the light indices into place
+        clusterRanges.resize(CLUSTER_COUNT);
+        unsigned int offset = 0;
+        maxLightsInCluster = 0;
+        for (unsigned int c = 0; c < CLUSTER_COUNT; c++) {
+            clusterRanges[c] = glm::uvec2(offset, 0);
+            offset += counts[c];
+            maxLightsInCluster = std::max(maxLightsInCluster, counts[c]);
+        }
+        lightIndices.resize(std::max(offset, 1u));
+        for (const glm::uvec2& entry : assignments) {
+            glm::uvec2& range = clusterRanges[entry.y];
+            lightIndices[range.x + range.y++] = entry.x;
+        }
+        assignedLights = (unsigned int)assignments.size();
+
+        if (gpuLights.empty()) {
+            gpuLights.push_back(GpuPointLight{});
+        }
+        upload(lightBuffer, gpuLights.data(), gpuLights.size() * sizeof(GpuPointLight), lightBufferBytes);
+        upload(clusterBuffer, clusterRanges.data(), clusterRanges.size() * sizeof(glm::uvec2), clusterBufferBytes);
+        upload(indexBuffer, lightIndices.data(), lightIndices.size() * sizeof(unsigned int), indexBufferBytes);
+    }
+
+    // Bind the cluster buffers and lookup constants for a shader that uses them
+    void bind(Shader& shader) const {
+        glState.bindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_BINDING, lightBuffer);
+        glState.bindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_BINDING, clusterBuffer);
+        glState.bindBufferBase(GL_SHADER_STORAGE_BUFFER, INDEX_BINDING, indexBuffer);
+
+        float logRatio = std::log(zFar / zNear);
+        shader.setUVec3("clusterCount", TILES_X, TILES_Y, SLICES);
+        shader.setVec2("clusterTileSize", glm::vec2((float)screenWidth / TILES_X, (float)screenHeight / TILES_Y));
+        shader.setFloat("clusterScale", SLICES / logRatio);
+        shader.setFloat("clusterBias", -(float)SLICES * std::log(zNear) / logRatio);
+    }
+
+private:
+    unsigned int lightBuffer = 0;
+    unsigned int clusterBuffer = 0;
+    unsigned int indexBuffer = 0;
+    long long lightBufferBytes = 0;     // Current storage sizes, for GpuMemory
+    long long clusterBufferBytes = 0;
+    long long indexBufferBytes = 0;
+
+    glm::mat4 cachedProjection = glm::mat4(0.0f);
+    float zNear = 0.1f;
+    float zFar = 100.0f;
+    int screenWidth = 1;
+    int screenHeight = 1;
+
+    // View-space bounds of every cluster
+    std::vector<glm::vec3> clusterMin;
+    std::vector<glm::vec3> clusterMax;
+
+    // Scratch kept between frames
+    std::vector<unsigned int> clusterCounts;
+    std::vector<glm::uvec2> assignments;     // (light, cluster) pairs
+    std::vector<glm::uvec2> clusterRanges;
+    std::vector<unsigned int> lightIndices;
+    std::vector<GpuPointLight> gpuLights;
+
+    float sliceDepth(unsigned int slice) const {
+        return zNear * std::pow(zFar / zNear, (float)slice / SLICES);
+    }
+
+    unsigned int sliceOf(float depth) const {
+        float slice = std::log(depth / zNear) / std::log(zFar / zNear) * SLICES;
+        return (unsigned int)std::min(std::max(slice, 0.0f), (float)SLICES - 1.0f);
+    }
+
+    void buildClusterBounds() {
+        glm::mat4 inverseProjection = glm::inverse(cachedProjection);
+        clusterMin.resize(CLUSTER_COUNT);
+        clusterMax.resize(CLUSTER_COUNT);
+
+        for (unsigned int y = 0; y < TILES_Y; y++) {
+            for (unsigned int x = 0; x < TILES_X; x++) {
+                // Tile corners as view-space directions through the near plane
+                glm::vec3 corners[4];
+                for (int c = 0; c < 4; c++) {
+                    glm::vec2 ndc(((x + (c & 1)) / (float)TILES_X) * 2.0f - 1.0f,
+                                  ((y + (c >> 1)) / (float)TILES_Y) * 2.0f - 1.0f);
+                    glm::vec4 point = inverseProjection * glm::vec4(ndc, -1.0f, 1.0f);
+                    corners[c] = glm::vec3(point) / point.w;
+                }
+
+                for (unsigned int z = 0; z < SLICES; z++) {
+                    float depths[2] = {sliceDepth(z), sliceDepth(z + 1)};
+                    glm::vec3 lo(1e30f), hi(-1e30f);
+                    for (float depth : depths) {
+                        for (const glm::vec3& corner : corners) {
+                            glm::vec3 point = corner * (depth / -corner.z);
+                            lo = glm::min(lo, point);
+                            hi = glm::max(hi, point);
+                        }
+                    }
+                    unsigned int index = x + y * TILES_X + z * TILES_X * TILES_Y;
+                    clusterMin[index] = lo;
+                    clusterMax[index] = hi;
+                }
+            }
+        }
+    }
+
+    // Calls visit for every cluster the view-space sphere touches
+    template<typename Visit>
+    void forEachCluster(const glm::vec3& center, float radius, Visit visit) const {
+        float nearDepth = -center.z - radius;
+        float farDepth = -center.z + radius;
+        if (farDepth < zNear || nearDepth > zFar) return;
+
+        unsigned int z0 = sliceOf(std::max(nearDepth, zNear));
+        unsigned int z1 = sliceOf(std::min(farDepth, zFar));
+
+        // Screen rectangle of the sphere's box; corners in front of the near plane are pulled onto it
+        glm::vec2 lo(1.0f), hi(-1.0f);
+        for (int c = 0; c < 8; c++) {
+            glm::vec3 corner = center + glm::vec3(c & 1 ? radius : -radius, c & 2 ? radius : -radius, c & 4 ? radius : -radius);
+            corner.z = std::min(corner.z, -zNear);
+            glm::vec4 clip = cachedProjection * glm::vec4(corner, 1.0f);
+            glm::vec2 ndc = glm::vec2(clip) / clip.w;
+            lo = glm::min(lo, ndc);
+            hi = glm::max(hi, ndc);
+        }
+        lo = glm::max(lo, glm::vec2(-1.0f));
+        hi = glm::min(hi, glm::vec2(1.0f));
+        if (lo.x > hi.x || lo.y > hi.y) return;
+
+        unsigned int x0 = std::min((unsigned int)((lo.x * 0.5f + 0.5f) * TILES_X), TILES_X - 1);
+        unsigned int x1 = std::min((unsigned int)((hi.x * 0.5f + 0.5f) * TILES_X), TILES_X - 1);
+        unsigned int y0 = std::min((unsigned int)((lo.y * 0.5f + 0.5f) * TILES_Y), TILES_Y - 1);
+        unsigned int y1 = std::min((unsigned int)((hi.y * 0.5f + 0.5f) * TILES_Y), TILES_Y - 1);
+
+        float radiusSquared = radius * radius;
+        for (unsigned int z = z0; z <= z1; z++) {
+            for (unsigned int y = y0; y <= y1; y++) {
+                for (unsigned int x = x0; x <= x1; x++) {
+                    unsigned int index = x + y * TILES_X + z * TILES_X * TILES_Y;
+                    glm::vec3 closest = glm::clamp(center, clusterMin[index], clusterMax[index]);
+                    glm::vec3 offset = closest - center;
+                    if (glm::dot(offset, offset) <= radiusSquared) {
+                        visit(index);
+                    }
+                }
+            }
+        }
+    }
+
+    static void upload(unsigned int buffer, const void* data, size_t size, long long& storageBytes) {
+        glState.bindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, GL_STREAM_DRAW);
+        GpuMemory::bufferBytes += (long long)size - storageBytes;
+        storageBytes = (long long)size;
+    }
+};
+
+#endif
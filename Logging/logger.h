@@ -0,0 +1,259 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+enum Log_Level {
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_WARNING,
+    LOG_ERROR
+};
+
+static const char* const LOG_LEVEL_NAMES[] = {"debug", "info", "warning", "error"};
+
+// One key=value of a metric
+struct LogField {
+    const char* key;
+    double value;
+};
+
+// Asynchronous log. Callers format straight into a slot of a bounded lock-free queue (many
+// producers, one consumer) and return; a background thread writes the slots out, so no frame
+// ever waits on the terminal or a slow pipe. When the queue is full, messages are dropped and
+// counted rather than blocking.
+//
+// Messages go to the log output; metric() lines (structured key=value fields, e.g. frame
+// stats) go to the metrics output, which is the log output unless open() gave it a file.
+class Logger {
+public:
+    static const unsigned int QUEUE_CAPACITY = 1024;    // Power of two
+    static const unsigned int MESSAGE_SIZE = 512;       // Longer messages are cut
+
+    // Messages below this level are ignored
+    std::atomic<int> minimumLevel{LOG_INFO};
+
+    // Stats
+    std::atomic<unsigned long long> droppedMessages{0};
+
+    Logger() : epoch(std::chrono::steady_clock::now()), cells(new Cell[QUEUE_CAPACITY]) {
+        for (unsigned int i = 0; i < QUEUE_CAPACITY; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~Logger() {
+        stop();
+        if (logFile && logFile != stdout) std::fclose(logFile);
+        if (metricsFile && metricsFile != logFile && metricsFile != stdout) std::fclose(metricsFile);
+    }
+
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    // Outputs (nullptr keeps stdout / the log output); call before anything is logged
+    void open(const char* logPath, const char* metricsPath) {
+        if (logPath) {
+            FILE* file = std::fopen(logPath, "a");
+            if (file) logFile = file;
+            else log(LOG_ERROR, "ERROR::LOGGER::FILE_NOT_WRITABLE %s", logPath);
+        }
+        metricsFile = logFile;
+        if (metricsPath) {
+            FILE* file = std::fopen(metricsPath, "a");
+            if (file) metricsFile = file;
+            else log(LOG_ERROR, "ERROR::LOGGER::FILE_NOT_WRITABLE %s", metricsPath);
+        }
+    }
+
+    // printf-style; never blocks
+    void log(Log_Level level, const char* format, ...) {
+        if (level < minimumLevel.load(std::memory_order_relaxed)) return;
+
+        size_t position;
+        Cell* cell = claim(position);
+        if (!cell) return;
+        cell->message.level = level;
+        cell->message.metric = false;
+
+        va_list args;
+        va_start(args, format);
+        std::vsnprintf(cell->message.text, MESSAGE_SIZE, format, args);
+        va_end(args);
+        publish(cell, position);
+    }
+
+    // channel key=value ... on the metrics output
+    void metric(const char* channel, std::initializer_list<LogField> fields) {
+        size_t position;
+        Cell* cell = claim(position);
+        if (!cell) return;
+        cell->message.level = LOG_INFO;
+        cell->message.metric = true;
+
+        char* text = cell->message.text;
+        int length = std::snprintf(text, MESSAGE_SIZE, "%s", channel);
+        for (const LogField& field : fields) {
+            if (length < 0 || length >= (int)MESSAGE_SIZE) break;
+            length += std::snprintf(text + length, MESSAGE_SIZE - length, " %s=%g", field.key, field.value);
+        }
+        publish(cell, position);
+    }
+
+    // Write out everything queued so far and stop the writer (later messages restart it)
+    void stop() {
+        std::lock_guard<std::mutex> lock(writerMutex);
+        if (!writer.joinable()) return;
+        stopping = true;
+        writer.join();
+        stopping = false;
+    }
+
+private:
+    struct Message {
+        Log_Level level;
+        bool metric;
+        uint64_t time;              // Microseconds since the logger started
+        char text[MESSAGE_SIZE];
+    };
+
+    struct Cell {
+        std::atomic<size_t> sequence;
+        Message message;
+    };
+
+    const std::chrono::steady_clock::time_point epoch;
+    std::unique_ptr<Cell[]> cells;
+    std::atomic<size_t> enqueuePosition{0};
+    size_t dequeuePosition = 0;     // Writer thread only
+
+    FILE* logFile = stdout;
+    FILE* metricsFile = stdout;
+
+    std::mutex writerMutex;         // Starting and stopping only
+    std::thread writer;
+    std::atomic<bool> writerStarted{false};
+    std::atomic<bool> stopping{false};
+
+    // Bounded queue after Dmitry Vyukov: each cell's sequence says whether it is free for the
+    // producer at that position or filled for the consumer
+    Cell* claim(size_t& claimedPosition) {
+        ensureWriter();
+        size_t position = enqueuePosition.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[position & (QUEUE_CAPACITY - 1)];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+            if (difference == 0) {
+                if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    claimedPosition = position;
+                    cell.message.time = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - epoch).count();
+                    return &cell;
+                }
+            }
+            else if (difference < 0) {
+                droppedMessages.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            else {
+                position = enqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    static void publish(Cell* cell, size_t position) {
+        cell->sequence.store(position + 1, std::memory_order_release);
+    }
+
+    void ensureWriter() {
+        if (writerStarted.load(std::memory_order_acquire)) return;
+        std::lock_guard<std::mutex> lock(writerMutex);
+        if (writer.joinable()) return;
+        writer = std::thread([this] { writerLoop(); });
+        writerStarted.store(true, std::memory_order_release);
+    }
+
+    void writerLoop() {
+        while (true) {
+            bool wrote = false;
+            while (true) {
+                Cell& cell = cells[dequeuePosition & (QUEUE_CAPACITY - 1)];
+                if (cell.sequence.load(std::memory_order_acquire) != dequeuePosition + 1) break;
+
+                write(cell.message);
+                cell.sequence.store(dequeuePosition + QUEUE_CAPACITY, std::memory_order_release);
+                dequeuePosition++;
+                wrote = true;
+            }
+            if (wrote) {
+                std::fflush(logFile);
+                if (metricsFile != logFile) std::fflush(metricsFile);
+                continue;
+            }
+
+            if (stopping.load(std::memory_order_acquire)) break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        writerStarted.store(false, std::memory_order_release);
+    }
+
+    void write(const Message& message) {
+        double seconds = message.time / 1e6;
+        if (message.metric) {
+            std::fprintf(metricsFile, "[%10.3f] metric %s\n", seconds, message.text);
+        }
+        else {
+            std::fprintf(logFile, "[%10.3f] %-7s %s\n", seconds, LOG_LEVEL_NAMES[message.level], message.text);
+        }
+    }
+};
+
+inline Logger logger;
+
+// Lets a call site through at most once per interval; counts what it held back
+class LogRateLimit {
+public:
+    explicit LogRateLimit(double intervalSeconds)
+        : interval(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(intervalSeconds))) {}
+
+    bool allow() {
+        auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+        auto last = lastAllowed.load(std::memory_order_relaxed);
+        if (last != 0 && now - last < interval.count()) {
+            suppressed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return lastAllowed.compare_exchange_strong(last, now, std::memory_order_relaxed);
+    }
+
+    // Held back since the last message that got through
+    unsigned int takeSuppressed() {
+        return suppressed.exchange(0, std::memory_order_relaxed);
+    }
+
+private:
+    const std::chrono::steady_clock::duration interval;
+    std::atomic<std::chrono::steady_clock::rep> lastAllowed{0};
+    std::atomic<unsigned int> suppressed{0};
+};
+
+// logger.log(), but at most once per interval from this call site
+#define LOG_RATE_LIMITED(seconds, level, ...) do { \
+        static LogRateLimit logRateLimit(seconds); \
+        if (logRateLimit.allow()) { \
+            if (unsigned int held = logRateLimit.takeSuppressed()) logger.log(level, "(%u similar messages suppressed)", held); \
+            logger.log(level, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <atomic>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Bump allocator for data that lives for one frame (render lists, culling results, temporary
+// strings). Allocating is an atomic add, so jobs can use it too; nothing is freed one by one.
+//
+// There is one buffer per frame in flight: beginFrame() moves to the next buffer and resets it,
+// so memory handed out in a frame stays valid for the following frames - 1 frames (the render
+// thread or the GPU can still be reading it).
+//
+// A full buffer falls back to the heap and is grown to fit when it comes round again, so after
+// the first few frames steady state makes no heap allocations.
+class FrameArena {
+public:
+    static const unsigned int DEFAULT_FRAMES = 3;
+    static const size_t DEFAULT_CAPACITY = 1 << 20;
+
+    // Stats for the last finished frame
+    size_t usedBytes = 0;
+    size_t overflowBytes = 0;      // Served by the heap because the buffer was full
+
+    explicit FrameArena(size_t capacity = DEFAULT_CAPACITY, unsigned int frames = DEFAULT_FRAMES)
+        : buffers(frames < 1 ? 1 : frames) {
+        for (Buffer& buffer : buffers) {
+            buffer.memory = std::make_unique<unsigned char[]>(capacity);
+            buffer.capacity = capacity;
+        }
+    }
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    ~FrameArena() {
+        for (Buffer& buffer : buffers) {
+            releaseOverflow(buffer);
+        }
+    }
+
+    // Start a new frame; everything allocated frames() frames ago is gone
+    void beginFrame() {
+        Buffer& finished = buffers[current];
+        usedBytes = finished.head.load(std::memory_order_relaxed);
+        overflowBytes = finished.overflowBytes;
+
+        current = (current + 1) % (unsigned int)buffers.size();
+        Buffer& next = buffers[current];
+
+        // Grow to what the buffer needed last time round
+        size_t needed = next.head.load(std::memory_order_relaxed) + next.overflowBytes;
+        if (next.overflowBytes > 0 && needed > next.capacity) {
+            next.memory = std::make_unique<unsigned char[]>(needed);
+            next.capacity = needed;
+        }
+        releaseOverflow(next);
+        next.head.store(0, std::memory_order_relaxed);
+    }
+
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+        Buffer& buffer = buffers[current];
+        uintptr_t base = (uintptr_t)buffer.memory.get();
+
+        size_t head = buffer.head.load(std::memory_order_relaxed);
+        while (true) {
+            size_t start = (size_t)(((base + head + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base);
+            if (start + size > buffer.capacity) break;
+            if (buffer.head.compare_exchange_weak(head, start + size, std::memory_order_relaxed)) {
+                return buffer.memory.get() + start;
+            }
+        }
+
+        // Full: the heap until the next time this buffer is reset
+        std::lock_guard<std::mutex> lock(buffer.overflowMutex);
+        void* memory = ::operator new(size, std::align_val_t(alignment));
+        buffer.overflow.push_back(Overflow{memory, alignment});
+        buffer.overflowBytes += size;
+        return memory;
+    }
+
+    template<typename T>
+    T* allocateArray(size_t count) {
+        return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    // printf into the arena (uniform names and the like)
+    const char* format(const char* pattern, ...) {
+        va_list args;
+        va_start(args, pattern);
+        va_list measure;
+        va_copy(measure, args);
+        int length = std::vsnprintf(nullptr, 0, pattern, measure);
+        va_end(measure);
+
+        char* text = allocateArray<char>(length > 0 ? (size_t)length + 1 : 1);
+        if (length > 0) {
+            std::vsnprintf(text, (size_t)length + 1, pattern, args);
+        }
+        else {
+            text[0] = '\0';
+        }
+        va_end(args);
+        return text;
+    }
+
+    unsigned int frames() const {
+        return (unsigned int)buffers.size();
+    }
+
+    size_t capacity() const {
+        return buffers[current].capacity;
+    }
+
+private:
+    struct Overflow {
+        void* memory;
+        size_t alignment;
+    };
+
+    struct Buffer {
+        std::unique_ptr<unsigned char[]> memory;
+        size_t capacity = 0;
+        std::atomic<size_t> head{0};
+
+        std::mutex overflowMutex;
+        std::vector<Overflow> overflow;
+        size_t overflowBytes = 0;
+    };
+
+    std::vector<Buffer> buffers;
+    unsigned int current = 0;
+
+    static void releaseOverflow(Buffer& buffer) {
+        for (Overflow& block : buffer.overflow) {
+            ::operator delete(block.memory, std::align_val_t(block.alignment));
+        }
+        buffer.overflow.clear();
+        buffer.overflowBytes = 0;
+    }
+};
+
+// STL allocator on a frame arena; deallocate does nothing
+template<typename T>
+class ArenaAllocator {
+public:
+    using value_type = T;
+
+    explicit ArenaAllocator(FrameArena& arena) : arena(&arena) {}
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t count) {
+        return arena->allocateArray<T>(count);
+    }
+
+    void deallocate(T*, size_t) {}
+
+    template<typename U>
+    bool operator==(const ArenaAllocator<U>& other) const {
+        return arena == other.arena;
+    }
+
+    template<typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const {
+        return arena != other.arena;
+    }
+
+private:
+    template<typename U>
+    friend class ArenaAllocator;
+
+    FrameArena* arena;
+};
+
+// Vector whose storage comes from a frame arena; drop it before the arena comes round again
+template<typename T>
+using FrameVector = std::vector<T, ArenaAllocator<T>>;
+
+// Transient data of the main loop
+inline FrameArena frameArena;
+
+#endif
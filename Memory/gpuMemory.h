@@ -0,0 +1,12 @@
+#ifndef GPU_MEMORY_H
+#define GPU_MEMORY_H
+
+// Bytes of texture and buffer storage the engine has asked GL for, kept up to date wherever
+// storage is created, resized or deleted. Drivers pad and may keep extra copies, so this is
+// a lower bound. GL calls are main-thread only, so plain counters do.
+struct GpuMemory {
+    static inline long long textureBytes = 0;
+    static inline long long bufferBytes = 0;
+};
+
+#endif
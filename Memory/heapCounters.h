@@ -0,0 +1,92 @@
+#ifndef HEAP_COUNTERS_H
+#define HEAP_COUNTERS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// Process-wide heap allocation counts, so the frame loop can report how often it hits malloc.
+// The counting operator new/delete are compiled into the one file that defines
+// HEAP_COUNTERS_IMPLEMENTATION before including this header; C allocations are only counted
+// where a library is pointed at the counted* functions.
+struct HeapCounters {
+    static inline std::atomic<unsigned long long> allocations{0};
+    static inline std::atomic<unsigned long long> frees{0};
+    static inline std::atomic<unsigned long long> allocatedBytes{0};
+
+    // Counted stand-ins for the C allocator, for libraries that take their own malloc
+    // (STBI_MALLOC and friends). A realloc that moves counts as a free plus an allocation.
+    static void* countedMalloc(std::size_t size) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+        return std::malloc(size);
+    }
+
+    static void* countedRealloc(void* memory, std::size_t size) {
+        if (!memory) return countedMalloc(size);
+        void* moved = std::realloc(memory, size);
+        if (moved && moved != memory) {
+            frees.fetch_add(1, std::memory_order_relaxed);
+            allocations.fetch_add(1, std::memory_order_relaxed);
+            allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+        }
+        return moved;
+    }
+
+    static void countedFree(void* memory) {
+        if (!memory) return;
+        frees.fetch_add(1, std::memory_order_relaxed);
+        std::free(memory);
+    }
+};
+
+#ifdef HEAP_COUNTERS_IMPLEMENTATION
+
+void* operator new(std::size_t size) {
+    HeapCounters::allocations.fetch_add(1, std::memory_order_relaxed);
+    HeapCounters::allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* memory = std::malloc(size ? size : 1)) return memory;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    HeapCounters::allocations.fetch_add(1, std::memory_order_relaxed);
+    HeapCounters::allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    size_t align = (size_t)alignment;
+    size_t rounded = ((size ? size : 1) + align - 1) / align * align;
+#ifdef _WIN32
+    if (void* memory = _aligned_malloc(rounded, align)) return memory;
+#else
+    if (void* memory = std::aligned_alloc(align, rounded)) return memory;
+#endif
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+    if (!memory) return;
+    HeapCounters::frees.fetch_add(1, std::memory_order_relaxed);
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+    operator delete(memory);
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept {
+    if (!memory) return;
+    HeapCounters::frees.fetch_add(1, std::memory_order_relaxed);
+#ifdef _WIN32
+    _aligned_free(memory);
+#else
+    std::free(memory);
+#endif
+}
+
+void operator delete(void* memory, std::size_t, std::align_val_t alignment) noexcept {
+    operator delete(memory, alignment);
+}
+
+#endif
+
+#endif
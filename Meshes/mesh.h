@@ -4,6 +4,10 @@
 #include <glm.hpp>
 
 #include <shader_s.h>
+#include <shaderVariants.h>
+#include <glState.h>
+#include <bounds.h>
+#include <gpuMemory.h>
 
 #include <string>
 #include <vector>
@@ -14,6 +18,7 @@ struct Vertex {
     glm::vec3 Position;
     glm::vec3 Normal;
     glm::vec2 TexCoords;
+    glm::vec3 Tangent;
 };
 
 struct Texture {
@@ -29,59 +34,91 @@ public:
     vector<unsigned int> indices;
     vector<Texture> textures;
 
+    // Object-space bounds, filled in by the loader
+    AABB bounds;
+
+    // Shader features this mesh needs (FEATURE_TEXTURED, FEATURE_NORMAL_MAP)
+    unsigned int features = 0;
+
+    // Indices in the element buffer (still known when an instance drops its CPU copies)
+    unsigned int indexCount = 0;
+
     Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures){
         this -> vertices = vertices;
         this -> indices = indices;
         this -> textures = textures;
+        indexCount = (unsigned int)indices.size();
+
+        for(const Texture& texture : textures){
+            if(texture.type == "diffuse") features |= FEATURE_TEXTURED;
+            if(texture.type == "normal") features |= FEATURE_NORMAL_MAP;
+        }
 
+        setupSamplerNames();
         setupMesh();
     }
 
     void Draw(Shader &shader){
+        for(unsigned int i = 0; i < textures.size(); i++){
+            glState.setUniform1i(shader.ID, glGetUniformLocation(shader.ID, samplerNames[i].c_str()), i);
+            glState.bindTexture(i, GL_TEXTURE_2D, textures[i].id);
+        }
+
+        // Draw Mesh (the VAO stays bound; everything else binds through glState)
+        glState.bindVertexArray(VAO);
+        glState.drawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+    }
+
+    // Positions only, for the depth pre-pass
+    void DrawDepth(){
+        glState.bindVertexArray(depthVAO);
+        glState.drawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+    }
+
+private:
+    // Render
+    unsigned int VAO, VBO, EBO;
+    unsigned int depthVAO, positionVBO;
+
+    // Sampler uniform of each texture, built once so Draw doesn't assemble strings
+    vector<string> samplerNames;
+
+    void setupSamplerNames(){
         unsigned int diffuseNr = 1;
         unsigned int specularNr = 1;
 
-        for(unsigned int i = 0; i < textures.size(); i++){
-            glActiveTexture(GL_TEXTURE0 + i);
-
-            string number;
-            string name = textures[i].type;
+        for(const Texture& texture : textures){
+            string name = texture.type;
 
             if(name == "texture_diffuse"){
-                number = to_string(diffuseNr++);
+                name += to_string(diffuseNr++);
             }
             else if(name == "texture_specular"){
-                number = to_string(specularNr++);
+                name += to_string(specularNr++);
             }
 
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
-        }
-
-        glActiveTexture(GL_TEXTURE0);
+            // Normal maps are only read by the NORMAL_MAP variants
+            if(name == "normal"){
+                name = "material.normal";
+            }
 
-        // Draw Mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+            samplerNames.push_back(name);
+        }
     }
 
-private:
-    // Render
-    unsigned int VAO, VBO, EBO;
-
     void setupMesh(){
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
         glGenBuffers(1, &EBO);
 
-        glBindVertexArray(VAO);
+        glState.bindVertexArray(VAO);
 
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glState.bindBuffer(GL_ARRAY_BUFFER, VBO);
         glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        GpuMemory::bufferBytes += vertices.size() * sizeof(Vertex) + indices.size() * sizeof(unsigned int);
 
         // Positions
         glEnableVertexAttribArray(0);
@@ -95,7 +132,30 @@ private:
         glEnableVertexAttribArray(2);
         glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
 
-        glBindVertexArray(0);
+        // Tangents
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+
+        // Depth Only: tightly packed positions, sharing the index buffer
+        vector<glm::vec3> positions(vertices.size());
+        for(unsigned int i = 0; i < vertices.size(); i++){
+            positions[i] = vertices[i].Position;
+        }
+
+        glGenVertexArrays(1, &depthVAO);
+        glGenBuffers(1, &positionVBO);
+
+        glState.bindVertexArray(depthVAO);
+
+        glState.bindBuffer(GL_ARRAY_BUFFER, positionVBO);
+        glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), positions.data(), GL_STATIC_DRAW);
+        GpuMemory::bufferBytes += positions.size() * sizeof(glm::vec3);
+        glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+
+        glState.bindVertexArray(0);
     }
 };
 
@@ -8,8 +8,18 @@
 
 #include <mesh.h>
 #include <shader_s.h>
+#include <glState.h>
+#include <bounds.h>
+#include <frustum.h>
+#include <shaderVariants.h>
+#include <normalMatrix.h>
+#include <sceneGraph.h>
+#include <jobSystem.h>
+#include <logger.h>
+#include <gpuMemory.h>
 
 #include <string>
+#include <filesystem>
 #include <fstream>
 #include <sstream>
 #include <iostream>
@@ -19,18 +29,47 @@
 using namespace std;
 
 unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
+unsigned int TextureFromFileAsync(const char *path, const string &directory, JobSystem &jobs, JobCounter &loaded);
 
 class Model {
 public:
+    static const unsigned int IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace | aiProcess_GenBoundingBoxes;
+
     vector<Mesh> meshes;
     vector<Texture> textures_loaded;
     string directory;
 
+    // Object-space bounds of all meshes
+    AABB bounds;
+
+    // Rasterised into the software depth buffer to hide what is behind it
+    bool occluder = false;
+
     glm::vec3 position;
     glm::vec3 rotation;
 
-    Model(string const &path) : position(0.0f), rotation(0.0f){
+    // With a job system, textures decode on its workers and are uploaded as main-thread jobs;
+    // they are ready once texturesLoaded reaches zero
+    Model(string const &path, JobSystem* jobs = nullptr, JobCounter* texturesLoaded = nullptr) : position(0.0f), rotation(0.0f){
+        loadJobs = jobs;
+        loadCounter = texturesLoaded;
         loadModel(path);
+        loadJobs = nullptr;
+        loadCounter = nullptr;
+    }
+
+    // Another placement of the same meshes. GL buffers and textures are shared and the CPU copies
+    // of the vertices are left out, so an instance can't be an occluder. Attach it before moving it.
+    Model instance() const {
+        Model copy(*this);
+        copy.graph = nullptr;
+        copy.node = SceneGraph::NO_NODE;
+        copy.occluder = false;
+        for (Mesh& mesh : copy.meshes) {
+            vector<Vertex>().swap(mesh.vertices);
+            vector<unsigned int>().swap(mesh.indices);
+        }
+        return copy;
     }
 
     bool hasTexture() const {
@@ -42,33 +81,164 @@ public:
         return false;
     }
 
-    void Draw(Shader &shader){
-        // Create transformation matrix
+    // Cached world matrix when attached to a scene graph (as of its last update)
+    glm::mat4 getModelMatrix() const {
+        if (graph) {
+            return graph->world(node);
+        }
+
+        return composeMatrix(position, rotation);
+    }
+
+    // Translation, then rotations about x, y and z (degrees)
+    static glm::mat4 composeMatrix(const glm::vec3& position, const glm::vec3& rotation) {
         glm::mat4 model = glm::mat4(1.0f);
         model = glm::translate(model, position); // Move the model to its position
         model = glm::rotate(model, glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f)); // Rotate the model around the x-axis
         model = glm::rotate(model, glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f)); // Rotate the model around the y-axis
         model = glm::rotate(model, glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f)); // Rotate the model around the z-axis
+        return model;
+    }
+
+    // Vertices and triangle indices of an imported mesh (no GL, no materials)
+    static void extractGeometry(const aiMesh *mesh, vector<Vertex> &vertices, vector<unsigned int> &indices){
+        for(unsigned int i = 0; i < mesh -> mNumVertices; i++){
+            Vertex vertex;
+
+            // Positions
+            glm::vec3 vector;
+            vector.x = mesh -> mVertices[i].x;
+            vector.y = mesh -> mVertices[i].y;
+            vector.z = mesh -> mVertices[i].z;
+            vertex.Position = vector;
+
+            // Normals
+            if (mesh->HasNormals())
+            {
+                vector.x = mesh->mNormals[i].x;
+                vector.y = mesh->mNormals[i].y;
+                vector.z = mesh->mNormals[i].z;
+                vertex.Normal = vector;
+            }
+
+            // Textures
+            if(mesh->mTextureCoords[0]) // Does Mesh have Texture Coords?
+            {
+                glm::vec2 vec;
+                vec.x = mesh->mTextureCoords[0][i].x;
+                vec.y = mesh->mTextureCoords[0][i].y;
+                vertex.TexCoords = vec;
+            }
+            else {
+                vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+            }
+
+            // Tangents (from CalcTangentSpace, needed by normal mapping)
+            if(mesh->HasTangentsAndBitangents()){
+                vertex.Tangent = glm::vec3(mesh->mTangents[i].x, mesh->mTangents[i].y, mesh->mTangents[i].z);
+            }
+            else {
+                vertex.Tangent = glm::vec3(0.0f);
+            }
+
+            vertices.push_back(vertex);
+        }
+
+        // Process Indices
+        for(unsigned int i = 0; i < mesh->mNumFaces; i++)
+        {
+            aiFace face = mesh->mFaces[i];
+            for(unsigned int j = 0; j < face.mNumIndices; j++)
+                indices.push_back(face.mIndices[j]);
+        }
+    }
+
+    // From here on position and rotation are local to the node's parent (driven nodes ignore them)
+    void attach(SceneGraph& sceneGraph, unsigned int sceneNode) {
+        graph = &sceneGraph;
+        node = sceneNode;
+        graph->setTranslation(node, position);
+        graph->setRotation(node, SceneGraph::eulerRotation(rotation));
+    }
+
+    unsigned int getNode() const {
+        return node;
+    }
+
+    // World-space box around the model (empty if nothing loaded)
+    AABB getWorldBounds() const {
+        return bounds.transformed(getModelMatrix());
+    }
+
+    // When a frustum is given, meshes of multi-mesh models are culled individually
+    void Draw(Shader &shader, const Frustum* frustum = nullptr){
+        glm::mat4 model = getModelMatrix();
 
         // Pass the transformation matrix to the shader
         shader.setMat4("model", model);
+        shader.setMat3("normalMatrix", computeNormalMatrix(model));
 
         // Draw Model
+        bool cullMeshes = frustum && meshes.size() > 1;
         for(unsigned int i = 0; i < meshes.size(); i++){
+            if(cullMeshes && !frustum->containsSphere(meshes[i].bounds.sphere(model))){
+                continue;
+            }
             meshes[i].Draw(shader);
         }
     }
 
+    // Each mesh gets the smallest variant for the frame's lights plus its own material features.
+    // model and normalMatrix come from the per-frame batch (see computeNormalMatrices).
+    void Draw(ShaderVariants &variants, unsigned int frameFeatures, const glm::mat4 &model, const glm::mat3 &normalMatrix, const Frustum* frustum = nullptr){
+        Shader* current = nullptr;
+
+        bool cullMeshes = frustum && meshes.size() > 1;
+        for(unsigned int i = 0; i < meshes.size(); i++){
+            if(cullMeshes && !frustum->containsSphere(meshes[i].bounds.sphere(model))){
+                continue;
+            }
+
+            Shader& shader = variants.select(frameFeatures | meshes[i].features);
+            if(&shader != current){
+                shader.setMat4("model", model);
+                shader.setMat3("normalMatrix", normalMatrix);
+                current = &shader;
+            }
+            meshes[i].Draw(shader);
+        }
+    }
+
+    // Same culling as Draw, positions only
+    void DrawDepth(Shader &shader, const Frustum* frustum = nullptr){
+        glm::mat4 model = getModelMatrix();
+        shader.setMat4("model", model);
+
+        bool cullMeshes = frustum && meshes.size() > 1;
+        for(unsigned int i = 0; i < meshes.size(); i++){
+            if(cullMeshes && !frustum->containsSphere(meshes[i].bounds.sphere(model))){
+                continue;
+            }
+            meshes[i].DrawDepth();
+        }
+    }
+
     void setPosition(const glm::vec3& newPosition) {
         position = newPosition;
+        if (graph) graph->setTranslation(node, position);
     }
 
     glm::vec3 getPosition() const {
         return position;
     }
 
+    glm::vec3 getWorldPosition() const {
+        return glm::vec3(getModelMatrix()[3]);
+    }
+
     void setRotation(const glm::vec3& newRotation) {
         rotation = newRotation;
+        if (graph) graph->setRotation(node, SceneGraph::eulerRotation(rotation));
     }
 
     glm::vec3 getRotation() const {
@@ -76,18 +246,25 @@ public:
     }
 
     void rotate(const glm::vec3& deltaRotation) {
-        rotation += deltaRotation;
+        setRotation(rotation + deltaRotation);
     }
 
 private:
+    SceneGraph* graph = nullptr;
+    unsigned int node = SceneGraph::NO_NODE;
+
+    // Only set while loading
+    JobSystem* loadJobs = nullptr;
+    JobCounter* loadCounter = nullptr;
+
     void loadModel(string const &path){
         Assimp::Importer import;
         //const aiScene *scene = import.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
-        const aiScene* scene = import.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+        const aiScene* scene = import.ReadFile(path, IMPORT_FLAGS);
 
         // Check scene is not NULL or incomplete
         if(!scene || scene -> mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene -> mRootNode){
-            cout << "ERROR::ASSIMP::" << import.GetErrorString() << endl;
+            logger.log(LOG_ERROR, "ERROR::ASSIMP::%s", import.GetErrorString());
             return;
         }
 
@@ -101,6 +278,12 @@ private:
         for(unsigned int i = 0; i < node -> mNumMeshes; i++){
             aiMesh *mesh = scene -> mMeshes[node -> mMeshes[i]];
             meshes.push_back(processMesh(mesh, scene));
+
+            // Bounds from Assimp's GenBoundingBoxes step
+            AABB meshBounds(glm::vec3(mesh->mAABB.mMin.x, mesh->mAABB.mMin.y, mesh->mAABB.mMin.z),
+                            glm::vec3(mesh->mAABB.mMax.x, mesh->mAABB.mMax.y, mesh->mAABB.mMax.z));
+            meshes.back().bounds = meshBounds;
+            bounds.expand(meshBounds);
         }
 
         // Process all the Node's Children's Meshes
@@ -113,48 +296,7 @@ private:
         vector<Vertex> vertices;
         vector<unsigned int> indices;
         vector<Texture> textures;
-
-        for(unsigned int i = 0; i < mesh -> mNumVertices; i++){
-            Vertex vertex;
-
-            // Positions
-            glm::vec3 vector;
-            vector.x = mesh -> mVertices[i].x;
-            vector.y = mesh -> mVertices[i].y;
-            vector.z = mesh -> mVertices[i].z;
-            vertex.Position = vector;
-
-            // Normals
-            if (mesh->HasNormals())
-            {
-                vector.x = mesh->mNormals[i].x;
-                vector.y = mesh->mNormals[i].y;
-                vector.z = mesh->mNormals[i].z;
-                vertex.Normal = vector;
-            }
-
-            // Textures
-            if(mesh->mTextureCoords[0]) // Does Mesh have Texture Coords?
-            {
-                glm::vec2 vec;
-                vec.x = mesh->mTextureCoords[0][i].x;
-                vec.y = mesh->mTextureCoords[0][i].y;
-                vertex.TexCoords = vec;
-            }
-            else {
-                vertex.TexCoords = glm::vec2(0.0f, 0.0f);
-            }
-
-            vertices.push_back(vertex);
-        }
-
-        // Process Indices
-        for(unsigned int i = 0; i < mesh->mNumFaces; i++)
-        {
-            aiFace face = mesh->mFaces[i];
-            for(unsigned int j = 0; j < face.mNumIndices; j++)
-                indices.push_back(face.mIndices[j]);
-        }
+        extractGeometry(mesh, vertices, indices);
 
         // Process Material
         if(mesh -> mMaterialIndex >= 0){
@@ -170,6 +312,13 @@ private:
                 textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
             }
 
+            // OBJ files list normal maps as bump maps
+            aiTextureType normalType = material->GetTextureCount(aiTextureType_NORMALS) > 0 ? aiTextureType_NORMALS : aiTextureType_HEIGHT;
+            if (material->GetTextureCount(normalType) > 0) {
+                vector<Texture> normalMaps = loadMaterialTextures(material, normalType, "normal");
+                textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
+            }
+
         }
 
         return Mesh(vertices, indices, textures);
@@ -191,9 +340,16 @@ private:
                 }
             }
 
+            // A missing normal map would turn every normal to garbage; keep the vertex normals instead
+            if(!skip && typeName == "normal" && !std::filesystem::exists(directory + '/' + str.C_Str())){
+                logger.log(LOG_WARNING, "Normal map missing, using vertex normals: %s", str.C_Str());
+                continue;
+            }
+
             if(!skip){
                 Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), directory);
+                texture.id = loadJobs && loadCounter ? TextureFromFileAsync(str.C_Str(), directory, *loadJobs, *loadCounter)
+                                                     : TextureFromFile(str.C_Str(), directory);
                 texture.type = typeName;
                 texture.path = str.C_Str();
 
@@ -205,19 +361,8 @@ private:
     }
 };
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma){
-    string filename = string(path);
-    filename = directory + '/' + filename;
-
-    // Generate Texture ID
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-
-    // Load Image from File
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-
+// Fill an existing texture name from decoded pixels (GL, so main thread only); frees data
+void UploadTexture(unsigned int textureID, unsigned char *data, int width, int height, int nrComponents, const char *path){
     // Check if Image Loaded Successfully
     if (data)
     {
@@ -230,9 +375,10 @@ unsigned int TextureFromFile(const char *path, const string &directory, bool gam
         else if (nrComponents == 4)
             format = GL_RGBA;
 
-        glBindTexture(GL_TEXTURE_2D, textureID);
+        glState.bindTexture(0, GL_TEXTURE_2D, textureID);
         glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
         glGenerateMipmap(GL_TEXTURE_2D);
+        GpuMemory::textureBytes += (long long)width * height * nrComponents * 4 / 3;     // With the mip chain
 
         // Wrapping
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -247,9 +393,43 @@ unsigned int TextureFromFile(const char *path, const string &directory, bool gam
     }
     else
     {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
+        logger.log(LOG_ERROR, "Texture failed to load at path: %s", path);
         stbi_image_free(data);
     }
+}
+
+unsigned int TextureFromFile(const char *path, const string &directory, bool gamma){
+    string filename = string(path);
+    filename = directory + '/' + filename;
+
+    // Generate Texture ID
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+
+    int width, height, nrComponents;
+
+    // Load Image from File
+    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
+    UploadTexture(textureID, data, width, height, nrComponents, path);
+
+    return textureID;
+}
+
+// The name is valid at once; the image is decoded by a job and uploaded by a main-thread job
+unsigned int TextureFromFileAsync(const char *path, const string &directory, JobSystem &jobs, JobCounter &loaded){
+    string filename = directory + '/' + string(path);
+    string name = path;
+
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+
+    jobs.run([filename, name, textureID, &jobs, &loaded] {
+        int width, height, nrComponents;
+        unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
+        jobs.runOnMainThread([=] {
+            UploadTexture(textureID, data, width, height, nrComponents, name.c_str());
+        }, &loaded);
+    }, &loaded);
 
     return textureID;
 }
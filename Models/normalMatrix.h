@@ -0,0 +1,131 @@
+#ifndef NORMAL_MATRIX_H
+#define NORMAL_MATRIX_H
+
+#include <glm.hpp>
+
+#include <cmath>
+#include <cstddef>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NORMAL_MATRIX_SSE 1
+#endif
+
+// Normal matrices (inverse-transpose of the model's upper 3x3), computed on the CPU once per
+// instance instead of once per vertex.
+//
+// With columns c0, c1, c2 the inverse-transpose is [c1 x c2, c2 x c0, c0 x c1] / det. Rotations
+// with a uniform scale s skip that: the columns are orthogonal with length s, so the result is
+// the matrix itself over s^2.
+
+// Relative tolerance for treating a transform as rotation + uniform scale
+static const float RIGID_TOLERANCE = 1e-4f;
+
+// Single instance; rigid (optional) reports which path was taken
+inline glm::mat3 computeNormalMatrix(const glm::mat4& model, bool* rigid = nullptr) {
+    glm::vec3 c0(model[0]), c1(model[1]), c2(model[2]);
+    float scaleSquared = glm::dot(c0, c0);
+    float tolerance = RIGID_TOLERANCE * scaleSquared;
+
+    bool isRigid = std::abs(glm::dot(c0, c1)) <= tolerance && std::abs(glm::dot(c0, c2)) <= tolerance &&
+                   std::abs(glm::dot(c1, c2)) <= tolerance &&
+                   std::abs(glm::dot(c1, c1) - scaleSquared) <= tolerance &&
+                   std::abs(glm::dot(c2, c2) - scaleSquared) <= tolerance;
+    if (rigid) *rigid = isRigid;
+
+    if (isRigid) {
+        return glm::mat3(model) * (1.0f / scaleSquared);
+    }
+
+    glm::vec3 r0 = glm::cross(c1, c2);
+    float inverseDet = 1.0f / glm::dot(c0, r0);
+    return glm::mat3(r0 * inverseDet, glm::cross(c2, c0) * inverseDet, glm::cross(c0, c1) * inverseDet);
+}
+
+// Whole batch; four instances per step with SSE, one element of the 3x3 per register.
+// Returns how many instances were rigid.
+inline unsigned int computeNormalMatrices(const glm::mat4* models, glm::mat3* normals, size_t count) {
+    unsigned int rigidCount = 0;
+    size_t i = 0;
+
+#ifdef NORMAL_MATRIX_SSE
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 relativeTolerance = _mm_set1_ps(RIGID_TOLERANCE);
+
+    for (; i + 4 <= count; i += 4) {
+        const glm::mat4* m = models + i;
+
+        // m[c][r] of all four instances
+        __m128 e[3][3];
+        for (int c = 0; c < 3; c++) {
+            for (int r = 0; r < 3; r++) {
+                e[c][r] = _mm_setr_ps(m[0][c][r], m[1][c][r], m[2][c][r], m[3][c][r]);
+            }
+        }
+
+        auto dot = [](const __m128* a, const __m128* b) {
+            return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], b[0]), _mm_mul_ps(a[1], b[1])), _mm_mul_ps(a[2], b[2]));
+        };
+        auto within = [&](__m128 value, __m128 tolerance) {
+            return _mm_cmple_ps(_mm_andnot_ps(signMask, value), tolerance);
+        };
+
+        __m128 scaleSquared = dot(e[0], e[0]);
+        __m128 tolerance = _mm_mul_ps(relativeTolerance, scaleSquared);
+        __m128 rigid = _mm_and_ps(_mm_and_ps(within(dot(e[0], e[1]), tolerance), within(dot(e[0], e[2]), tolerance)),
+                                  _mm_and_ps(within(dot(e[1], e[2]), tolerance),
+                                             _mm_and_ps(within(_mm_sub_ps(dot(e[1], e[1]), scaleSquared), tolerance),
+                                                        within(_mm_sub_ps(dot(e[2], e[2]), scaleSquared), tolerance))));
+        int rigidMask = _mm_movemask_ps(rigid);
+        rigidCount += (rigidMask & 1) + ((rigidMask >> 1) & 1) + ((rigidMask >> 2) & 1) + ((rigidMask >> 3) & 1);
+
+        __m128 out[3][3];
+        __m128 inverseScale = _mm_div_ps(one, scaleSquared);
+        for (int c = 0; c < 3; c++) {
+            for (int r = 0; r < 3; r++) {
+                out[c][r] = _mm_mul_ps(e[c][r], inverseScale);
+            }
+        }
+
+        // Only groups with a non-rigid instance pay for the cofactors
+        if (rigidMask != 0xF) {
+            __m128 cofactor[3][3];
+            for (int c = 0; c < 3; c++) {
+                const __m128* a = e[(c + 1) % 3];
+                const __m128* b = e[(c + 2) % 3];
+                cofactor[c][0] = _mm_sub_ps(_mm_mul_ps(a[1], b[2]), _mm_mul_ps(a[2], b[1]));
+                cofactor[c][1] = _mm_sub_ps(_mm_mul_ps(a[2], b[0]), _mm_mul_ps(a[0], b[2]));
+                cofactor[c][2] = _mm_sub_ps(_mm_mul_ps(a[0], b[1]), _mm_mul_ps(a[1], b[0]));
+            }
+            __m128 inverseDet = _mm_div_ps(one, dot(e[0], cofactor[0]));
+            for (int c = 0; c < 3; c++) {
+                for (int r = 0; r < 3; r++) {
+                    __m128 general = _mm_mul_ps(cofactor[c][r], inverseDet);
+                    out[c][r] = _mm_or_ps(_mm_and_ps(rigid, out[c][r]), _mm_andnot_ps(rigid, general));
+                }
+            }
+        }
+
+        for (int c = 0; c < 3; c++) {
+            for (int r = 0; r < 3; r++) {
+                alignas(16) float lanes[4];
+                _mm_store_ps(lanes, out[c][r]);
+                for (int lane = 0; lane < 4; lane++) {
+                    normals[i + lane][c][r] = lanes[lane];
+                }
+            }
+        }
+    }
+#endif
+
+    // Remainder (or everything without SSE)
+    for (; i < count; i++) {
+        bool rigid;
+        normals[i] = computeNormalMatrix(models[i], &rigid);
+        rigidCount += rigid;
+    }
+    return rigidCount;
+}
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <logger.h>
+
+// Parts of a frame, in the order the main loop runs them
+enum Frame_Stage {
+    STAGE_SIMULATION,   // Input and ride ticks
+    STAGE_SCENE,        // Transforms, lights, light clusters, instance matrices
+    STAGE_CULLING,      // BVH, occlusion
+    STAGE_SHADOWS,
+    STAGE_PREPASS,
+    STAGE_SHADING,
+    STAGE_LIGHTING,     // Deferred lighting pass
+    STAGE_OVERLAY,      // Performance HUD
+    STAGE_FINISH,       // Present, or waiting for the GPU when headless
+    STAGE_COUNT
+};
+
+static const char* const FRAME_STAGE_NAMES[STAGE_COUNT] = {
+    "simulation", "scene", "culling", "shadows", "prepass", "shading", "lighting", "overlay", "finish"
+};
+
+// Per-frame CPU timings for benchmark runs, written out as JSON at the end. Each stage runs
+// from its beginStage() to the next one (or endFrame()). Storage is reserved up front so
+// recording doesn't allocate. The last finished frame is kept whether or not it was recorded,
+// for the HUD.
+class FrameStats {
+public:
+    explicit FrameStats(unsigned int expectedFrames = 0) {
+        frames.reserve(expectedFrames);
+    }
+
+    void beginFrame() {
+        current = Frame();
+        frameStart = stageStart = Clock::now();
+        stage = STAGE_SIMULATION;
+    }
+
+    void beginStage(Frame_Stage next) {
+        Clock::time_point now = Clock::now();
+        current.stageMs[stage] += milliseconds(now - stageStart);
+        stageStart = now;
+        stage = next;
+    }
+
+    void endFrame(unsigned int drawCalls, unsigned long long heapAllocations, bool record = true) {
+        Clock::time_point now = Clock::now();
+        current.stageMs[stage] += milliseconds(now - stageStart);
+        current.totalMs = milliseconds(now - frameStart);
+        current.drawCalls = drawCalls;
+        current.heapAllocations = heapAllocations;
+        previous = current;
+        if (record) frames.push_back(current);
+    }
+
+    // The last frame endFrame() finished
+    double lastFrameMs() const {
+        return previous.totalMs;
+    }
+
+    double lastStageMs(Frame_Stage s) const {
+        return previous.stageMs[s];
+    }
+
+    unsigned int recordedFrames() const {
+        return (unsigned int)frames.size();
+    }
+
+    // Run description (renderer settings and the like), written as strings
+    void setInfo(const std::string& key, const std::string& value) {
+        info.push_back({key, value});
+    }
+
+    // Average GPU time of a pass over the run (from the GPU profiler)
+    void setGpuTiming(const std::string& pass, double averageMs) {
+        gpuTimings.push_back({pass, averageMs});
+    }
+
+    bool writeJson(const char* path) const {
+        std::ofstream file(path);
+        if (!file) {
+            logger.log(LOG_ERROR, "ERROR::FRAME_STATS::FILE_NOT_WRITABLE: %s", path);
+            return false;
+        }
+        writeJson(file);
+        return true;
+    }
+
+    void writeJson(std::ostream& out) const {
+        out << "{\n";
+        for (const auto& entry : info) {
+            out << "  \"" << entry.first << "\": \"" << escape(entry.second) << "\",\n";
+        }
+        out << "  \"frames\": " << frames.size() << ",\n";
+
+        out << "  \"frameMs\": ";
+        writeSummary(out, [](const Frame& frame) { return frame.totalMs; });
+        out << ",\n";
+
+        out << "  \"stageMs\": {\n";
+        for (unsigned int s = 0; s < STAGE_COUNT; s++) {
+            out << "    \"" << FRAME_STAGE_NAMES[s] << "\": ";
+            writeSummary(out, [s](const Frame& frame) { return frame.stageMs[s]; });
+            out << (s + 1 < STAGE_COUNT ? ",\n" : "\n");
+        }
+        out << "  },\n";
+
+        out << "  \"drawCalls\": ";
+        writeSummary(out, [](const Frame& frame) { return (double)frame.drawCalls; });
+        out << ",\n";
+
+        out << "  \"heapAllocations\": ";
+        writeSummary(out, [](const Frame& frame) { return (double)frame.heapAllocations; });
+        out << ",\n";
+
+        out << "  \"gpuMs\": {";
+        for (size_t i = 0; i < gpuTimings.size(); i++) {
+            out << (i > 0 ? ", " : "") << "\"" << escape(gpuTimings[i].first) << "\": " << gpuTimings[i].second;
+        }
+        out << "}\n}\n";
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Frame {
+        double totalMs = 0.0;
+        double stageMs[STAGE_COUNT] = {};
+        unsigned int drawCalls = 0;
+        unsigned long long heapAllocations = 0;
+    };
+
+    std::vector<Frame> frames;
+    std::vector<std::pair<std::string, std::string>> info;
+    std::vector<std::pair<std::string, double>> gpuTimings;
+
+    Frame current;
+    Frame previous;
+    Frame_Stage stage = STAGE_SIMULATION;
+    Clock::time_point frameStart;
+    Clock::time_point stageStart;
+
+    static double milliseconds(Clock::duration duration) {
+        return std::chrono::duration<double, std::milli>(duration).count();
+    }
+
+    static std::string escape(const std::string& text) {
+        std::string escaped;
+        for (char c : text) {
+            if (c == '"' || c == '\\') escaped += '\\';
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    // Nearest-rank percentile of sorted values
+    static double percentile(const std::vector<double>& sorted, double p) {
+        if (sorted.empty()) return 0.0;
+        size_t rank = (size_t)std::max(1.0, std::ceil(p / 100.0 * sorted.size()));
+        return sorted[std::min(rank, sorted.size()) - 1];
+    }
+
+    template<typename Value>
+    void writeSummary(std::ostream& out, Value value) const {
+        std::vector<double> values;
+        values.reserve(frames.size());
+        double sum = 0.0;
+        for (const Frame& frame : frames) {
+            values.push_back(value(frame));
+            sum += values.back();
+        }
+        std::sort(values.begin(), values.end());
+
+        out << "{\"mean\": " << (values.empty() ? 0.0 : sum / values.size())
+            << ", \"min\": " << (values.empty() ? 0.0 : values.front())
+            << ", \"p50\": " << percentile(values, 50.0)
+            << ", \"p95\": " << percentile(values, 95.0)
+            << ", \"p99\": " << percentile(values, 99.0)
+            << ", \"max\": " << (values.empty() ? 0.0 : values.back()) << "}";
+    }
+};
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef GPU_PROFILER_H
+#define GPU_PROFILER_H
+
+#include <glad/glad.h>
+
+#include "profiler.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// GPU time per render pass from GL_TIMESTAMP queries. Scopes write a timestamp query at each
+// end; queries cycle through FRAMES_IN_FLIGHT frames and a frame's results are only read when
+// its slot comes round again, by which time the GPU has finished them, so reading never
+// stalls (a frame that still isn't ready is skipped).
+//
+// Results keep a rolling average per scope name, and while a CPU capture is running they go
+// into the trace on a "GPU" track, moved onto the CPU clock.
+class GpuProfiler {
+public:
+    static const unsigned int FRAMES_IN_FLIGHT = 4;
+    static const unsigned int MAX_SCOPES = 32;         // Per frame; later scopes aren't timed
+    static const unsigned int ROLLING_FRAMES = 60;
+    static const unsigned int NO_SCOPE = ~0u;
+
+    struct Timing {
+        const char* name;
+        double lastMs;
+        double averageMs;       // Over about ROLLING_FRAMES frames
+    };
+
+    // Stats
+    unsigned int skippedFrames = 0;     // Results not ready in time
+
+    // Off: scopes issue no queries
+    bool enabled = true;
+
+    // Call at the top of every frame (GL context current)
+    void beginFrame() {
+        if (!enabled) return;
+        if (!initialised) {
+            for (Frame& frame : frames) {
+                glGenQueries(MAX_SCOPES, frame.startQueries);
+                glGenQueries(MAX_SCOPES, frame.endQueries);
+            }
+            initialised = true;
+        }
+
+        current = (current + 1) % FRAMES_IN_FLIGHT;
+        collect(frames[current]);
+        frames[current].count = 0;
+        frames[current].ended = 0;
+        frames[current].lastEnded = NO_SCOPE;
+
+        // GPU timestamps to profiler time: both clocks read now
+        GLint64 gpuNow = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+        frames[current].clockOffset = (int64_t)profiler.now() - (int64_t)gpuNow;
+    }
+
+    unsigned int begin(const char* name) {
+        if (!enabled || !initialised) return NO_SCOPE;
+        Frame& frame = frames[current];
+        if (frame.count == MAX_SCOPES) return NO_SCOPE;
+
+        unsigned int scope = frame.count++;
+        frame.names[scope] = name;
+        glQueryCounter(frame.startQueries[scope], GL_TIMESTAMP);
+        return scope;
+    }
+
+    void end(unsigned int scope) {
+        if (scope == NO_SCOPE) return;
+        Frame& frame = frames[current];
+        glQueryCounter(frame.endQueries[scope], GL_TIMESTAMP);
+        frame.ended++;
+        frame.lastEnded = scope;
+    }
+
+    // Rolling averages, in the order scopes were first seen
+    const std::vector<Timing>& timings() const {
+        return results;
+    }
+
+    double averageMs(const char* name) const {
+        for (const Timing& timing : results) {
+            if (std::strcmp(timing.name, name) == 0) return timing.averageMs;
+        }
+        return 0.0;
+    }
+
+private:
+    struct Frame {
+        unsigned int startQueries[MAX_SCOPES];
+        unsigned int endQueries[MAX_SCOPES];
+        const char* names[MAX_SCOPES];
+        unsigned int count = 0;
+        unsigned int ended = 0;
+        unsigned int lastEnded = NO_SCOPE;     // Scope of the last query issued (scopes nest)
+        int64_t clockOffset = 0;
+    };
+
+    Frame frames[FRAMES_IN_FLIGHT];
+    unsigned int current = 0;
+    bool initialised = false;
+    std::vector<Timing> results;
+
+    void collect(const Frame& frame) {
+        if (frame.count == 0) return;
+
+        // Queries complete in order, so the last one issued tells for the whole frame. That is
+        // the end of the outermost scope, not of the last scope begun.
+        GLint available = 0;
+        if (frame.ended == frame.count) {
+            glGetQueryObjectiv(frame.endQueries[frame.lastEnded], GL_QUERY_RESULT_AVAILABLE, &available);
+        }
+        if (!available) {
+            skippedFrames++;
+            return;
+        }
+
+        bool tracing = profiler.isRecording();
+        for (unsigned int i = 0; i < frame.count; i++) {
+            GLuint64 start = 0, end = 0;
+            glGetQueryObjectui64v(frame.startQueries[i], GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(frame.endQueries[i], GL_QUERY_RESULT, &end);
+            double ms = (end - start) / 1e6;
+            addSample(frame.names[i], ms);
+
+            if (tracing) {
+                int64_t cpuStart = (int64_t)start + frame.clockOffset;
+                if (cpuStart >= 0) {
+                    profiler.recordOnTrack("GPU", frame.names[i], (uint64_t)cpuStart, (uint64_t)cpuStart + (end - start));
+                }
+            }
+        }
+    }
+
+    void addSample(const char* name, double ms) {
+        for (Timing& timing : results) {
+            if (timing.name == name || std::strcmp(timing.name, name) == 0) {
+                timing.lastMs = ms;
+                timing.averageMs += (ms - timing.averageMs) / ROLLING_FRAMES;
+                return;
+            }
+        }
+        results.push_back(Timing{name, ms, ms});
+    }
+};
+
+inline GpuProfiler gpuProfiler;
+
+// Times the enclosing scope on the GPU
+class GpuScope {
+public:
+    explicit GpuScope(const char* name) : scope(gpuProfiler.begin(name)) {}
+
+    ~GpuScope() {
+        gpuProfiler.end(scope);
+    }
+
+    GpuScope(const GpuScope&) = delete;
+    GpuScope& operator=(const GpuScope&) = delete;
+
+private:
+    unsigned int scope;
+};
+
+// A pass: timed on the CPU and the GPU under the same name
+#define PROFILE_PASS(name) PROFILE_SCOPE(name); GpuScope PROFILE_CONCAT(gpuScope, __LINE__)(name)
+
+#endif
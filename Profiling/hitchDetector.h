@@ -0,0 +1,222 @@
+#ifndef HITCH_DETECTOR_H
+#define HITCH_DETECTOR_H
+
+#include <logger.h>
+#include <glState.h>
+#include <gpuMemory.h>
+#include "frameStats.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Post-mortem captures of stutters nobody was watching. Every frame's stage times and GL
+// counters go into a ring, and the profiler records all the time; when a frame takes longer
+// than the threshold, the seconds before it are written as a Chrome trace with the counters
+// as graphs and the scene state in its metadata ("otherData").
+//
+// The window is copied on the main thread and written on a background one, so the capture
+// costs the frame after the hitch a copy rather than a file write. At most one capture per
+// cooldown, and maxCaptures per run.
+class HitchDetector {
+public:
+    static const unsigned int FRAME_CAPACITY = 2048;       // Power of two
+    static constexpr double WINDOW_SECONDS = 5.0;
+    static constexpr double COOLDOWN_SECONDS = 10.0;
+
+    using State = std::vector<std::pair<std::string, std::string>>;
+
+    double thresholdMs = 50.0;
+    unsigned int maxCaptures = 10;
+
+    ~HitchDetector() {
+        if (writer.joinable()) writer.join();
+    }
+
+    bool isEnabled() const {
+        return !directory.empty();
+    }
+
+    // Captures go to dir; the profiler records from now on
+    bool start(const std::string& dir) {
+        std::error_code error;
+        std::filesystem::create_directories(dir, error);
+        if (error) {
+            logger.log(LOG_ERROR, "ERROR::HITCH_DETECTOR::DIRECTORY_NOT_CREATED: %s", dir.c_str());
+            return false;
+        }
+        directory = dir;
+        frames.assign(FRAME_CAPACITY, FrameRecord{});
+        profiler.setContinuous(true);
+        return true;
+    }
+
+    void beginFrame() {
+        frameStart = profiler.now();
+    }
+
+    // After frameStats.endFrame(). True when the frame was a hitch worth a capture().
+    bool endFrame(const FrameStats& stats, const GLState& gl, unsigned long long heapAllocations) {
+        if (!isEnabled()) return false;
+
+        FrameRecord& record = frames[frameCount & (FRAME_CAPACITY - 1)];
+        record.start = frameStart;
+        record.end = profiler.now();
+        for (unsigned int s = 0; s < STAGE_COUNT; s++) {
+            record.stageMs[s] = (float)stats.lastStageMs((Frame_Stage)s);
+        }
+        record.drawCalls = gl.drawCalls;
+        record.issuedCalls = gl.issuedCalls;
+        record.skippedCalls = gl.skippedCalls;
+        record.triangles = gl.triangles;
+        record.heapAllocations = heapAllocations;
+        record.gpuBytes = GpuMemory::textureBytes + GpuMemory::bufferBytes;
+        frameCount++;
+
+        if (milliseconds(record) <= thresholdMs) return false;
+        if (captures >= maxCaptures) return false;
+        return captures == 0 || record.end - lastCapture >= (uint64_t)(COOLDOWN_SECONDS * 1e9);
+    }
+
+    // Writes the window up to the last frame, with state as metadata
+    void capture(State state) {
+        if (!isEnabled() || frameCount == 0) return;
+        if (writer.joinable()) writer.join();
+
+        const FrameRecord& hitch = frames[(frameCount - 1) & (FRAME_CAPACITY - 1)];
+        uint64_t window = (uint64_t)(WINDOW_SECONDS * 1e9);
+        uint64_t from = hitch.end > window ? hitch.end - window : 0;
+
+        std::vector<Profiler::TrackEvents> tracks = profiler.copyEvents(from, hitch.end);
+        std::vector<FrameRecord> records;
+        uint64_t count = std::min<uint64_t>(frameCount, FRAME_CAPACITY);
+        for (uint64_t i = frameCount - count; i < frameCount; i++) {
+            const FrameRecord& record = frames[i & (FRAME_CAPACITY - 1)];
+            if (record.start >= from) records.push_back(record);
+        }
+
+        captures++;
+        lastCapture = hitch.end;
+        state.emplace_back("frame", std::to_string(frameCount - 1));
+        state.emplace_back("frameMs", std::to_string(milliseconds(hitch)));
+        state.emplace_back("thresholdMs", std::to_string(thresholdMs));
+
+        std::string path = directory + "/" + fileName(frameCount - 1);
+        logger.log(LOG_WARNING, "Hitch: %.1f ms frame (threshold %.1f ms), capturing to %s", milliseconds(hitch), thresholdMs, path.c_str());
+        writer = std::thread([path, tracks = std::move(tracks), records = std::move(records), state = std::move(state)] {
+            writeCapture(path, tracks, records, state);
+        });
+    }
+
+private:
+    struct FrameRecord {
+        uint64_t start;             // Profiler clock
+        uint64_t end;
+        float stageMs[STAGE_COUNT];
+        unsigned int drawCalls;
+        unsigned int issuedCalls;
+        unsigned int skippedCalls;
+        unsigned long long triangles;
+        unsigned long long heapAllocations;
+        long long gpuBytes;
+    };
+
+    std::vector<FrameRecord> frames;      // FRAME_CAPACITY once started
+    uint64_t frameCount = 0;
+    uint64_t frameStart = 0;
+
+    std::string directory;
+    unsigned int captures = 0;
+    uint64_t lastCapture = 0;
+    std::thread writer;
+
+    static double milliseconds(const FrameRecord& record) {
+        return (record.end - record.start) / 1e6;
+    }
+
+    // hitch-YYYYMMDD-HHMMSS-fFRAME.json, so captures from different runs don't collide
+    static std::string fileName(uint64_t frame) {
+        std::time_t now = std::time(nullptr);
+        std::tm local = {};
+#ifdef _WIN32
+        localtime_s(&local, &now);
+#else
+        localtime_r(&now, &local);
+#endif
+        char name[64];
+        size_t length = std::strftime(name, sizeof(name), "hitch-%Y%m%d-%H%M%S", &local);
+        std::snprintf(name + length, sizeof(name) - length, "-f%llu.json", (unsigned long long)frame);
+        return name;
+    }
+
+    static std::string quoted(const std::string& text) {
+        std::string out = "\"";
+        for (char c : text) {
+            if (c == '"' || c == '\\') out += '\\';
+            if ((unsigned char)c >= 0x20) out += c;
+        }
+        return out + "\"";
+    }
+
+    static void writeCapture(const std::string& path, const std::vector<Profiler::TrackEvents>& tracks,
+                             const std::vector<FrameRecord>& records, const State& state) {
+        std::ofstream file(path);
+        if (!file) {
+            logger.log(LOG_ERROR, "ERROR::HITCH_DETECTOR::FILE_NOT_WRITABLE: %s", path.c_str());
+            return;
+        }
+
+        file << "{\"traceEvents\": [\n";
+        if (!records.empty()) {
+            const FrameRecord& hitch = records.back();
+            char line[160];
+            std::snprintf(line, sizeof(line), "{\"name\": \"Hitch\", \"ph\": \"i\", \"s\": \"g\", \"pid\": 1, \"tid\": 0, \"ts\": %.3f}",
+                          hitch.start / 1000.0);
+            file << line;
+        }
+        if (!records.empty() && !tracks.empty()) file << ",\n";
+        unsigned long long scopes = Profiler::writeEvents(file, tracks);
+
+        // One counter track per quantity; the stages stack
+        bool first = records.empty() && tracks.empty();
+        for (const FrameRecord& record : records) {
+            char ts[32];
+            std::snprintf(ts, sizeof(ts), "%.3f", record.start / 1000.0);
+            auto counter = [&](const char* name, const std::string& args) {
+                file << (first ? "" : ",\n") << "{\"name\": \"" << name << "\", \"ph\": \"C\", \"pid\": 1, \"ts\": " << ts
+                     << ", \"args\": {" << args << "}}";
+                first = false;
+            };
+
+            std::string stages;
+            for (unsigned int s = 0; s < STAGE_COUNT; s++) {
+                stages += (s > 0 ? ", \"" : "\"") + std::string(FRAME_STAGE_NAMES[s]) + "\": " + std::to_string(record.stageMs[s]);
+            }
+            counter("Frame ms", "\"ms\": " + std::to_string(milliseconds(record)));
+            counter("Stage ms", stages);
+            counter("Draw calls", "\"draws\": " + std::to_string(record.drawCalls));
+            counter("GL calls", "\"issued\": " + std::to_string(record.issuedCalls) + ", \"skipped\": " + std::to_string(record.skippedCalls));
+            counter("Triangles", "\"triangles\": " + std::to_string(record.triangles));
+            counter("Heap allocations", "\"allocations\": " + std::to_string(record.heapAllocations));
+            counter("GPU memory MB", "\"mb\": " + std::to_string(record.gpuBytes / (1024.0 * 1024.0)));
+        }
+
+        file << "\n], \"displayTimeUnit\": \"ms\", \"otherData\": {";
+        for (size_t i = 0; i < state.size(); i++) {
+            file << (i > 0 ? ",\n  " : "\n  ") << quoted(state[i].first) << ": " << quoted(state[i].second);
+        }
+        file << "\n}}\n";
+
+        logger.log(LOG_INFO, "Hitch capture: %llu scopes over %zu frames written to %s", scopes, records.size(), path.c_str());
+    }
+};
+
+#endif
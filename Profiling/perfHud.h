@@ -0,0 +1,367 @@
+#ifndef PERF_HUD_H
+#define PERF_HUD_H
+
+#include <glad/glad.h>
+
+#include <glState.h>
+#include <shader_s.h>
+#include <heapCounters.h>
+#include <gpuMemory.h>
+#include "frameStats.h"
+#include "gpuProfiler.h"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// 5x7 glyphs, one byte per row (bit 4 is the left column). Lower case draws as upper case;
+// anything not listed is blank.
+struct HudGlyph {
+    char character;
+    unsigned char rows[7];
+};
+
+static const HudGlyph HUD_GLYPHS[] = {
+    {'!', {0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04}}, {'#', {0x0A, 0x0A, 0x1F, 0x0A, 0x1F, 0x0A, 0x0A}},
+    {'%', {0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03}}, {'(', {0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02}},
+    {')', {0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08}}, {'*', {0x00, 0x04, 0x15, 0x0E, 0x15, 0x04, 0x00}},
+    {'+', {0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00}}, {',', {0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08}},
+    {'-', {0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00}}, {'.', {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C}},
+    {'/', {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00}}, {'0', {0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E}},
+    {'1', {0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E}}, {'2', {0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F}},
+    {'3', {0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E}}, {'4', {0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02}},
+    {'5', {0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E}}, {'6', {0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E}},
+    {'7', {0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08}}, {'8', {0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E}},
+    {'9', {0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C}}, {':', {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00}},
+    {'<', {0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02}}, {'=', {0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00}},
+    {'>', {0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08}}, {'?', {0x0E, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04}},
+    {'A', {0x0E, 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11}}, {'B', {0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E}},
+    {'C', {0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E}}, {'D', {0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C}},
+    {'E', {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F}}, {'F', {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10}},
+    {'G', {0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F}}, {'H', {0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11}},
+    {'I', {0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E}}, {'J', {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C}},
+    {'K', {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11}}, {'L', {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F}},
+    {'M', {0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11}}, {'N', {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11}},
+    {'O', {0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}}, {'P', {0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10}},
+    {'Q', {0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D}}, {'R', {0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11}},
+    {'S', {0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E}}, {'T', {0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}},
+    {'U', {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}}, {'V', {0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04}},
+    {'W', {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A}}, {'X', {0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11}},
+    {'Y', {0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04}}, {'Z', {0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F}},
+    {'[', {0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E}}, {']', {0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E}},
+    {'_', {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F}}, {'|', {0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}},
+};
+
+// In-window performance overlay: a frame time graph, the CPU stages of the last frame, the
+// GPU pass timings, draw calls, triangles, GPU memory and heap allocations.
+//
+// Everything is a textured quad from one glyph atlas (solid quads sample its one all-set
+// cell), written into a vertex array reserved up front and copied into one dynamic vertex
+// buffer, then drawn with a single call. Building and drawing it doesn't allocate.
+class PerfHud {
+public:
+    static const unsigned int MAX_QUADS = 4096;         // Further quads are dropped
+    static const unsigned int GRAPH_FRAMES = 240;
+    static const int SCALE = 2;                         // Screen pixels per atlas texel
+    static constexpr float GRAPH_MAX_MS = 50.0f;        // Top of the graph
+
+    bool visible = false;
+
+    PerfHud() : shader("Shaders/hud.shader.vs", "Shaders/hud.shader.fs") {
+        vertices.reserve(MAX_QUADS * 4);
+        screenSizeLocation = glGetUniformLocation(shader.ID, "screenSize");
+        atlasLocation = glGetUniformLocation(shader.ID, "glyphAtlas");
+        createAtlas();
+        createBuffers();
+    }
+
+    ~PerfHud() {
+        glState.forgetTexture(atlas);
+        glState.forgetBuffer(VBO);
+        glState.forgetBuffer(EBO);
+        glState.forgetVertexArray(VAO);
+        glState.forgetProgram(shader.ID);
+        glDeleteTextures(1, &atlas);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &EBO);
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteProgram(shader.ID);
+        GpuMemory::textureBytes -= ATLAS_WIDTH * ATLAS_HEIGHT;
+        GpuMemory::bufferBytes -= MAX_QUADS * (4 * sizeof(HudVertex) + 6 * sizeof(uint16_t));
+    }
+
+    PerfHud(const PerfHud&) = delete;
+    PerfHud& operator=(const PerfHud&) = delete;
+
+    // Every frame, visible or not, so the graph has history when it is turned on
+    void addFrameTime(double ms) {
+        frameTimes[graphHead] = (float)ms;
+        graphHead = (graphHead + 1) % GRAPH_FRAMES;
+        if (graphFrames < GRAPH_FRAMES) graphFrames++;
+    }
+
+    // Draws over whatever is on screen; the counters are this frame's so far
+    void draw(const FrameStats& stats, unsigned long long frameAllocations, int width, int height) {
+        if (!visible) return;
+        vertices.clear();
+        build(stats, frameAllocations);
+        if (vertices.empty()) return;
+
+        // Invalidating drops last frame's contents, so the driver never waits on the GPU
+        size_t bytes = vertices.size() * sizeof(HudVertex);
+        glState.bindBuffer(GL_ARRAY_BUFFER, VBO);
+        void* mapped = glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (!mapped) return;
+        std::memcpy(mapped, vertices.data(), bytes);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+
+        glState.bindFramebuffer(0);
+        glState.viewport(0, 0, width, height);
+        glState.disable(GL_DEPTH_TEST);
+        glState.disable(GL_CULL_FACE);
+        glState.enable(GL_BLEND);
+        glState.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+        shader.use();
+        glUniform2f(screenSizeLocation, (float)width, (float)height);
+        glState.setUniform1i(shader.ID, atlasLocation, 0);
+        glState.bindTexture(0, GL_TEXTURE_2D, atlas);
+        glState.bindSampler(0, 0);
+        glState.bindVertexArray(VAO);
+        glState.drawElements(GL_TRIANGLES, (GLsizei)(vertices.size() / 4 * 6), GL_UNSIGNED_SHORT, 0);
+
+        glState.disable(GL_BLEND);
+        glState.enable(GL_CULL_FACE);
+        glState.enable(GL_DEPTH_TEST);
+    }
+
+private:
+    struct HudVertex {
+        float x, y;
+        float u, v;
+        uint32_t color;     // RGBA8
+    };
+
+    // Colours (0xAABBGGRR)
+    static const uint32_t PANEL_COLOR = 0xB0101010;
+    static const uint32_t TEXT_COLOR = 0xFFE6E6E6;
+    static const uint32_t HEADING_COLOR = 0xFFFFC860;
+    static const uint32_t GOOD_COLOR = 0xFF50D050;
+    static const uint32_t SLOW_COLOR = 0xFF30C8E8;
+    static const uint32_t BAD_COLOR = 0xFF4040F0;
+    static const uint32_t GUIDE_COLOR = 0x60FFFFFF;
+
+    // Atlas: ASCII 32-127 in 16 x 6 cells of 6 x 8 texels (glyph plus a spacing column and row)
+    static const int CELL_WIDTH = 6;
+    static const int CELL_HEIGHT = 8;
+    static const int ATLAS_COLUMNS = 16;
+    static const int ATLAS_WIDTH = CELL_WIDTH * ATLAS_COLUMNS;
+    static const int ATLAS_HEIGHT = CELL_HEIGHT * 6;
+    static const char SOLID_CELL = 127;
+
+    // Layout, in screen pixels
+    static const int MARGIN = 8;
+    static const int PADDING = 8;
+    static const int LINE_HEIGHT = CELL_HEIGHT * SCALE + 4;
+    static const int GLYPH_ADVANCE = CELL_WIDTH * SCALE;
+    static const int PANEL_WIDTH = 56 * GLYPH_ADVANCE + 2 * PADDING;
+    static const int GRAPH_HEIGHT = 80;
+    static const int BAR_WIDTH = 2;
+
+    Shader shader;
+    int screenSizeLocation = -1;
+    int atlasLocation = -1;
+    unsigned int atlas = 0;
+    unsigned int VAO = 0;
+    unsigned int VBO = 0;
+    unsigned int EBO = 0;
+
+    std::vector<HudVertex> vertices;
+    float frameTimes[GRAPH_FRAMES] = {};
+    unsigned int graphHead = 0;
+    unsigned int graphFrames = 0;       // Filled so far
+
+    void build(const FrameStats& stats, unsigned long long frameAllocations) {
+        float x = MARGIN + PADDING;
+        float y = MARGIN + PADDING;
+
+        // Panel first so everything else blends over it; its height is patched at the end
+        size_t panel = vertices.size();
+        rect(MARGIN, MARGIN, PANEL_WIDTH, 0.0f, PANEL_COLOR);
+
+        // Frame times over the graph
+        float sum = 0.0f, worst = 0.0f;
+        for (float ms : frameTimes) {
+            sum += ms;
+            worst = std::max(worst, ms);
+        }
+        float average = graphFrames > 0 ? sum / graphFrames : 0.0f;
+        text(x, y, TEXT_COLOR, "FPS %5.0f  %6.2f MS AVG  %6.2f MS MAX", average > 0.0f ? 1000.0f / average : 0.0f, average, worst);
+        y += LINE_HEIGHT;
+
+        graph(x, y);
+        y += GRAPH_HEIGHT + 6;
+
+        // CPU stages of the last frame, three to a line
+        text(x, y, HEADING_COLOR, "CPU MS  %.3f", stats.lastFrameMs());
+        y += LINE_HEIGHT;
+        for (unsigned int s = 0; s < STAGE_COUNT; s++) {
+            text(x + (s % 3) * 19 * GLYPH_ADVANCE, y, TEXT_COLOR, "%-10s %6.3f", FRAME_STAGE_NAMES[s], stats.lastStageMs((Frame_Stage)s));
+            if (s % 3 == 2 || s + 1 == STAGE_COUNT) y += LINE_HEIGHT;
+        }
+
+        // GPU passes (rolling averages), two to a line
+        const std::vector<GpuProfiler::Timing>& timings = gpuProfiler.timings();
+        text(x, y, HEADING_COLOR, "GPU MS");
+        y += LINE_HEIGHT;
+        for (size_t i = 0; i < timings.size(); i++) {
+            text(x + (i % 2) * 28 * GLYPH_ADVANCE, y, TEXT_COLOR, "%-16.16s %7.3f", timings[i].name, timings[i].averageMs);
+            if (i % 2 == 1 || i + 1 == timings.size()) y += LINE_HEIGHT;
+        }
+
+        // Counters
+        text(x, y, HEADING_COLOR, "COUNTERS");
+        y += LINE_HEIGHT;
+        text(x, y, TEXT_COLOR, "DRAWS %u  TRIANGLES %llu  GL CALLS %u (%u SKIPPED)",
+             glState.drawCalls, glState.triangles, glState.issuedCalls, glState.skippedCalls);
+        y += LINE_HEIGHT;
+        text(x, y, TEXT_COLOR, "TEXTURES %.1f MB  BUFFERS %.1f MB",
+             GpuMemory::textureBytes / (1024.0 * 1024.0), GpuMemory::bufferBytes / (1024.0 * 1024.0));
+        y += LINE_HEIGHT;
+        text(x, y, TEXT_COLOR, "HEAP ALLOCS %llu/FRAME  %llu TOTAL", frameAllocations,
+             (unsigned long long)HeapCounters::allocations.load(std::memory_order_relaxed));
+        y += LINE_HEIGHT;
+
+        // The panel's bottom edge
+        float bottom = y + PADDING - 4;
+        vertices[panel + 2].y = bottom;
+        vertices[panel + 3].y = bottom;
+    }
+
+    // Oldest frame on the left; bars coloured against 60 and 30 fps
+    void graph(float x, float y) {
+        const float scale = GRAPH_HEIGHT / GRAPH_MAX_MS;
+        for (unsigned int i = 0; i < GRAPH_FRAMES; i++) {
+            float ms = frameTimes[(graphHead + i) % GRAPH_FRAMES];
+            float height = std::min(ms, GRAPH_MAX_MS) * scale;
+            uint32_t color = ms <= 1000.0f / 60.0f + 0.5f ? GOOD_COLOR : ms <= 1000.0f / 30.0f + 0.5f ? SLOW_COLOR : BAD_COLOR;
+            rect(x + i * BAR_WIDTH, y + GRAPH_HEIGHT - height, BAR_WIDTH, height, color);
+        }
+
+        float graphWidth = GRAPH_FRAMES * BAR_WIDTH;
+        rect(x, y + GRAPH_HEIGHT - 1000.0f / 60.0f * scale, graphWidth, 1.0f, GUIDE_COLOR);
+        rect(x, y + GRAPH_HEIGHT - 1000.0f / 30.0f * scale, graphWidth, 1.0f, GUIDE_COLOR);
+        text(x + graphWidth + 6, y + GRAPH_HEIGHT - 1000.0f / 60.0f * scale - CELL_HEIGHT, GUIDE_COLOR, "16.7");
+        text(x + graphWidth + 6, y + GRAPH_HEIGHT - 1000.0f / 30.0f * scale - CELL_HEIGHT, GUIDE_COLOR, "33.3");
+    }
+
+    void text(float x, float y, uint32_t color, const char* format, ...) {
+        char line[128];
+        va_list args;
+        va_start(args, format);
+        int length = std::vsnprintf(line, sizeof(line), format, args);
+        va_end(args);
+        length = std::min(length, (int)sizeof(line) - 1);
+
+        for (int i = 0; i < length; i++, x += GLYPH_ADVANCE) {
+            if (line[i] != ' ') glyph(x, y, line[i], color);
+        }
+    }
+
+    void rect(float x, float y, float width, float height, uint32_t color) {
+        // Centre of the solid cell, so filtering never reaches a neighbour
+        float u, v;
+        cellOrigin(SOLID_CELL, u, v);
+        u += 0.5f * CELL_WIDTH / ATLAS_WIDTH;
+        v += 0.5f * CELL_HEIGHT / ATLAS_HEIGHT;
+        quad(x, y, x + width, y + height, u, v, u, v, color);
+    }
+
+    void glyph(float x, float y, char character, uint32_t color) {
+        if (character < 32 || character >= SOLID_CELL) return;
+        float u, v;
+        cellOrigin(character, u, v);
+        quad(x, y, x + GLYPH_ADVANCE, y + CELL_HEIGHT * SCALE, u, v,
+             u + (float)CELL_WIDTH / ATLAS_WIDTH, v + (float)CELL_HEIGHT / ATLAS_HEIGHT, color);
+    }
+
+    void quad(float x0, float y0, float x1, float y1, float u0, float v0, float u1, float v1, uint32_t color) {
+        if (vertices.size() + 4 > vertices.capacity()) return;
+        vertices.push_back(HudVertex{x0, y0, u0, v0, color});
+        vertices.push_back(HudVertex{x1, y0, u1, v0, color});
+        vertices.push_back(HudVertex{x1, y1, u1, v1, color});
+        vertices.push_back(HudVertex{x0, y1, u0, v1, color});
+    }
+
+    static void cellOrigin(char character, float& u, float& v) {
+        int cell = character - 32;
+        u = (float)(cell % ATLAS_COLUMNS * CELL_WIDTH) / ATLAS_WIDTH;
+        v = (float)(cell / ATLAS_COLUMNS * CELL_HEIGHT) / ATLAS_HEIGHT;
+    }
+
+    // Row 0 of the texture holds the top of the first row of cells
+    void createAtlas() {
+        std::vector<unsigned char> texels(ATLAS_WIDTH * ATLAS_HEIGHT, 0);
+        auto fillCell = [&](char character, const unsigned char* rows) {
+            int cell = character - 32;
+            int left = cell % ATLAS_COLUMNS * CELL_WIDTH;
+            int top = cell / ATLAS_COLUMNS * CELL_HEIGHT;
+            for (int row = 0; row < CELL_HEIGHT; row++) {
+                for (int column = 0; column < CELL_WIDTH; column++) {
+                    bool set = rows ? row < 7 && column < 5 && (rows[row] >> (4 - column) & 1) : true;
+                    texels[(top + row) * ATLAS_WIDTH + left + column] = set ? 255 : 0;
+                }
+            }
+        };
+        for (const HudGlyph& glyph : HUD_GLYPHS) {
+            fillCell(glyph.character, glyph.rows);
+            if (glyph.character >= 'A' && glyph.character <= 'Z') fillCell(glyph.character - 'A' + 'a', glyph.rows);
+        }
+        fillCell(SOLID_CELL, nullptr);
+
+        glGenTextures(1, &atlas);
+        glState.bindTexture(0, GL_TEXTURE_2D, atlas);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, ATLAS_WIDTH, ATLAS_HEIGHT, 0, GL_RED, GL_UNSIGNED_BYTE, texels.data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        GpuMemory::textureBytes += ATLAS_WIDTH * ATLAS_HEIGHT;
+    }
+
+    // Quads share one static index buffer; the vertex buffer is refilled every frame
+    void createBuffers() {
+        std::vector<uint16_t> indices(MAX_QUADS * 6);
+        for (unsigned int q = 0; q < MAX_QUADS; q++) {
+            uint16_t first = (uint16_t)(q * 4);
+            uint16_t quadIndices[6] = {first, (uint16_t)(first + 1), (uint16_t)(first + 2),
+                                       first, (uint16_t)(first + 2), (uint16_t)(first + 3)};
+            std::memcpy(&indices[q * 6], quadIndices, sizeof(quadIndices));
+        }
+
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+        glState.bindVertexArray(VAO);
+
+        glState.bindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, MAX_QUADS * 4 * sizeof(HudVertex), NULL, GL_STREAM_DRAW);
+        glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint16_t), indices.data(), GL_STATIC_DRAW);
+        GpuMemory::bufferBytes += MAX_QUADS * (4 * sizeof(HudVertex) + 6 * sizeof(uint16_t));
+
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(HudVertex), (void*)offsetof(HudVertex, x));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(HudVertex), (void*)offsetof(HudVertex, u));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(HudVertex), (void*)offsetof(HudVertex, color));
+
+        glState.bindVertexArray(0);
+    }
+};
+
+#endif
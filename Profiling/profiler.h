@@ -0,0 +1,256 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <logger.h>
+
+// CPU scope profiler. PROFILE_SCOPE("Name") times the rest of the enclosing block; each thread
+// records into its own ring buffer (single writer, no locks), so jobs can be profiled too.
+//
+// Nothing is recorded outside a capture: a scope then costs one relaxed load. capture() records
+// the next few frames and writes them as a Chrome trace (chrome://tracing, Perfetto) when the
+// last one ends. Rings keep the newest RING_CAPACITY scopes per thread; in continuous mode
+// they always record, so the last few seconds can be copied out after something goes wrong.
+class Profiler {
+public:
+    static const unsigned int RING_CAPACITY = 1 << 16;     // Power of two
+
+    struct Event {
+        const char* name;       // Must outlive the capture (string literals)
+        uint64_t start;         // Nanoseconds since the profiler started
+        uint64_t end;
+    };
+
+    // Scopes copied out of one thread's (or track's) ring
+    struct TrackEvents {
+        unsigned int id;
+        std::string name;
+        std::vector<Event> events;
+    };
+
+    Profiler() : epoch(Clock::now()) {}
+
+    bool isRecording() const {
+        return recording.load(std::memory_order_relaxed);
+    }
+
+    uint64_t now() const {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - epoch).count();
+    }
+
+    // Record all the time (captures still write only their own frames)
+    void setContinuous(bool on) {
+        continuous = on;
+        if (!capturing) recording.store(on, std::memory_order_relaxed);
+    }
+
+    // Record frames frames from the next beginFrame(), then write them to path
+    void capture(unsigned int frames, const std::string& path) {
+        if (capturing) return;
+        capturePath = path;
+        captureFrames = std::max(frames, 1u);
+        capturing = true;
+        startPending = true;
+    }
+
+    // Call at the top of every frame, on the main thread
+    void beginFrame() {
+        if (!capturing) return;
+        if (startPending) {
+            startPending = false;
+            framesLeft = captureFrames;
+            captureStart = now();
+            recording.store(true, std::memory_order_relaxed);
+            return;
+        }
+        if (--framesLeft == 0) {
+            recording.store(continuous, std::memory_order_relaxed);
+            captureEnd = now();
+            capturing = false;
+            writeTrace(capturePath.c_str());
+        }
+    }
+
+    // Names this thread in traces (its ring is only made once it records something)
+    void setThreadName(const char* name) {
+        std::snprintf(threadName, sizeof(threadName), "%s", name);
+        if (threadRingPointer) {
+            std::snprintf(threadRingPointer->name, sizeof(threadRingPointer->name), "%s", name);
+        }
+    }
+
+    void record(const char* name, uint64_t start, uint64_t end) {
+        push(threadRing(), Event{name, start, end});
+    }
+
+    // Scopes timed elsewhere (GPU queries) go on a track of their own. Each track must only
+    // be written by one thread.
+    void recordOnTrack(const char* track, const char* name, uint64_t start, uint64_t end) {
+        ThreadRing* ring = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            for (const std::unique_ptr<ThreadRing>& candidate : rings) {
+                if (candidate->track && std::strcmp(candidate->name, track) == 0) ring = candidate.get();
+            }
+            if (!ring) {
+                ring = addRing(track);
+                ring->track = true;
+            }
+        }
+        push(*ring, Event{name, start, end});
+    }
+
+    bool writeTrace(const char* path) {
+        std::ofstream file(path);
+        if (!file) {
+            logger.log(LOG_ERROR, "ERROR::PROFILER::FILE_NOT_WRITABLE: %s", path);
+            return false;
+        }
+
+        std::vector<TrackEvents> tracks = copyEvents(captureStart, captureEnd);
+        file << "{\"traceEvents\": [\n";
+        unsigned long long written = writeEvents(file, tracks);
+        file << "\n], \"displayTimeUnit\": \"ms\"}\n";
+
+        logger.log(LOG_INFO, "Profiler: %llu scopes over %u frames written to %s", written, captureFrames, path);
+        return true;
+    }
+
+    // Scopes that started between from and to, oldest first, from every ring. Rings written
+    // during the copy may lose their oldest scopes to it, so copy while the workers are idle.
+    std::vector<TrackEvents> copyEvents(uint64_t from, uint64_t to) {
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        std::vector<TrackEvents> tracks;
+        for (const std::unique_ptr<ThreadRing>& ring : rings) {
+            tracks.push_back(TrackEvents{ring->id, ring->name, {}});
+            uint64_t head = ring->head.load(std::memory_order_acquire);
+            uint64_t count = std::min<uint64_t>(head, RING_CAPACITY);
+            for (uint64_t i = head - count; i < head; i++) {
+                const Event& event = ring->events[i & (RING_CAPACITY - 1)];
+                if (event.start >= from && event.start <= to) tracks.back().events.push_back(event);
+            }
+        }
+        return tracks;
+    }
+
+    // Thread names and complete events, comma separated (no enclosing brackets); returns how
+    // many scopes were written
+    static unsigned long long writeEvents(std::ostream& out, const std::vector<TrackEvents>& tracks) {
+        bool first = true;
+        unsigned long long written = 0;
+        for (const TrackEvents& track : tracks) {
+            out << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << track.id
+                << ", \"args\": {\"name\": \"" << track.name << "\"}}";
+            first = false;
+
+            for (const Event& event : track.events) {
+                char line[256];
+                std::snprintf(line, sizeof(line),
+                              ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+                              event.name, track.id, event.start / 1000.0, (event.end - event.start) / 1000.0);
+                out << line;
+                written++;
+            }
+        }
+        return written;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct ThreadRing {
+        unsigned int id;
+        char name[32];
+        bool track = false;
+        std::unique_ptr<Event[]> events{new Event[RING_CAPACITY]};
+        std::atomic<uint64_t> head{0};
+    };
+
+    const Clock::time_point epoch;
+    std::atomic<bool> recording{false};
+
+    // Rings live as long as the profiler, so a thread can exit before its scopes are written
+    std::mutex ringsMutex;
+    std::vector<std::unique_ptr<ThreadRing>> rings;
+
+    // Capture window (main thread)
+    bool continuous = false;
+    bool capturing = false;
+    bool startPending = false;
+    unsigned int captureFrames = 0;
+    unsigned int framesLeft = 0;
+    uint64_t captureStart = 0;
+    uint64_t captureEnd = 0;
+    std::string capturePath;
+
+    static inline thread_local ThreadRing* threadRingPointer = nullptr;
+    static inline thread_local char threadName[32] = "";
+
+    // Caller holds ringsMutex
+    ThreadRing* addRing(const char* name) {
+        rings.push_back(std::make_unique<ThreadRing>());
+        ThreadRing* ring = rings.back().get();
+        ring->id = (unsigned int)rings.size();
+        if (name[0]) {
+            std::snprintf(ring->name, sizeof(ring->name), "%s", name);
+        }
+        else {
+            std::snprintf(ring->name, sizeof(ring->name), "Thread %u", ring->id);
+        }
+        return ring;
+    }
+
+    ThreadRing& threadRing() {
+        if (!threadRingPointer) {
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            threadRingPointer = addRing(threadName);
+        }
+        return *threadRingPointer;
+    }
+
+    static void push(ThreadRing& ring, const Event& event) {
+        uint64_t head = ring.head.load(std::memory_order_relaxed);
+        ring.events[head & (RING_CAPACITY - 1)] = event;
+        ring.head.store(head + 1, std::memory_order_release);
+    }
+};
+
+inline Profiler profiler;
+
+// Times the enclosing scope while a capture is running
+class ProfileScope {
+public:
+    explicit ProfileScope(const char* scopeName) {
+        if (!profiler.isRecording()) return;
+        name = scopeName;
+        start = profiler.now();
+    }
+
+    ~ProfileScope() {
+        if (name) profiler.record(name, start, profiler.now());
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    const char* name = nullptr;
+    uint64_t start = 0;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+
+#endif
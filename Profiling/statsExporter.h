@@ -0,0 +1,401 @@
+#ifndef STATS_EXPORTER_H
+#define STATS_EXPORTER_H
+
+#include <logger.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <windows.h>
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+// Upper bounds of the frame time histogram buckets, in ms (one more bucket takes the rest)
+static const double STATS_FRAME_BUCKETS_MS[] = {4.0, 8.0, 12.0, 16.7, 20.0, 25.0, 33.3, 50.0, 100.0, 250.0};
+static const unsigned int STATS_FRAME_BUCKET_COUNT = sizeof(STATS_FRAME_BUCKETS_MS) / sizeof(STATS_FRAME_BUCKETS_MS[0]) + 1;
+
+// Counters as published. Plain data at fixed offsets, so other processes can read it
+// straight out of the stats file.
+struct StatsSnapshot {
+    uint64_t frames;
+    uint64_t hitches;                       // Frames longer than hitchThresholdMs
+    uint64_t frameBuckets[STATS_FRAME_BUCKET_COUNT];     // Not cumulative
+    double frameSecondsSum;
+    double fps;                             // Over the last publish interval
+    double frameMsAverage;                  // Over the last publish interval
+    double frameMsMax;                      // Over the last publish interval
+    double hitchThresholdMs;
+    double uptimeSeconds;
+    double startupSeconds;                  // Process start to the first frame
+    double sceneLoadSeconds;                // Models, textures and scene set-up
+    uint64_t textureBytes;                  // GPU memory the engine asked for
+    uint64_t bufferBytes;
+    uint64_t heapAllocations;               // Since start
+    uint32_t drawCalls;                     // Last frame
+    uint32_t pointLights;
+};
+
+// The stats file: a header, then the snapshot. sequence is odd while the engine is writing;
+// a reader copies the snapshot and keeps it if sequence was the same even number before and
+// after.
+struct StatsPage {
+    char magic[4];                          // "FWST"
+    uint32_t version;
+    std::atomic<uint32_t> sequence;
+    uint32_t processId;
+    StatsSnapshot snapshot;
+};
+
+// Publishes rolling performance counters for processes that can't be profiled directly: into
+// a memory-mapped stats file (--stats-file) that any local process can map and read, and as
+// Prometheus text on a local HTTP endpoint (--stats-port, 127.0.0.1 only, GET /metrics).
+//
+// The render thread only updates counters (no allocation, no syscalls) and copies a snapshot
+// into the page a few times a second. The endpoint runs on its own thread and formats from
+// that page, so a slow scraper never holds up a frame.
+class StatsExporter {
+public:
+    static const uint32_t VERSION = 1;
+    static constexpr double PUBLISH_INTERVAL = 0.25;    // Seconds
+    static const int POLL_MS = 100;                     // How quickly the server notices stop()
+
+    double hitchThresholdMs = 50.0;
+
+    StatsExporter() : started(Clock::now()) {
+        page = &localPage;
+        initPage(*page);
+    }
+
+    ~StatsExporter() {
+        stop();
+        closeFile();
+    }
+
+    StatsExporter(const StatsExporter&) = delete;
+    StatsExporter& operator=(const StatsExporter&) = delete;
+
+    bool isEnabled() const {
+        return page != &localPage || serving.load(std::memory_order_relaxed);
+    }
+
+    // Maps path as the page (created or truncated to fit)
+    bool openFile(const std::string& path) {
+#ifdef _WIN32
+        fileHandle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                 NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (fileHandle != INVALID_HANDLE_VALUE) {
+            mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READWRITE, 0, sizeof(StatsPage), NULL);
+        }
+        void* mapped = mappingHandle ? MapViewOfFile(mappingHandle, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(StatsPage)) : nullptr;
+#else
+        int descriptor = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        void* mapped = nullptr;
+        if (descriptor >= 0 && ftruncate(descriptor, sizeof(StatsPage)) == 0) {
+            mapped = mmap(nullptr, sizeof(StatsPage), PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+            if (mapped == MAP_FAILED) mapped = nullptr;
+        }
+        if (descriptor >= 0) ::close(descriptor);
+#endif
+        if (!mapped) {
+            logger.log(LOG_ERROR, "ERROR::STATS::FILE_NOT_MAPPED %s", path.c_str());
+            closeFile();
+            return false;
+        }
+
+        page = new (mapped) StatsPage();
+        initPage(*page);
+        logger.log(LOG_INFO, "Stats: publishing to %s", path.c_str());
+        return true;
+    }
+
+    // Starts the HTTP endpoint on 127.0.0.1:port
+    bool listen(unsigned int port) {
+#ifdef _WIN32
+        WSADATA data;
+        if (WSAStartup(MAKEWORD(2, 2), &data) != 0) return false;
+#endif
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        if (listener == INVALID_SOCKET_VALUE) {
+            logger.log(LOG_ERROR, "ERROR::STATS::SOCKET_FAILED");
+            return false;
+        }
+        int reuse = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons((uint16_t)port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || ::listen(listener, 4) != 0) {
+            logger.log(LOG_ERROR, "ERROR::STATS::PORT_NOT_AVAILABLE %u", port);
+            closeSocket(listener);
+            listener = INVALID_SOCKET_VALUE;
+            return false;
+        }
+
+        serving = true;
+        server = std::thread([this] { serve(); });
+        logger.log(LOG_INFO, "Stats: serving http://127.0.0.1:%u/metrics", port);
+        return true;
+    }
+
+    void setLoadTimes(double startupSeconds, double sceneLoadSeconds) {
+        current.startupSeconds = startupSeconds;
+        current.sceneLoadSeconds = sceneLoadSeconds;
+    }
+
+    // Once per frame from the render thread
+    void recordFrame(double frameSeconds, unsigned int drawCalls, unsigned int pointLights,
+                     unsigned long long textureBytes, unsigned long long bufferBytes, unsigned long long heapAllocations) {
+        double ms = frameSeconds * 1000.0;
+        unsigned int bucket = 0;
+        while (bucket + 1 < STATS_FRAME_BUCKET_COUNT && ms > STATS_FRAME_BUCKETS_MS[bucket]) bucket++;
+
+        current.frames++;
+        current.frameBuckets[bucket]++;
+        current.frameSecondsSum += frameSeconds;
+        if (ms > hitchThresholdMs) current.hitches++;
+        current.drawCalls = drawCalls;
+        current.pointLights = pointLights;
+        current.textureBytes = textureBytes;
+        current.bufferBytes = bufferBytes;
+        current.heapAllocations = heapAllocations;
+
+        intervalFrames++;
+        intervalSeconds += frameSeconds;
+        intervalMaxMs = ms > intervalMaxMs ? ms : intervalMaxMs;
+        if (intervalSeconds >= PUBLISH_INTERVAL) publish();
+    }
+
+    // Stops the endpoint (the file keeps its last snapshot)
+    void stop() {
+        if (!serving.exchange(false)) return;
+        server.join();
+        closeSocket(listener);
+        listener = INVALID_SOCKET_VALUE;
+#ifdef _WIN32
+        WSACleanup();
+#endif
+    }
+
+    // A consistent copy of the page, from any thread (or process, through the file)
+    static StatsSnapshot read(const StatsPage& source) {
+        StatsSnapshot copy;
+        while (true) {
+            uint32_t before = source.sequence.load(std::memory_order_acquire);
+            std::memcpy(&copy, &source.snapshot, sizeof(copy));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (!(before & 1u) && source.sequence.load(std::memory_order_relaxed) == before) return copy;
+            std::this_thread::yield();
+        }
+    }
+
+    // Prometheus text exposition format
+    static std::string formatPrometheus(const StatsSnapshot& stats) {
+        std::string out;
+        char line[512];
+        auto append = [&](const char* format, auto... values) {
+            std::snprintf(line, sizeof(line), format, values...);
+            out += line;
+        };
+
+        append("# HELP ferris_frame_seconds Frame time.\n# TYPE ferris_frame_seconds histogram\n");
+        uint64_t cumulative = 0;
+        for (unsigned int b = 0; b < STATS_FRAME_BUCKET_COUNT; b++) {
+            cumulative += stats.frameBuckets[b];
+            if (b + 1 < STATS_FRAME_BUCKET_COUNT) {
+                append("ferris_frame_seconds_bucket{le=\"%g\"} %llu\n", STATS_FRAME_BUCKETS_MS[b] / 1000.0, (unsigned long long)cumulative);
+            }
+            else {
+                append("ferris_frame_seconds_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)cumulative);
+            }
+        }
+        append("ferris_frame_seconds_sum %.6f\nferris_frame_seconds_count %llu\n", stats.frameSecondsSum, (unsigned long long)stats.frames);
+
+        append("# HELP ferris_fps Frames per second over the last publish interval.\n# TYPE ferris_fps gauge\nferris_fps %.2f\n", stats.fps);
+        append("# HELP ferris_frame_ms Frame time over the last publish interval.\n# TYPE ferris_frame_ms gauge\n"
+               "ferris_frame_ms{stat=\"average\"} %.3f\nferris_frame_ms{stat=\"max\"} %.3f\n", stats.frameMsAverage, stats.frameMsMax);
+        append("# HELP ferris_hitches_total Frames longer than the hitch threshold.\n# TYPE ferris_hitches_total counter\n"
+               "ferris_hitches_total %llu\n", (unsigned long long)stats.hitches);
+        append("# HELP ferris_hitch_threshold_seconds Hitch threshold.\n# TYPE ferris_hitch_threshold_seconds gauge\n"
+               "ferris_hitch_threshold_seconds %g\n", stats.hitchThresholdMs / 1000.0);
+        append("# HELP ferris_gpu_memory_bytes Texture and buffer storage allocated (estimate).\n# TYPE ferris_gpu_memory_bytes gauge\n"
+               "ferris_gpu_memory_bytes{kind=\"texture\"} %llu\nferris_gpu_memory_bytes{kind=\"buffer\"} %llu\n",
+               (unsigned long long)stats.textureBytes, (unsigned long long)stats.bufferBytes);
+        append("# HELP ferris_load_seconds Load times.\n# TYPE ferris_load_seconds gauge\n"
+               "ferris_load_seconds{phase=\"startup\"} %.3f\nferris_load_seconds{phase=\"scene\"} %.3f\n",
+               stats.startupSeconds, stats.sceneLoadSeconds);
+        append("# HELP ferris_draw_calls Draw calls in the last frame.\n# TYPE ferris_draw_calls gauge\nferris_draw_calls %u\n", stats.drawCalls);
+        append("# HELP ferris_point_lights Point lights in the scene.\n# TYPE ferris_point_lights gauge\nferris_point_lights %u\n", stats.pointLights);
+        append("# HELP ferris_heap_allocations_total Heap allocations since start.\n# TYPE ferris_heap_allocations_total counter\n"
+               "ferris_heap_allocations_total %llu\n", (unsigned long long)stats.heapAllocations);
+        append("# HELP ferris_uptime_seconds Time since start.\n# TYPE ferris_uptime_seconds gauge\nferris_uptime_seconds %.3f\n", stats.uptimeSeconds);
+        return out;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+#ifdef _WIN32
+    using Socket = SOCKET;
+    static constexpr Socket INVALID_SOCKET_VALUE = INVALID_SOCKET;
+#else
+    using Socket = int;
+    static constexpr Socket INVALID_SOCKET_VALUE = -1;
+#endif
+
+    const Clock::time_point started;
+    StatsPage localPage;            // Used until (unless) a file is mapped
+    StatsPage* page = nullptr;
+#ifdef _WIN32
+    HANDLE fileHandle = INVALID_HANDLE_VALUE;
+    HANDLE mappingHandle = NULL;
+#endif
+
+    // Render thread
+    StatsSnapshot current = {};
+    unsigned int intervalFrames = 0;
+    double intervalSeconds = 0.0;
+    double intervalMaxMs = 0.0;
+
+    // Endpoint
+    Socket listener = INVALID_SOCKET_VALUE;
+    std::thread server;
+    std::atomic<bool> serving{false};
+
+    void closeFile() {
+        if (page != &localPage) {
+#ifdef _WIN32
+            UnmapViewOfFile(page);
+#else
+            munmap(page, sizeof(StatsPage));
+#endif
+            page = &localPage;
+        }
+#ifdef _WIN32
+        if (mappingHandle) CloseHandle(mappingHandle);
+        if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+        mappingHandle = NULL;
+        fileHandle = INVALID_HANDLE_VALUE;
+#endif
+    }
+
+    static void initPage(StatsPage& target) {
+        std::memcpy(target.magic, "FWST", 4);
+        target.version = VERSION;
+        target.sequence.store(0, std::memory_order_relaxed);
+#ifdef _WIN32
+        target.processId = (uint32_t)GetCurrentProcessId();
+#else
+        target.processId = (uint32_t)getpid();
+#endif
+        target.snapshot = StatsSnapshot{};
+    }
+
+    void publish() {
+        current.fps = intervalFrames / intervalSeconds;
+        current.frameMsAverage = intervalSeconds * 1000.0 / intervalFrames;
+        current.frameMsMax = intervalMaxMs;
+        current.hitchThresholdMs = hitchThresholdMs;
+        current.uptimeSeconds = std::chrono::duration<double>(Clock::now() - started).count();
+        intervalFrames = 0;
+        intervalSeconds = 0.0;
+        intervalMaxMs = 0.0;
+
+        uint32_t sequence = page->sequence.load(std::memory_order_relaxed);
+        page->sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(&page->snapshot, &current, sizeof(current));
+        page->sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    // One request per connection; anything but GET /metrics gets a 404
+    void serve() {
+        while (serving.load(std::memory_order_relaxed)) {
+            if (!waitReadable(listener)) continue;
+            Socket client = accept(listener, nullptr, nullptr);
+            if (client == INVALID_SOCKET_VALUE) continue;
+#ifdef SO_NOSIGPIPE
+            // No MSG_NOSIGNAL on macOS; a scraper hanging up must not raise SIGPIPE
+            int noSignal = 1;
+            setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &noSignal, sizeof(noSignal));
+#endif
+
+            char request[1024];
+            int received = waitReadable(client) ? (int)recv(client, request, sizeof(request) - 1, 0) : 0;
+            request[received > 0 ? received : 0] = '\0';
+
+            std::string body, status;
+            if (std::strncmp(request, "GET /metrics", 12) == 0) {
+                status = "200 OK";
+                body = formatPrometheus(read(*page));
+            }
+            else {
+                status = "404 Not Found";
+                body = "Not found; try /metrics\n";
+            }
+            std::string response = "HTTP/1.1 " + status + "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+                                   + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+            if (!sendAll(client, response)) {
+                logger.log(LOG_WARNING, "Stats: client closed the connection before the response was sent");
+            }
+            closeSocket(client);
+        }
+    }
+
+    // False if the client went away first. A closed connection is an error, never SIGPIPE.
+    static bool sendAll(Socket socket, const std::string& data) {
+#ifdef MSG_NOSIGNAL
+        const int flags = MSG_NOSIGNAL;
+#else
+        const int flags = 0;
+#endif
+        size_t sent = 0;
+        while (sent < data.size()) {
+            int result = (int)send(socket, data.data() + sent, (int)(data.size() - sent), flags);
+            if (result <= 0) return false;
+            sent += (size_t)result;
+        }
+        return true;
+    }
+
+    static bool waitReadable(Socket socket) {
+#ifdef _WIN32
+        WSAPOLLFD descriptor = {socket, POLLRDNORM, 0};
+        return WSAPoll(&descriptor, 1, POLL_MS) > 0;
+#else
+        pollfd descriptor = {socket, POLLIN, 0};
+        return poll(&descriptor, 1, POLL_MS) > 0;
+#endif
+    }
+
+    static void closeSocket(Socket socket) {
+        if (socket == INVALID_SOCKET_VALUE) return;
+#ifdef _WIN32
+        closesocket(socket);
+#else
+        ::close(socket);
+#endif
+    }
+};
+
+inline StatsExporter statsExporter;
+
+#endif
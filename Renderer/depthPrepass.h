@@ -0,0 +1,128 @@
+#ifndef DEPTH_PREPASS_H
+#define DEPTH_PREPASS_H
+
+#include <glad/glad.h>
+#include <glm.hpp>
+
+#include <glState.h>
+#include <shader_s.h>
+
+enum Prepass_Mode {
+    PREPASS_AUTO,
+    PREPASS_ALWAYS,
+    PREPASS_NEVER
+};
+
+// Optional depth-only pass ahead of shading. Once the depth buffer holds the final surface,
+// the shading pass tests with GL_EQUAL and every covered pixel runs the expensive shader once.
+//
+// In auto mode the overdraw is measured with sample queries: fragments passing the pre-pass
+// (what shading alone would have run) over fragments passing GL_EQUAL (pixels covered).
+// While off, a probe frame runs the pre-pass every PROBE_INTERVAL frames to re-measure.
+class DepthPrepass {
+public:
+    static constexpr float ENABLE_OVERDRAW = 1.5f;
+    static constexpr float DISABLE_OVERDRAW = 1.2f;
+    static const unsigned int PROBE_INTERVAL = 120;
+    static const unsigned int QUERY_FRAMES = 3;     // Results are read a few frames late to avoid stalls
+
+    Prepass_Mode mode = PREPASS_AUTO;
+
+    // Auto mode's current decision and the last measurement
+    bool enabled = false;
+    float overdraw = 1.0f;
+
+    Shader depthShader;
+
+    DepthPrepass() : depthShader("Shaders/depth.shader.vs", "Shaders/depth.shader.fs") {
+        glGenQueries(QUERY_FRAMES * 2, queries);
+    }
+
+    ~DepthPrepass() {
+        glDeleteQueries(QUERY_FRAMES * 2, queries);
+        glState.forgetProgram(depthShader.ID);
+        glDeleteProgram(depthShader.ID);
+    }
+
+    DepthPrepass(const DepthPrepass&) = delete;
+    DepthPrepass& operator=(const DepthPrepass&) = delete;
+
+    // Returns true if this frame runs the pre-pass
+    bool beginFrame() {
+        collectResults();
+
+        if (mode == PREPASS_ALWAYS) active = true;
+        else if (mode == PREPASS_NEVER) active = false;
+        else active = enabled || framesSinceProbe >= PROBE_INTERVAL;
+
+        if (active && !enabled) framesSinceProbe = 0;
+        else framesSinceProbe++;
+
+        slot = (slot + 1) % QUERY_FRAMES;
+        measuring = active && !pending[slot];
+        return active;
+    }
+
+    void beginDepthPass(const glm::mat4& projection, const glm::mat4& view) {
+        depthShader.use();
+        depthShader.setMat4("projection", projection);
+        depthShader.setMat4("view", view);
+
+        glState.colorMask(false);
+        glState.depthMask(true);
+        glState.depthFunc(GL_LESS);
+        if (measuring) glBeginQuery(GL_SAMPLES_PASSED, queries[slot * 2]);
+    }
+
+    void endDepthPass() {
+        if (measuring) glEndQuery(GL_SAMPLES_PASSED);
+        glState.colorMask(true);
+    }
+
+    // Depth is already final: shade only the front-most fragment, leave the buffer alone
+    void beginShadingPass() {
+        if (!active) return;
+        glState.depthFunc(GL_EQUAL);
+        glState.depthMask(false);
+        if (measuring) glBeginQuery(GL_SAMPLES_PASSED, queries[slot * 2 + 1]);
+    }
+
+    void endShadingPass() {
+        if (!active) return;
+        if (measuring) {
+            glEndQuery(GL_SAMPLES_PASSED);
+            pending[slot] = true;
+        }
+        glState.depthFunc(GL_LESS);
+        glState.depthMask(true);
+    }
+
+private:
+    unsigned int queries[QUERY_FRAMES * 2];
+    bool pending[QUERY_FRAMES] = {};
+    unsigned int slot = 0;
+    unsigned int framesSinceProbe = PROBE_INTERVAL;    // Probe on the first frame
+    bool active = false;
+    bool measuring = false;
+
+    // Read whichever measurements have arrived and update the auto decision
+    void collectResults() {
+        for (unsigned int i = 0; i < QUERY_FRAMES; i++) {
+            if (!pending[i]) continue;
+
+            unsigned int available = 0;
+            glGetQueryObjectuiv(queries[i * 2 + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) continue;
+
+            unsigned int depthSamples = 0, shadedSamples = 0;
+            glGetQueryObjectuiv(queries[i * 2], GL_QUERY_RESULT, &depthSamples);
+            glGetQueryObjectuiv(queries[i * 2 + 1], GL_QUERY_RESULT, &shadedSamples);
+            pending[i] = false;
+
+            overdraw = shadedSamples > 0 ? (float)depthSamples / (float)shadedSamples : 1.0f;
+            enabled = overdraw > (enabled ? DISABLE_OVERDRAW : ENABLE_OVERDRAW);
+        }
+    }
+};
+
+#endif
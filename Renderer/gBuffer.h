@@ -0,0 +1,141 @@
+#ifndef G_BUFFER_H
+#define G_BUFFER_H
+
+#include <glad/glad.h>
+
+#include <glState.h>
+#include <shader_s.h>
+#include <logger.h>
+#include <gpuMemory.h>
+
+// Render targets for deferred shading. The geometry pass writes surface attributes here;
+// the lighting pass reads them back once per screen pixel.
+//   albedo   RGBA8         rgb = diffuse colour
+//   specular RGBA8         rgb = specular colour, a = shininess / 255
+//   normal   RG16_SNORM    octahedral world-space normal
+//   depth    DEPTH32F      position is rebuilt from depth and the inverse matrices
+class GBuffer {
+public:
+    // Texture units the lighting shader samples from
+    static const unsigned int ALBEDO_UNIT = 0;
+    static const unsigned int SPECULAR_UNIT = 1;
+    static const unsigned int NORMAL_UNIT = 2;
+    static const unsigned int DEPTH_UNIT = 3;
+
+    int width = 0;
+    int height = 0;
+
+    GBuffer() {
+        glGenFramebuffers(1, &FBO);
+        glGenVertexArrays(1, &emptyVAO);
+    }
+
+    ~GBuffer() {
+        deleteTextures();
+        glState.forgetFramebuffer(FBO);
+        glState.forgetVertexArray(emptyVAO);
+        glDeleteFramebuffers(1, &FBO);
+        glDeleteVertexArrays(1, &emptyVAO);
+    }
+
+    GBuffer(const GBuffer&) = delete;
+    GBuffer& operator=(const GBuffer&) = delete;
+
+    // (Re)allocate the targets when the framebuffer size changes
+    void resize(int newWidth, int newHeight) {
+        if (newWidth == width && newHeight == height) return;
+        width = newWidth;
+        height = newHeight;
+
+        deleteTextures();
+        albedo = createTarget(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+        specular = createTarget(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+        normal = createTarget(GL_RG16_SNORM, GL_RG, GL_SHORT);
+        depth = createTarget(GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT);
+        targetBytes = (long long)width * height * BYTES_PER_PIXEL;
+        GpuMemory::textureBytes += targetBytes;
+
+        glState.bindFramebuffer(FBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedo, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, specular, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, normal, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+
+        unsigned int attachments[3] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2};
+        glDrawBuffers(3, attachments);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            logger.log(LOG_ERROR, "ERROR::GBUFFER::FRAMEBUFFER_NOT_COMPLETE");
+        }
+        glState.bindFramebuffer(0);
+    }
+
+    // Bind and clear the targets for the geometry pass
+    void beginGeometryPass() {
+        glState.bindFramebuffer(FBO);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+
+    // Back to the default framebuffer, with the targets bound for the lighting shader
+    void beginLightingPass(Shader& shader) {
+        glState.bindFramebuffer(0);
+        shader.use();
+        bindTarget(shader, "gAlbedo", ALBEDO_UNIT, albedo);
+        bindTarget(shader, "gSpecular", SPECULAR_UNIT, specular);
+        bindTarget(shader, "gNormal", NORMAL_UNIT, normal);
+        bindTarget(shader, "gDepth", DEPTH_UNIT, depth);
+    }
+
+    // One triangle covering the screen; the vertex shader builds it from gl_VertexID
+    void drawFullscreen() {
+        glState.disable(GL_DEPTH_TEST);
+        glState.depthMask(false);
+        glState.bindVertexArray(emptyVAO);
+        glState.drawArrays(GL_TRIANGLES, 0, 3);
+        glState.depthMask(true);
+        glState.enable(GL_DEPTH_TEST);
+    }
+
+private:
+    unsigned int FBO = 0;
+    unsigned int emptyVAO = 0;
+    unsigned int albedo = 0;
+    unsigned int specular = 0;
+    unsigned int normal = 0;
+    unsigned int depth = 0;
+    long long targetBytes = 0;
+
+    // albedo + specular + normal + depth
+    static const unsigned int BYTES_PER_PIXEL = 4 + 4 + 4 + 4;
+
+    unsigned int createTarget(GLenum internalFormat, GLenum format, GLenum type) {
+        unsigned int id;
+        glGenTextures(1, &id);
+        glState.bindTexture(0, GL_TEXTURE_2D, id);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        return id;
+    }
+
+    void deleteTextures() {
+        unsigned int targets[4] = {albedo, specular, normal, depth};
+        for (unsigned int id : targets) {
+            if (id == 0) continue;
+            glState.forgetTexture(id);
+            glDeleteTextures(1, &id);
+        }
+        albedo = specular = normal = depth = 0;
+        GpuMemory::textureBytes -= targetBytes;
+        targetBytes = 0;
+    }
+
+    void bindTarget(Shader& shader, const char* name, unsigned int unit, unsigned int id) {
+        glState.setUniform1i(shader.ID, glGetUniformLocation(shader.ID, name), unit);
+        glState.bindTexture(unit, GL_TEXTURE_2D, id);
+    }
+};
+
+#endif
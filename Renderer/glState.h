@@ -0,0 +1,424 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+#include <logger.h>
+
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+
+// Shadow copy of the GL state the engine touches. Every bind/enable goes through here
+// so calls that would not change anything never reach the driver.
+class GLState{
+public:
+    static const unsigned int MAX_TEXTURE_UNITS = 32;
+    static const unsigned int UNKNOWN = 0xFFFFFFFFu;
+
+    // Counters (reset each frame by the caller)
+    unsigned int issuedCalls = 0;
+    unsigned int skippedCalls = 0;
+    unsigned int drawCalls = 0;
+    unsigned long long triangles = 0;
+
+    GLState(){
+        invalidate();
+    }
+
+    // Forget everything we know; the next call of each kind always reaches the driver
+    void invalidate(){
+        program = UNKNOWN;
+        vertexArray = UNKNOWN;
+        framebuffer = UNKNOWN;
+        activeUnit = UNKNOWN;
+        for(unsigned int i = 0; i < MAX_TEXTURE_UNITS; i++){
+            for(unsigned int t = 0; t < NUM_TEXTURE_TARGETS; t++){
+                textures[i][t] = UNKNOWN;
+            }
+            samplers[i] = UNKNOWN;
+        }
+        for(unsigned int t = 0; t < NUM_BUFFER_TARGETS; t++){
+            buffers[t] = UNKNOWN;
+            for(unsigned int i = 0; i < MAX_BUFFER_INDICES; i++){
+                indexedBuffers[t][i] = UNKNOWN;
+            }
+        }
+        for(unsigned int c = 0; c < NUM_CAPS; c++){
+            caps[c] = UNKNOWN;
+        }
+        depthFuncMode = UNKNOWN;
+        depthWrite = UNKNOWN;
+        colorWrite = UNKNOWN;
+        cullFaceMode = UNKNOWN;
+        blendSrc = UNKNOWN;
+        blendDst = UNKNOWN;
+        offsetFactor = offsetUnits = NAN;
+        viewportRect[0] = viewportRect[1] = viewportRect[2] = viewportRect[3] = -1;
+        intUniforms.clear();
+    }
+
+    void resetCounters(){
+        issuedCalls = 0;
+        skippedCalls = 0;
+        drawCalls = 0;
+        triangles = 0;
+    }
+
+    // Programs and Vertex Arrays
+    void useProgram(unsigned int id){
+        if(!changed(program, id)) return;
+        glUseProgram(id);
+    }
+
+    void bindVertexArray(unsigned int id){
+        if(!changed(vertexArray, id)) return;
+        glBindVertexArray(id);
+
+        // The element buffer binding belongs to the VAO
+        buffers[bufferSlot(GL_ELEMENT_ARRAY_BUFFER)] = UNKNOWN;
+    }
+
+    // Framebuffers (draw and read are always bound together). 0 is the screen, which is
+    // screenFramebuffer when rendering offscreen.
+    void bindFramebuffer(unsigned int id){
+        if(id == 0) id = screenFramebuffer;
+        if(!changed(framebuffer, id)) return;
+        glBindFramebuffer(GL_FRAMEBUFFER, id);
+    }
+
+    // Textures and Samplers
+    void activeTexture(unsigned int unit){
+        if(!changed(activeUnit, unit)) return;
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    void bindTexture(unsigned int unit, GLenum target, unsigned int id){
+        int slot = textureSlot(target);
+        if(slot < 0 || unit >= MAX_TEXTURE_UNITS){
+            activeTexture(unit);
+            glBindTexture(target, id);
+            issuedCalls++;
+            return;
+        }
+        if(!changed(textures[unit][slot], id)) return;
+        activeTexture(unit);
+        glBindTexture(target, id);
+    }
+
+    void bindSampler(unsigned int unit, unsigned int id){
+        if(unit >= MAX_TEXTURE_UNITS){
+            glBindSampler(unit, id);
+            issuedCalls++;
+            return;
+        }
+        if(!changed(samplers[unit], id)) return;
+        glBindSampler(unit, id);
+    }
+
+    // Integer uniforms (sampler units) are program state, so they are cached per program
+    void setUniform1i(unsigned int programId, int location, int value){
+        if(location < 0) return;
+        uint64_t key = (uint64_t(programId) << 32) | uint32_t(location);
+        auto it = intUniforms.find(key);
+        if(it != intUniforms.end() && it->second == value){
+            skippedCalls++;
+            return;
+        }
+        intUniforms[key] = value;
+        useProgram(programId);
+        glUniform1i(location, value);
+        issuedCalls++;
+    }
+
+    // Buffers
+    void bindBuffer(GLenum target, unsigned int id){
+        int slot = bufferSlot(target);
+        if(slot < 0){
+            glBindBuffer(target, id);
+            issuedCalls++;
+            return;
+        }
+        if(!changed(buffers[slot], id)) return;
+        glBindBuffer(target, id);
+    }
+
+    // Indexed uniform/storage buffer binding points (also changes the generic binding)
+    void bindBufferBase(GLenum target, unsigned int index, unsigned int id){
+        int slot = bufferSlot(target);
+        if(slot >= 0 && index < MAX_BUFFER_INDICES){
+            if(!changed(indexedBuffers[slot][index], id)){
+                return;
+            }
+            buffers[slot] = id;
+        }
+        else{
+            issuedCalls++;
+        }
+        glBindBufferBase(target, index, id);
+    }
+
+    // Fixed Function State
+    void enable(GLenum cap){
+        setEnabled(cap, true);
+    }
+
+    void disable(GLenum cap){
+        setEnabled(cap, false);
+    }
+
+    void setEnabled(GLenum cap, bool on){
+        int slot = capSlot(cap);
+        if(slot >= 0 && !changed(caps[slot], on ? 1u : 0u)) return;
+        if(on) glEnable(cap); else glDisable(cap);
+        if(slot < 0) issuedCalls++;
+    }
+
+    void depthFunc(GLenum func){
+        if(!changed(depthFuncMode, func)) return;
+        glDepthFunc(func);
+    }
+
+    void depthMask(bool write){
+        if(!changed(depthWrite, write ? 1u : 0u)) return;
+        glDepthMask(write ? GL_TRUE : GL_FALSE);
+    }
+
+    void colorMask(bool write){
+        if(!changed(colorWrite, write ? 1u : 0u)) return;
+        GLboolean value = write ? GL_TRUE : GL_FALSE;
+        glColorMask(value, value, value, value);
+    }
+
+    void cullFace(GLenum face){
+        if(!changed(cullFaceMode, face)) return;
+        glCullFace(face);
+    }
+
+    void blendFunc(GLenum src, GLenum dst){
+        if(blendSrc == src && blendDst == dst){
+            skippedCalls++;
+            return;
+        }
+        blendSrc = src;
+        blendDst = dst;
+        glBlendFunc(src, dst);
+        issuedCalls++;
+    }
+
+    void polygonOffset(float factor, float units){
+        if(offsetFactor == factor && offsetUnits == units){
+            skippedCalls++;
+            return;
+        }
+        offsetFactor = factor;
+        offsetUnits = units;
+        glPolygonOffset(factor, units);
+        issuedCalls++;
+    }
+
+    void viewport(int x, int y, int width, int height){
+        if(viewportRect[0] == x && viewportRect[1] == y && viewportRect[2] == width && viewportRect[3] == height){
+            skippedCalls++;
+            return;
+        }
+        viewportRect[0] = x;
+        viewportRect[1] = y;
+        viewportRect[2] = width;
+        viewportRect[3] = height;
+        glViewport(x, y, width, height);
+        issuedCalls++;
+    }
+
+    // Draws
+    void drawElements(GLenum mode, GLsizei count, GLenum type, const void* indices){
+        glDrawElements(mode, count, type, indices);
+        drawCalls++;
+        if(mode == GL_TRIANGLES) triangles += count / 3;
+#ifdef GL_STATE_DEBUG
+        validate();
+#endif
+    }
+
+    void drawArrays(GLenum mode, GLint first, GLsizei count){
+        glDrawArrays(mode, first, count);
+        drawCalls++;
+        if(mode == GL_TRIANGLES) triangles += count / 3;
+#ifdef GL_STATE_DEBUG
+        validate();
+#endif
+    }
+
+    // Deleted objects may have their names reused, so drop them from the cache
+    void forgetTexture(unsigned int id){
+        for(unsigned int i = 0; i < MAX_TEXTURE_UNITS; i++){
+            for(unsigned int t = 0; t < NUM_TEXTURE_TARGETS; t++){
+                if(textures[i][t] == id) textures[i][t] = UNKNOWN;
+            }
+        }
+    }
+
+    void forgetBuffer(unsigned int id){
+        for(unsigned int t = 0; t < NUM_BUFFER_TARGETS; t++){
+            if(buffers[t] == id) buffers[t] = UNKNOWN;
+            for(unsigned int i = 0; i < MAX_BUFFER_INDICES; i++){
+                if(indexedBuffers[t][i] == id) indexedBuffers[t][i] = UNKNOWN;
+            }
+        }
+    }
+
+    void forgetProgram(unsigned int id){
+        if(program == id) program = UNKNOWN;
+        for(auto it = intUniforms.begin(); it != intUniforms.end();){
+            if((it->first >> 32) == id) it = intUniforms.erase(it);
+            else ++it;
+        }
+    }
+
+    void forgetVertexArray(unsigned int id){
+        if(vertexArray == id) vertexArray = UNKNOWN;
+    }
+
+    // Render what would go to the window into this framebuffer instead (0 for the window)
+    void setScreenFramebuffer(unsigned int id){
+        screenFramebuffer = id;
+        framebuffer = UNKNOWN;
+    }
+
+    void forgetFramebuffer(unsigned int id){
+        if(framebuffer == id) framebuffer = UNKNOWN;
+    }
+
+    // Compare the shadow state with what the driver reports; returns false on any mismatch
+    bool validate(){
+        bool ok = true;
+        int value = 0;
+
+        glGetIntegerv(GL_CURRENT_PROGRAM, &value);
+        ok &= check("program", program, value);
+        glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &value);
+        ok &= check("vertex array", vertexArray, value);
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &value);
+        ok &= check("framebuffer", framebuffer, value);
+
+        int currentUnit = 0;
+        glGetIntegerv(GL_ACTIVE_TEXTURE, &currentUnit);
+        ok &= check("active texture", activeUnit, currentUnit - GL_TEXTURE0);
+        for(unsigned int i = 0; i < MAX_TEXTURE_UNITS; i++){
+            glActiveTexture(GL_TEXTURE0 + i);
+            for(unsigned int t = 0; t < NUM_TEXTURE_TARGETS; t++){
+                glGetIntegerv(TEXTURE_BINDINGS[t], &value);
+                ok &= check("texture", textures[i][t], value, i);
+            }
+            glGetIntegerv(GL_SAMPLER_BINDING, &value);
+            ok &= check("sampler", samplers[i], value, i);
+        }
+        glActiveTexture(currentUnit);
+
+        for(unsigned int t = 0; t < NUM_BUFFER_TARGETS; t++){
+            glGetIntegerv(BUFFER_BINDINGS[t], &value);
+            ok &= check("buffer", buffers[t], value, t);
+            if(BUFFER_TARGETS[t] == GL_UNIFORM_BUFFER || BUFFER_TARGETS[t] == GL_SHADER_STORAGE_BUFFER){
+                for(unsigned int i = 0; i < MAX_BUFFER_INDICES; i++){
+                    glGetIntegeri_v(BUFFER_BINDINGS[t], i, &value);
+                    ok &= check("indexed buffer", indexedBuffers[t][i], value, i);
+                }
+            }
+        }
+
+        for(unsigned int c = 0; c < NUM_CAPS; c++){
+            ok &= check("capability", caps[c], glIsEnabled(CAPS[c]) ? 1 : 0, c);
+        }
+
+        glGetIntegerv(GL_DEPTH_FUNC, &value);
+        ok &= check("depth func", depthFuncMode, value);
+        glGetIntegerv(GL_DEPTH_WRITEMASK, &value);
+        ok &= check("depth mask", depthWrite, value);
+        GLboolean colorMaskValues[4];
+        glGetBooleanv(GL_COLOR_WRITEMASK, colorMaskValues);
+        ok &= check("color mask", colorWrite, colorMaskValues[0] ? 1 : 0);
+        glGetIntegerv(GL_CULL_FACE_MODE, &value);
+        ok &= check("cull face", cullFaceMode, value);
+        glGetIntegerv(GL_BLEND_SRC_RGB, &value);
+        ok &= check("blend src", blendSrc, value);
+        glGetIntegerv(GL_BLEND_DST_RGB, &value);
+        ok &= check("blend dst", blendDst, value);
+
+        return ok;
+    }
+
+private:
+    static const unsigned int NUM_TEXTURE_TARGETS = 3;
+    static const unsigned int NUM_BUFFER_TARGETS = 5;
+    static const unsigned int NUM_CAPS = 5;
+    static const unsigned int MAX_BUFFER_INDICES = 8;    // Minimum the spec guarantees for SSBOs
+
+    static constexpr GLenum TEXTURE_TARGETS[NUM_TEXTURE_TARGETS] = {GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_CUBE_MAP};
+    static constexpr GLenum TEXTURE_BINDINGS[NUM_TEXTURE_TARGETS] = {GL_TEXTURE_BINDING_2D, GL_TEXTURE_BINDING_2D_ARRAY, GL_TEXTURE_BINDING_CUBE_MAP};
+    static constexpr GLenum BUFFER_TARGETS[NUM_BUFFER_TARGETS] = {GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER, GL_UNIFORM_BUFFER, GL_SHADER_STORAGE_BUFFER, GL_DRAW_INDIRECT_BUFFER};
+    static constexpr GLenum BUFFER_BINDINGS[NUM_BUFFER_TARGETS] = {GL_ARRAY_BUFFER_BINDING, GL_ELEMENT_ARRAY_BUFFER_BINDING, GL_UNIFORM_BUFFER_BINDING, GL_SHADER_STORAGE_BUFFER_BINDING, GL_DRAW_INDIRECT_BUFFER_BINDING};
+    static constexpr GLenum CAPS[NUM_CAPS] = {GL_DEPTH_TEST, GL_CULL_FACE, GL_BLEND, GL_SCISSOR_TEST, GL_POLYGON_OFFSET_FILL};
+
+    unsigned int program = UNKNOWN;
+    unsigned int vertexArray = UNKNOWN;
+    unsigned int framebuffer = UNKNOWN;
+    unsigned int screenFramebuffer = 0;
+    unsigned int activeUnit = UNKNOWN;
+    unsigned int textures[MAX_TEXTURE_UNITS][NUM_TEXTURE_TARGETS];
+    unsigned int samplers[MAX_TEXTURE_UNITS];
+    unsigned int buffers[NUM_BUFFER_TARGETS];
+    unsigned int indexedBuffers[NUM_BUFFER_TARGETS][MAX_BUFFER_INDICES];
+    unsigned int caps[NUM_CAPS];
+    unsigned int depthFuncMode = UNKNOWN;
+    unsigned int depthWrite = UNKNOWN;
+    unsigned int colorWrite = UNKNOWN;
+    unsigned int cullFaceMode = UNKNOWN;
+    unsigned int blendSrc = UNKNOWN;
+    unsigned int blendDst = UNKNOWN;
+    float offsetFactor = NAN;
+    float offsetUnits = NAN;
+    int viewportRect[4] = {-1, -1, -1, -1};
+    std::unordered_map<uint64_t, int> intUniforms;
+
+    // Returns true (and records the new value) if the driver call is needed
+    bool changed(unsigned int &cached, unsigned int value){
+        if(cached == value){
+            skippedCalls++;
+            return false;
+        }
+        cached = value;
+        issuedCalls++;
+        return true;
+    }
+
+    static int textureSlot(GLenum target){
+        for(unsigned int t = 0; t < NUM_TEXTURE_TARGETS; t++){
+            if(TEXTURE_TARGETS[t] == target) return (int)t;
+        }
+        return -1;
+    }
+
+    static int bufferSlot(GLenum target){
+        for(unsigned int t = 0; t < NUM_BUFFER_TARGETS; t++){
+            if(BUFFER_TARGETS[t] == target) return (int)t;
+        }
+        return -1;
+    }
+
+    static int capSlot(GLenum cap){
+        for(unsigned int c = 0; c < NUM_CAPS; c++){
+            if(CAPS[c] == cap) return (int)c;
+        }
+        return -1;
+    }
+
+    static bool check(const char* what, unsigned int cached, int actual, unsigned int index = 0){
+        // Nothing to compare until the first call has gone through
+        if(cached == UNKNOWN || cached == (unsigned int)actual) return true;
+        LOG_RATE_LIMITED(1.0, LOG_ERROR, "ERROR::GLSTATE::MISMATCH %s [%u] cached %u driver %d", what, index, cached, actual);
+        return false;
+    }
+};
+
+inline GLState glState;
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef HEADLESS_CONTEXT_H
+#define HEADLESS_CONTEXT_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <glState.h>
+#include <logger.h>
+
+#include <vector>
+
+#ifdef HEADLESS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+// Offscreen GL for benchmark runs on machines without a display or GPU.
+//
+// GLFW runs on its null platform (no window system, but the timer and input polling still
+// work). The context comes from OSMesa through GLFW, or failing that from a surfaceless EGL
+// context (Mesa's llvmpipe). Either falls back to 4.5 core when the requested version isn't
+// offered, as llvmpipe stops at 4.5; the shader loader lowers #version to match. Frames are
+// rendered into an FBO that glState binds whenever the renderer asks for the screen.
+class HeadlessContext {
+public:
+    HeadlessContext(int glMajor, int glMinor) : major(glMajor), minor(glMinor) {}
+
+    ~HeadlessContext() {
+        if (FBO) {
+            glState.setScreenFramebuffer(0);
+            glDeleteFramebuffers(1, &FBO);
+            glDeleteRenderbuffers(1, &colorRBO);
+            glDeleteRenderbuffers(1, &depthRBO);
+        }
+#ifdef HEADLESS_EGL
+        if (eglContext != EGL_NO_CONTEXT) {
+            eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            eglDestroyContext(eglDisplay, eglContext);
+            eglTerminate(eglDisplay);
+        }
+#endif
+    }
+
+    HeadlessContext(const HeadlessContext&) = delete;
+    HeadlessContext& operator=(const HeadlessContext&) = delete;
+
+    // Call before glfwInit()
+    static void selectPlatform() {
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+    }
+
+    // Invisible window (for GLFW's timer and input) with a current context; NULL on failure
+    GLFWwindow* createWindow(int width, int height, const char* title) {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+        for (int attemptMinor : contextMinors()) {
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, major);
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, attemptMinor);
+            GLFWwindow* window = glfwCreateWindow(width, height, title, NULL, NULL);
+            if (window) {
+                glfwMakeContextCurrent(window);
+                logVersion(attemptMinor);
+                return window;
+            }
+        }
+
+#ifdef HEADLESS_EGL
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+        GLFWwindow* window = glfwCreateWindow(width, height, title, NULL, NULL);
+        if (window && createEGLContext()) {
+            return window;
+        }
+        if (window) glfwDestroyWindow(window);
+#endif
+
+        logger.log(LOG_ERROR, "ERROR::HEADLESS::CONTEXT_CREATION_FAILED");
+        return NULL;
+    }
+
+    // For gladLoadGLLoader
+    GLADloadproc loader() const {
+#ifdef HEADLESS_EGL
+        if (eglContext != EGL_NO_CONTEXT) return (GLADloadproc)eglGetProcAddress;
+#endif
+        return (GLADloadproc)glfwGetProcAddress;
+    }
+
+    // The offscreen target; call once GL is loaded
+    bool createFramebuffer(int width, int height) {
+        glGenRenderbuffers(1, &colorRBO);
+        glBindRenderbuffer(GL_RENDERBUFFER, colorRBO);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+        glGenRenderbuffers(1, &depthRBO);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthRBO);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+
+        glGenFramebuffers(1, &FBO);
+        glState.setScreenFramebuffer(FBO);
+        glState.bindFramebuffer(0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorRBO);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthRBO);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            logger.log(LOG_ERROR, "ERROR::HEADLESS::FRAMEBUFFER_NOT_COMPLETE");
+            return false;
+        }
+        glState.viewport(0, 0, width, height);
+        return true;
+    }
+
+    // There is no swap to pace the frame, so wait for the GL work to finish; frame times then
+    // include the rendering
+    void endFrame() {
+        glFinish();
+    }
+
+private:
+    static const int FALLBACK_MINOR = 5;    // 4.5 core: the most llvmpipe offers
+
+    int major;
+    int minor;
+    unsigned int FBO = 0;
+    unsigned int colorRBO = 0;
+    unsigned int depthRBO = 0;
+
+    // The requested minor version, then the fallback
+    std::vector<int> contextMinors() const {
+        if (major == 4 && minor > FALLBACK_MINOR) return {minor, FALLBACK_MINOR};
+        return {minor};
+    }
+
+    void logVersion(int contextMinor) const {
+        if (contextMinor != minor) {
+            logger.log(LOG_INFO, "Headless: no %d.%d context, using %d.%d", major, minor, major, contextMinor);
+        }
+    }
+
+#ifdef HEADLESS_EGL
+    EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+    EGLContext eglContext = EGL_NO_CONTEXT;
+
+    bool createEGLContext() {
+        auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (!getPlatformDisplay) return false;
+
+        eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, NULL, NULL)) return false;
+        eglBindAPI(EGL_OPENGL_API);
+
+        for (int attemptMinor : contextMinors()) {
+            EGLint attributes[] = {
+                EGL_CONTEXT_MAJOR_VERSION, major,
+                EGL_CONTEXT_MINOR_VERSION, attemptMinor,
+                EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                EGL_NONE
+            };
+            eglContext = eglCreateContext(eglDisplay, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attributes);
+            if (eglContext != EGL_NO_CONTEXT) {
+                logVersion(attemptMinor);
+                return eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, eglContext);
+            }
+        }
+        eglTerminate(eglDisplay);
+        return false;
+    }
+#endif
+};
+
+#endif
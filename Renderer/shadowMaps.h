@@ -0,0 +1,245 @@
+#ifndef SHADOW_MAPS_H
+#define SHADOW_MAPS_H
+
+#include <glad/glad.h>
+#include <glm.hpp>
+#include <gtc/matrix_transform.hpp>
+
+#include <glState.h>
+#include <shader_s.h>
+#include <frustum.h>
+#include <frameArena.h>
+#include <gpuProfiler.h>
+#include <gpuMemory.h>
+
+#include <cmath>
+#include <string>
+
+// Shadow maps for the directional light (three cascades) and the two spotlights, all layers
+// of one depth array. Every layer keeps a cached copy holding only the static casters; an
+// update copies that cache into the sampled layer and draws just the dynamic casters on top.
+// The cache is redrawn only when the layer's light matrix changes, and the outer cascades
+// are refreshed every second / fourth frame.
+class ShadowMaps {
+public:
+    static const unsigned int SIZE = 1024;
+    static const unsigned int CASCADE_COUNT = 3;
+    static const unsigned int SPOT_RIDE_LAYER = 3;
+    static const unsigned int SPOT_TORCH_LAYER = 4;
+    static const unsigned int LAYER_COUNT = 5;
+    static const unsigned int SHADOW_UNIT = 8;      // Clear of the material and G-buffer units
+
+    bool enabled = true;
+    float shadowDistance = 60.0f;       // Cascades stop here
+    float splitLambda = 0.75f;          // Blend of logarithmic and uniform cascade splits
+
+    // Stats for the last update
+    unsigned int staticRenders = 0;
+    unsigned int dynamicRenders = 0;
+
+    ShadowMaps() : depthShader("Shaders/depth.shader.vs", "Shaders/depth.shader.fs") {
+        staticDepth = createArray(false);
+        shadowDepth = createArray(true);
+
+        glGenFramebuffers(1, &FBO);
+        glState.bindFramebuffer(FBO);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glState.bindFramebuffer(0);
+    }
+
+    ~ShadowMaps() {
+        glState.forgetTexture(staticDepth);
+        glState.forgetTexture(shadowDepth);
+        glState.forgetFramebuffer(FBO);
+        glState.forgetProgram(depthShader.ID);
+        glDeleteTextures(1, &staticDepth);
+        glDeleteTextures(1, &shadowDepth);
+        GpuMemory::textureBytes -= 2 * ARRAY_BYTES;
+        glDeleteFramebuffers(1, &FBO);
+        glDeleteProgram(depthShader.ID);
+    }
+
+    ShadowMaps(const ShadowMaps&) = delete;
+    ShadowMaps& operator=(const ShadowMaps&) = delete;
+
+    // Fit the cascades to the camera's view for this frame
+    void setCascades(const glm::mat4& view, float fovDegrees, float aspect, float nearPlane, const glm::vec3& lightDirection) {
+        glm::mat4 inverseView = glm::inverse(view);
+        float tanY = std::tan(glm::radians(fovDegrees) * 0.5f);
+        float tanX = tanY * aspect;
+
+        glm::vec3 forward = glm::normalize(lightDirection);
+        glm::vec3 up = std::abs(forward.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), forward, up);
+
+        float sliceNear = nearPlane;
+        for (unsigned int i = 0; i < CASCADE_COUNT; i++) {
+            float fraction = (float)(i + 1) / CASCADE_COUNT;
+            float logSplit = nearPlane * std::pow(shadowDistance / nearPlane, fraction);
+            float uniformSplit = nearPlane + (shadowDistance - nearPlane) * fraction;
+            float sliceFar = splitLambda * logSplit + (1.0f - splitLambda) * uniformSplit;
+            cascadeSplits[i] = sliceFar;
+
+            // Bounding sphere of the slice keeps the size fixed as the camera turns
+            glm::vec3 corners[8];
+            glm::vec3 center(0.0f);
+            for (int c = 0; c < 8; c++) {
+                float depth = c & 4 ? sliceFar : sliceNear;
+                glm::vec4 corner(c & 1 ? depth * tanX : -depth * tanX, c & 2 ? depth * tanY : -depth * tanY, -depth, 1.0f);
+                corners[c] = glm::vec3(inverseView * corner);
+                center += corners[c] / 8.0f;
+            }
+            float radius = 0.0f;
+            for (const glm::vec3& corner : corners) {
+                radius = std::max(radius, glm::length(corner - center));
+            }
+            radius = std::ceil(radius * 16.0f) / 16.0f;
+
+            // Snap the centre to a coarse grid (a whole number of texels) so the static cache
+            // survives small camera moves; the margin keeps the slice inside the box
+            float halfExtent = radius * 1.125f;
+            float texel = 2.0f * halfExtent / SIZE;
+            float step = texel * std::max(1.0f, std::floor(radius * 0.125f / texel));
+            glm::vec3 lightCenter = glm::vec3(lightView * glm::vec4(center, 1.0f));
+            lightCenter = glm::floor(lightCenter / step) * step;
+
+            // Casters up to CASTER_DISTANCE towards the light still land in the map
+            glm::mat4 projection = glm::ortho(lightCenter.x - halfExtent, lightCenter.x + halfExtent,
+                                              lightCenter.y - halfExtent, lightCenter.y + halfExtent,
+                                              -lightCenter.z - halfExtent - CASTER_DISTANCE, -lightCenter.z + halfExtent);
+            layers[i].target = projection * lightView;
+            layers[i].normalOffset = texel * 1.5f;
+            layers[i].active = true;
+
+            sliceNear = sliceFar;
+        }
+    }
+
+    // Perspective map for a spotlight; inactive layers are not drawn
+    void setSpot(unsigned int layer, const glm::vec3& position, const glm::vec3& direction, float outerCutOffDegrees, bool active) {
+        glm::vec3 forward = glm::normalize(direction);
+        glm::vec3 up = std::abs(forward.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        glm::mat4 lightView = glm::lookAt(position, position + forward, up);
+        float fov = std::min(2.0f * outerCutOffDegrees + 5.0f, 170.0f);
+
+        layers[layer].target = glm::perspective(glm::radians(fov), 1.0f, SPOT_NEAR, SPOT_FAR) * lightView;
+        layers[layer].normalOffset = 0.02f;
+        layers[layer].active = active;
+    }
+
+    // Bring every due layer up to date. drawCasters(frustum, shader, dynamic) draws the static
+    // or the dynamic casters inside the light frustum with DrawDepth.
+    template<typename DrawCasters>
+    void update(DrawCasters drawCasters, int screenWidth, int screenHeight) {
+        PROFILE_PASS("Shadow Maps");
+        staticRenders = 0;
+        dynamicRenders = 0;
+        frame++;
+        if (!enabled) return;
+
+        glState.bindFramebuffer(FBO);
+        glState.viewport(0, 0, SIZE, SIZE);
+        glState.disable(GL_CULL_FACE);
+        glState.enable(GL_POLYGON_OFFSET_FILL);
+        glState.polygonOffset(2.0f, 4.0f);
+        glState.depthMask(true);
+        glState.depthFunc(GL_LESS);
+
+        depthShader.use();
+        depthShader.setMat4("view", glm::mat4(1.0f));
+
+        for (unsigned int i = 0; i < LAYER_COUNT; i++) {
+            Layer& layer = layers[i];
+            if (!layer.active) continue;
+
+            bool moved = layer.target != layer.cached;
+            if (!moved && (frame + UPDATE_PHASE[i]) % UPDATE_INTERVAL[i] != 0) continue;
+
+            Frustum lightFrustum(layer.target);
+            depthShader.setMat4("projection", layer.target);
+
+            // Static casters into the cache
+            if (moved) {
+                glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, staticDepth, 0, i);
+                glClear(GL_DEPTH_BUFFER_BIT);
+                drawCasters(lightFrustum, depthShader, false);
+                layer.cached = layer.target;
+                staticRenders++;
+            }
+
+            // Cache, then the dynamic casters on top
+            glCopyImageSubData(staticDepth, GL_TEXTURE_2D_ARRAY, 0, 0, 0, i,
+                               shadowDepth, GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, SIZE, SIZE, 1);
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadowDepth, 0, i);
+            drawCasters(lightFrustum, depthShader, true);
+            layer.matrix = layer.target;
+            dynamicRenders++;
+        }
+
+        glState.disable(GL_POLYGON_OFFSET_FILL);
+        glState.enable(GL_CULL_FACE);
+        glState.bindFramebuffer(0);
+        glState.viewport(0, 0, screenWidth, screenHeight);
+    }
+
+    // Bind the maps and matrices for a lighting shader (SHADOWS variants). Always call this
+    // for shaders that declare shadowMap, so the array sampler never shares unit 0 with a 2D sampler.
+    void bind(Shader& shader) const {
+        glState.setUniform1i(shader.ID, glGetUniformLocation(shader.ID, "shadowMap"), SHADOW_UNIT);
+        glState.bindTexture(SHADOW_UNIT, GL_TEXTURE_2D_ARRAY, shadowDepth);
+
+        for (unsigned int i = 0; i < LAYER_COUNT; i++) {
+            shader.setMat4(frameArena.format("shadowMatrices[%u]", i), layers[i].matrix);
+            shader.setFloat(frameArena.format("shadowNormalOffsets[%u]", i), layers[i].normalOffset);
+        }
+        shader.setVec3("cascadeSplits", cascadeSplits[0], cascadeSplits[1], cascadeSplits[2]);
+    }
+
+private:
+    static constexpr float CASTER_DISTANCE = 100.0f;
+    static constexpr float SPOT_NEAR = 0.5f;
+    static constexpr float SPOT_FAR = 100.0f;
+
+    // Frames between refreshes of each layer (cascades 1 and 2 never share a frame)
+    static constexpr unsigned int UPDATE_INTERVAL[LAYER_COUNT] = {1, 2, 4, 2, 1};
+    static constexpr unsigned int UPDATE_PHASE[LAYER_COUNT] = {0, 1, 2, 0, 0};
+
+    struct Layer {
+        glm::mat4 target = glm::mat4(1.0f);     // Wanted this frame
+        glm::mat4 cached = glm::mat4(0.0f);     // The static cache was drawn with this
+        glm::mat4 matrix = glm::mat4(0.0f);     // The sampled layer was drawn with this
+        float normalOffset = 0.0f;
+        bool active = false;
+    };
+
+    Layer layers[LAYER_COUNT];
+    float cascadeSplits[CASCADE_COUNT] = {};
+    unsigned int frame = 0;
+
+    Shader depthShader;
+    unsigned int staticDepth = 0;
+    unsigned int shadowDepth = 0;
+    unsigned int FBO = 0;
+
+    static const long long ARRAY_BYTES = (long long)SIZE * SIZE * LAYER_COUNT * sizeof(float);
+
+    unsigned int createArray(bool compare) {
+        unsigned int id;
+        glGenTextures(1, &id);
+        glState.bindTexture(0, GL_TEXTURE_2D_ARRAY, id);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32F, SIZE, SIZE, LAYER_COUNT);
+        GpuMemory::textureBytes += ARRAY_BYTES;
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, compare ? GL_LINEAR : GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, compare ? GL_LINEAR : GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        if (compare) {
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        }
+        return id;
+    }
+};
+
+#endif
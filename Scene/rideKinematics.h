@@ -0,0 +1,145 @@
+#ifndef RIDE_KINEMATICS_H
+#define RIDE_KINEMATICS_H
+
+#include <glm.hpp>
+
+#include "sceneGraph.h"
+#include "jobSystem.h"
+
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#define RIDE_KINEMATICS_SSE 1
+#endif
+
+// Carts of every ferris wheel, stored as flat arrays (one entry per cart) so the per-frame
+// update is a straight SIMD sweep.
+//
+// A wheel spins about its local x axis, so its world matrix already carries the ride angle: a
+// cart's spoke tip is a fixed point in the wheel's space, found once with sin/cos when the
+// cart is added. Each frame the tip is transformed by the wheel's matrix and the cart hangs
+// level below it, so only the translation of the cart's world matrix is rewritten; the
+// rotation part stays identity. Wheels that did not move in the scene graph are skipped.
+class RideKinematics {
+public:
+    static const unsigned int RIDES_PER_JOB = 256;
+
+    // Stats for the last update
+    unsigned int updatedCarts = 0;
+
+    // cartCount evenly spaced carts on wheelNode's rim, hanging hang below their spoke tips.
+    // Their world matrices go to the driven scene graph nodes starting at firstCartNode.
+    unsigned int addRide(unsigned int wheelNode, unsigned int firstCartNode, unsigned int cartCount,
+                         float radius, float firstAngleDegrees, float hang) {
+        Ride ride;
+        ride.wheelNode = wheelNode;
+        ride.firstCartNode = firstCartNode;
+        ride.firstCart = (unsigned int)spokeY.size();
+        ride.cartCount = cartCount;
+        ride.hang = hang;
+        ride.needsUpdate = true;
+
+        for (unsigned int i = 0; i < cartCount; i++) {
+            float angle = glm::radians(firstAngleDegrees + 360.0f * i / cartCount);
+            spokeY.push_back(-radius * std::sin(angle));
+            spokeZ.push_back(radius * std::cos(angle));
+        }
+
+        rides.push_back(ride);
+        return (unsigned int)rides.size() - 1;
+    }
+
+    unsigned int cartCount() const {
+        return (unsigned int)spokeY.size();
+    }
+
+    // Call after graph.update() so the wheels' matrices are current
+    void update(SceneGraph& graph) {
+        PROFILE_SCOPE("Ride Kinematics");
+        updatedCarts = updateRides(graph, 0, (unsigned int)rides.size());
+    }
+
+    // Same, split across the job system in groups of rides
+    void update(SceneGraph& graph, JobSystem& jobs) {
+        PROFILE_SCOPE("Ride Kinematics");
+        std::atomic<unsigned int> carts{0};
+        JobCounter counter;
+        jobs.parallelFor((unsigned int)rides.size(), RIDES_PER_JOB, [&](unsigned int begin, unsigned int end) {
+            carts += updateRides(graph, begin, end);
+        }, counter);
+        jobs.wait(counter);
+        updatedCarts = carts;
+    }
+
+private:
+    struct Ride {
+        unsigned int wheelNode;
+        unsigned int firstCartNode;
+        unsigned int firstCart;
+        unsigned int cartCount;
+        float hang;
+        bool needsUpdate;
+    };
+
+    std::vector<Ride> rides;
+
+    // Spoke tips in wheel space (x is always 0)
+    std::vector<float> spokeY;
+    std::vector<float> spokeZ;
+
+    unsigned int updateRides(SceneGraph& graph, unsigned int begin, unsigned int end) {
+        unsigned int carts = 0;
+        for (unsigned int r = begin; r < end; r++) {
+            Ride& ride = rides[r];
+            if (!ride.needsUpdate && !graph.hasMoved(ride.wheelNode)) continue;
+            ride.needsUpdate = false;
+
+            const glm::mat4& wheel = graph.world(ride.wheelNode);
+            glm::vec3 hub = glm::vec3(wheel[3]) - glm::vec3(0.0f, ride.hang, 0.0f);
+            placeCarts(glm::vec3(wheel[1]), glm::vec3(wheel[2]), hub,
+                       &spokeY[ride.firstCart], &spokeZ[ride.firstCart], ride.cartCount,
+                       graph.drivenWorlds(ride.firstCartNode));
+            carts += ride.cartCount;
+        }
+        return carts;
+    }
+
+    // out[i] translation = hub + axisY * y[i] + axisZ * z[i]
+    static void placeCarts(const glm::vec3& axisY, const glm::vec3& axisZ, const glm::vec3& hub,
+                           const float* y, const float* z, unsigned int count, glm::mat4* out) {
+        unsigned int i = 0;
+
+#ifdef RIDE_KINEMATICS_SSE
+        __m128 yx = _mm_set1_ps(axisY.x), yy = _mm_set1_ps(axisY.y), yz = _mm_set1_ps(axisY.z);
+        __m128 zx = _mm_set1_ps(axisZ.x), zy = _mm_set1_ps(axisZ.y), zz = _mm_set1_ps(axisZ.z);
+        __m128 hx = _mm_set1_ps(hub.x), hy = _mm_set1_ps(hub.y), hz = _mm_set1_ps(hub.z);
+
+        for (; i + 4 <= count; i += 4) {
+            __m128 cy = _mm_loadu_ps(y + i);
+            __m128 cz = _mm_loadu_ps(z + i);
+            __m128 px = _mm_add_ps(hx, _mm_add_ps(_mm_mul_ps(yx, cy), _mm_mul_ps(zx, cz)));
+            __m128 py = _mm_add_ps(hy, _mm_add_ps(_mm_mul_ps(yy, cy), _mm_mul_ps(zy, cz)));
+            __m128 pz = _mm_add_ps(hz, _mm_add_ps(_mm_mul_ps(yz, cy), _mm_mul_ps(zz, cz)));
+            __m128 pw = _mm_set1_ps(1.0f);
+
+            // Lanes to one column per cart
+            _MM_TRANSPOSE4_PS(px, py, pz, pw);
+            _mm_storeu_ps(&out[i][3][0], px);
+            _mm_storeu_ps(&out[i + 1][3][0], py);
+            _mm_storeu_ps(&out[i + 2][3][0], pz);
+            _mm_storeu_ps(&out[i + 3][3][0], pw);
+        }
+#endif
+
+        // Remainder (or everything without SSE)
+        for (; i < count; i++) {
+            out[i][3] = glm::vec4(hub + axisY * y[i] + axisZ * z[i], 1.0f);
+        }
+    }
+};
+
+#endif
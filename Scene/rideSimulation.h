@@ -0,0 +1,154 @@
+#ifndef RIDE_SIMULATION_H
+#define RIDE_SIMULATION_H
+
+#include "profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+#include <thread>
+
+// Ride state stepped at a fixed rate, independent of the frame rate. Rendering blends the
+// last two ticks, so motion is smooth at any frame rate and the result does not depend on
+// frame timing.
+//
+// The wheel angle is kept in double precision and wrapped every tick, so it stays exact over
+// days of running. A long frame runs at most MAX_STEPS_PER_FRAME ticks and drops the rest, so
+// after a hitch the ride carries on from where it was instead of jumping ahead.
+//
+// With startThread() the ticks run on their own thread at the fixed rate; otherwise advance()
+// runs the due ticks on the calling thread each frame.
+class RideSimulation {
+public:
+    static constexpr unsigned int MAX_STEPS_PER_FRAME = 4;
+
+    // Stats
+    std::atomic<unsigned long long> ticks{0};
+    std::atomic<unsigned int> droppedSteps{0};      // Lost to hitches so far
+
+    RideSimulation(double tickRate, float speedDegreesPerSecond)
+        : step(1.0 / tickRate), speed(speedDegreesPerSecond) {}
+
+    ~RideSimulation() {
+        stopThread();
+    }
+
+    RideSimulation(const RideSimulation&) = delete;
+    RideSimulation& operator=(const RideSimulation&) = delete;
+
+    void setRunning(bool isRunning) {
+        running = isRunning;
+    }
+
+    bool isRunning() const {
+        return running;
+    }
+
+    double stepSeconds() const {
+        return step;
+    }
+
+    // Single-threaded mode: run the ticks that fall due in frameSeconds
+    void advance(double frameSeconds) {
+        PROFILE_SCOPE("Ride Simulation");
+        if (worker.joinable()) return;
+
+        accumulator += frameSeconds;
+        for (unsigned int steps = 0; accumulator >= step && steps < MAX_STEPS_PER_FRAME; steps++) {
+            accumulator -= step;
+            tick();
+        }
+        if (accumulator >= step) {
+            droppedSteps += (unsigned int)(accumulator / step);
+            accumulator = std::fmod(accumulator, step);
+        }
+        alpha = accumulator / step;
+    }
+
+    void startThread() {
+        if (worker.joinable()) return;
+        stopping = false;
+        worker = std::thread([this] { threadLoop(); });
+    }
+
+    void stopThread() {
+        if (!worker.joinable()) return;
+        stopping = true;
+        worker.join();
+    }
+
+    // Wheel angle for rendering (degrees), blended between the last two ticks
+    float wheelAngle() const {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        double blend = alpha;
+        if (worker.joinable()) {
+            double sinceTick = std::chrono::duration<double>(std::chrono::steady_clock::now() - lastTickTime).count();
+            blend = std::min(sinceTick / step, 1.0);
+        }
+
+        // Shortest way round, across the wrap at 360
+        double delta = current - previous;
+        if (delta < -180.0) delta += 360.0;
+        if (delta > 180.0) delta -= 360.0;
+        return (float)std::fmod(previous + delta * blend + 360.0, 360.0);
+    }
+
+private:
+    const double step;
+    const float speed;
+    std::atomic<bool> running{false};
+
+    // Ride state of the last two ticks
+    double previous = 0.0;
+    double current = 0.0;
+
+    // Single-threaded mode
+    double accumulator = 0.0;
+    double alpha = 0.0;
+
+    // Threaded mode
+    std::thread worker;
+    std::atomic<bool> stopping{false};
+    mutable std::mutex stateMutex;
+    std::chrono::steady_clock::time_point lastTickTime;
+
+    void tick() {
+        double next = current;
+        if (running) {
+            next = std::fmod(current + speed * step, 360.0);
+        }
+
+        std::lock_guard<std::mutex> lock(stateMutex);
+        previous = current;
+        current = next;
+        lastTickTime = std::chrono::steady_clock::now();
+        ticks++;
+    }
+
+    void threadLoop() {
+        profiler.setThreadName("Ride Simulation");
+        using Clock = std::chrono::steady_clock;
+        auto interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(step));
+        auto next = Clock::now() + interval;
+
+        while (!stopping) {
+            std::this_thread::sleep_until(next);
+            {
+                PROFILE_SCOPE("Ride Tick");
+                tick();
+            }
+            next += interval;
+
+            // Behind by more than a few ticks (the process was stalled): skip, don't catch up
+            auto now = Clock::now();
+            if (now - next > interval * MAX_STEPS_PER_FRAME) {
+                droppedSteps += (unsigned int)((now - next) / interval);
+                next = now + interval;
+            }
+        }
+    }
+};
+
+#endif
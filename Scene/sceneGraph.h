@@ -0,0 +1,144 @@
+#ifndef SCENE_GRAPH_H
+#define SCENE_GRAPH_H
+
+#include <glm.hpp>
+#include <gtc/matrix_transform.hpp>
+#include <gtc/quaternion.hpp>
+
+#include "profiler.h"
+
+#include <vector>
+
+// Transform hierarchy kept in flat arrays, one entry per node. A node's parent always has a
+// lower index, so one forward sweep updates every level after the level above it.
+//
+// Setting a local transform only marks the node dirty; update() recomputes the world matrices
+// of dirty nodes and their descendants and leaves everything else cached.
+//
+// Driven nodes are leaves whose world matrices are written in bulk by an outside kernel (see
+// RideKinematics); update() skips them.
+class SceneGraph {
+public:
+    static const unsigned int NO_NODE = ~0u;
+
+    // Stats for the last update
+    unsigned int updatedNodes = 0;
+
+    unsigned int addNode(unsigned int parent = NO_NODE) {
+        unsigned int node = (unsigned int)parents.size();
+        parents.push_back(parent);
+        driven.push_back(false);
+        translations.push_back(glm::vec3(0.0f));
+        rotations.push_back(glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+        scales.push_back(glm::vec3(1.0f));
+        worlds.push_back(glm::mat4(1.0f));
+        dirty.push_back(true);
+        return node;
+    }
+
+    // count contiguous driven nodes under parent; returns the first
+    unsigned int addDrivenNodes(unsigned int parent, unsigned int count) {
+        unsigned int first = size();
+        for (unsigned int i = 0; i < count; i++) {
+            unsigned int node = addNode(parent);
+            driven[node] = true;
+            dirty[node] = false;
+        }
+        return first;
+    }
+
+    // World matrices of driven nodes from first on; valid until more nodes are added
+    glm::mat4* drivenWorlds(unsigned int first) {
+        return &worlds[first];
+    }
+
+    void setTranslation(unsigned int node, const glm::vec3& translation) {
+        translations[node] = translation;
+        dirty[node] = true;
+    }
+
+    void setRotation(unsigned int node, const glm::quat& rotation) {
+        rotations[node] = rotation;
+        dirty[node] = true;
+    }
+
+    void setScale(unsigned int node, const glm::vec3& scale) {
+        scales[node] = scale;
+        dirty[node] = true;
+    }
+
+    const glm::vec3& getTranslation(unsigned int node) const { return translations[node]; }
+    const glm::quat& getRotation(unsigned int node) const { return rotations[node]; }
+
+    // Valid as of the last update()
+    const glm::mat4& world(unsigned int node) const {
+        return worlds[node];
+    }
+
+    glm::vec3 worldPosition(unsigned int node) const {
+        return glm::vec3(worlds[node][3]);
+    }
+
+    // True if the node's world matrix changed in the last update
+    bool hasMoved(unsigned int node) const {
+        return node < moved.size() && moved[node];
+    }
+
+    // Nodes whose world matrix changed in the last update, in update order
+    const std::vector<unsigned int>& changedNodes() const {
+        return changed;
+    }
+
+    unsigned int size() const {
+        return (unsigned int)parents.size();
+    }
+
+    // Recompute the world matrices of dirty nodes and everything below them
+    void update() {
+        PROFILE_SCOPE("Scene Graph");
+        changed.clear();
+        moved.assign(parents.size(), false);
+
+        for (unsigned int node = 0; node < parents.size(); node++) {
+            unsigned int parent = parents[node];
+            bool parentMoved = parent != NO_NODE && moved[parent];
+            if (driven[node] || (!dirty[node] && !parentMoved)) continue;
+
+            glm::mat4 local = glm::translate(glm::mat4(1.0f), translations[node]) *
+                              glm::mat4_cast(rotations[node]) *
+                              glm::scale(glm::mat4(1.0f), scales[node]);
+
+            worlds[node] = parent == NO_NODE ? local : worlds[parent] * local;
+
+            dirty[node] = false;
+            moved[node] = true;
+            changed.push_back(node);
+        }
+        updatedNodes = (unsigned int)changed.size();
+    }
+
+    // Rotation from Euler angles in degrees, as Rx * Ry * Rz
+    static glm::quat eulerRotation(const glm::vec3& degrees) {
+        return glm::angleAxis(glm::radians(degrees.x), glm::vec3(1.0f, 0.0f, 0.0f)) *
+               glm::angleAxis(glm::radians(degrees.y), glm::vec3(0.0f, 1.0f, 0.0f)) *
+               glm::angleAxis(glm::radians(degrees.z), glm::vec3(0.0f, 0.0f, 1.0f));
+    }
+
+private:
+    std::vector<unsigned int> parents;
+    std::vector<bool> driven;
+
+    // Local TRS
+    std::vector<glm::vec3> translations;
+    std::vector<glm::quat> rotations;
+    std::vector<glm::vec3> scales;
+
+    std::vector<glm::mat4> worlds;
+    std::vector<bool> dirty;
+
+    // Scratch for update()
+    std::vector<bool> moved;
+    std::vector<unsigned int> changed;
+};
+
+#endif
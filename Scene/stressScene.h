@@ -0,0 +1,205 @@
+#ifndef STRESS_SCENE_H
+#define STRESS_SCENE_H
+
+#include <glm.hpp>
+#include <gtc/constants.hpp>
+
+#include <model.h>
+#include <lightClusters.h>
+#include "sceneGraph.h"
+#include "rideKinematics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+enum Stress_Layout {
+    STRESS_GRID,        // Rings of grid cells around the hand-built scene
+    STRESS_RANDOM       // Scattered (seeded), facing random directions
+};
+
+static const char* const STRESS_LAYOUT_NAMES[] = {"grid", "random"};
+
+struct StressSettings {
+    unsigned int wheels = 0;
+    unsigned int cartsPerWheel = 4;
+    unsigned int props = 0;
+    unsigned int lights = 0;
+    Stress_Layout layout = STRESS_GRID;
+    unsigned int seed = 1;
+
+    bool enabled() const {
+        return wheels > 0 || props > 0 || lights > 0;
+    }
+
+    // For benchmark output
+    std::string describe() const {
+        return std::to_string(wheels) + " wheels x " + std::to_string(cartsPerWheel) + " carts, " +
+               std::to_string(props) + " props, " + std::to_string(lights) + " lights, " + STRESS_LAYOUT_NAMES[layout];
+    }
+};
+
+// Extra rides, props and point lights around the hand-built scene, for finding where frame
+// time stops scaling with scene size. Everything is an instance of a model that is already
+// loaded (see Model::instance), so even large scenes load quickly and share GPU memory.
+//
+// Each ride is a base with a turning wheel and its carts, set up like the hand-built one:
+// carts are driven scene graph nodes placed by the ride kinematics. Props are solid, lights
+// are static.
+class StressScene {
+public:
+    static constexpr float WHEEL_SPACING = 50.0f;      // Between ride centres
+    static constexpr float PROP_SPACING = 6.0f;
+    static constexpr float LIGHT_SPACING = 12.0f;
+    static constexpr float CLEAR_RADIUS = 30.0f;       // Kept free around the hand-built scene
+    static constexpr float PROP_HEIGHT = 2.8f;
+    static constexpr float LIGHT_HEIGHT = 6.0f;
+
+    // Instances; filled once by build(), so pointers into it stay valid
+    std::vector<Model> models;
+    std::vector<PointLight> lights;
+
+    // Distance from the origin that everything fits within
+    float extent = 0.0f;
+
+    // base, wheel and cart as set up for the hand-built ride (wheel attached under base)
+    void build(const StressSettings& settings, const Model& base, const Model& wheel, const Model& cart, const Model& prop,
+               float rideRadius, SceneGraph& graph, RideKinematics& kinematics) {
+        std::mt19937 random(settings.seed);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+        models.reserve(settings.wheels * (2 + settings.cartsPerWheel) + settings.props);
+        roles.reserve(models.capacity());
+
+        // Rides
+        float rideArea = areaRadius(settings.wheels, WHEEL_SPACING);
+        for (unsigned int i = 0; i < settings.wheels; i++) {
+            glm::vec2 spot = place(settings.layout, i, WHEEL_SPACING, rideArea, random);
+            float yaw = settings.layout == STRESS_RANDOM ? unit(random) * 360.0f : 0.0f;
+
+            unsigned int baseIndex = add(base, ROLE_STATIC, graph, graph.addNode());
+            models[baseIndex].setPosition(glm::vec3(spot.x, base.getPosition().y, spot.y));
+            models[baseIndex].setRotation(glm::vec3(0.0f, yaw, 0.0f));
+
+            unsigned int wheelIndex = add(wheel, ROLE_MOVING, graph, graph.addNode(models[baseIndex].getNode()));
+            models[wheelIndex].setPosition(wheel.getPosition());
+            wheels.push_back(wheelIndex);
+            phases.push_back(unit(random) * 360.0f);
+
+            unsigned int firstCartNode = graph.addDrivenNodes(models[wheelIndex].getNode(), settings.cartsPerWheel);
+            for (unsigned int c = 0; c < settings.cartsPerWheel; c++) {
+                add(cart, ROLE_MOVING, graph, firstCartNode + c);
+            }
+            kinematics.addRide(models[wheelIndex].getNode(), firstCartNode, settings.cartsPerWheel, rideRadius, 0.0f, 1.0f);
+            extent = std::max(extent, glm::length(spot) + WHEEL_SPACING * 0.5f);
+        }
+
+        // Props
+        float propArea = areaRadius(settings.props, PROP_SPACING);
+        for (unsigned int i = 0; i < settings.props; i++) {
+            glm::vec2 spot = place(settings.layout, i, PROP_SPACING, propArea, random);
+            float yaw = settings.layout == STRESS_RANDOM ? unit(random) * 360.0f : 0.0f;
+
+            unsigned int propIndex = add(prop, ROLE_SOLID, graph, graph.addNode());
+            models[propIndex].setPosition(glm::vec3(spot.x, PROP_HEIGHT, spot.y));
+            models[propIndex].setRotation(glm::vec3(0.0f, yaw, 0.0f));
+            extent = std::max(extent, glm::length(spot) + PROP_SPACING);
+        }
+
+        // Lights (the carts' attenuation, random colours)
+        float lightArea = areaRadius(settings.lights, LIGHT_SPACING);
+        for (unsigned int i = 0; i < settings.lights; i++) {
+            glm::vec2 spot = place(settings.layout, i, LIGHT_SPACING, lightArea, random);
+            glm::vec3 color = glm::vec3(0.4f) + 0.6f * glm::vec3(unit(random), unit(random), unit(random));
+
+            PointLight light;
+            light.position = glm::vec3(spot.x, LIGHT_HEIGHT, spot.y);
+            light.ambient = 0.05f * color;
+            light.diffuse = 0.8f * color;
+            light.specular = 1.0f * color;
+            light.constant = 1.0f;
+            light.linear = 0.09f;
+            light.quadratic = 0.032f;
+            lights.push_back(light);
+            extent = std::max(extent, glm::length(spot));
+        }
+    }
+
+    // The wheels turn with the hand-built one, each from its own starting angle
+    void update(float rideAngle) {
+        // A stopped ride leaves every wheel (and its carts) clean
+        if (rideAngle == appliedAngle) return;
+        appliedAngle = rideAngle;
+
+        for (unsigned int i = 0; i < wheels.size(); i++) {
+            models[wheels[i]].setRotation(glm::vec3(rideAngle + phases[i], 0.0f, 0.0f));
+        }
+    }
+
+    bool isMoving(unsigned int index) const {
+        return roles[index] == ROLE_MOVING;
+    }
+
+    bool isSolid(unsigned int index) const {
+        return roles[index] == ROLE_SOLID;
+    }
+
+private:
+    enum Role : unsigned char {
+        ROLE_STATIC,
+        ROLE_MOVING,
+        ROLE_SOLID
+    };
+
+    std::vector<Role> roles;
+    std::vector<unsigned int> wheels;
+    std::vector<float> phases;
+    float appliedAngle = std::numeric_limits<float>::quiet_NaN();     // NaN: the first update always applies
+
+    unsigned int add(const Model& prototype, Role role, SceneGraph& graph, unsigned int node) {
+        models.push_back(prototype.instance());
+        models.back().attach(graph, node);
+        roles.push_back(role);
+        return (unsigned int)models.size() - 1;
+    }
+
+    // Radius of a disc holding count cells of spacing outside the clear area
+    static float areaRadius(unsigned int count, float spacing) {
+        float area = count * spacing * spacing + glm::pi<float>() * CLEAR_RADIUS * CLEAR_RADIUS;
+        return std::sqrt(area / glm::pi<float>());
+    }
+
+    static glm::vec2 place(Stress_Layout layout, unsigned int index, float spacing, float radius, std::mt19937& random) {
+        if (layout == STRESS_GRID) {
+            return glm::vec2(ringCell(index, (int)std::ceil(CLEAR_RADIUS / spacing))) * spacing;
+        }
+
+        // Uniform over the ring between the clear area and radius
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        float r = std::sqrt(CLEAR_RADIUS * CLEAR_RADIUS + unit(random) * (radius * radius - CLEAR_RADIUS * CLEAR_RADIUS));
+        float angle = unit(random) * glm::two_pi<float>();
+        return glm::vec2(r * std::cos(angle), r * std::sin(angle));
+    }
+
+    // index-th cell of the square rings around the origin, starting at ring firstRing (ring r
+    // has 8r cells)
+    static glm::ivec2 ringCell(unsigned int index, int firstRing) {
+        int ring = std::max(firstRing, 1);
+        while (index >= 8u * ring) {
+            index -= 8u * ring;
+            ring++;
+        }
+
+        int k = (int)index;
+        int side = 2 * ring;
+        if (k < side) return glm::ivec2(-ring + k, -ring);
+        if (k < 2 * side) return glm::ivec2(ring, -ring + (k - side));
+        if (k < 3 * side) return glm::ivec2(ring - (k - 2 * side), ring);
+        return glm::ivec2(-ring, ring - (k - 3 * side));
+    }
+};
+
+#endif
@@ -0,0 +1,5 @@
+#version 460 core
+// Depth only; colour writes are masked off during the pre-pass
+void main()
+{
+}
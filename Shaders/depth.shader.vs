@@ -0,0 +1,16 @@
+#version 460 core
+layout (location = 0) in vec3 aPos;
+
+// Must match light.multiple.shader.vs exactly so the main pass can test with GL_EQUAL
+invariant gl_Position;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+void main()
+{
+    vec3 FragPos = vec3(model * vec4(aPos, 1.0));
+    vec4 viewPosition = view * vec4(FragPos, 1.0);
+    gl_Position = projection * viewPosition;
+}
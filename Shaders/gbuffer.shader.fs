@@ -0,0 +1,55 @@
+#version 460 core
+// G-buffer layout matches gBuffer.h
+layout (location = 0) out vec4 gAlbedo;
+layout (location = 1) out vec4 gSpecular;
+layout (location = 2) out vec2 gNormal;
+
+struct Material{
+    sampler2D diffuse;
+    sampler2D specular;
+#ifdef NORMAL_MAP
+    sampler2D normal;
+#endif
+    float shininess;
+};
+
+in vec3 Normal;
+in vec3 FragPos;
+in vec2 TexCoords;
+#ifdef NORMAL_MAP
+in mat3 TBN;
+#endif
+
+uniform Material material;
+
+// Meshes without a diffuse map (same as light.multiple.shader.fs)
+const vec3 UNTEXTURED_DIFFUSE = vec3(0.8);
+const vec3 UNTEXTURED_SPECULAR = vec3(0.5);
+
+// Octahedral encoding: the unit sphere folded onto [-1, 1]^2
+vec2 EncodeNormal(vec3 n){
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    if(n.z < 0.0){
+        vec2 signs = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+        n.xy = (1.0 - abs(n.yx)) * signs;
+    }
+    return n.xy;
+}
+
+void main()
+{
+#ifdef TEXTURED
+    gAlbedo = vec4(texture(material.diffuse, TexCoords).rgb, 1.0);
+    gSpecular = vec4(texture(material.specular, TexCoords).rgb, material.shininess / 255.0);
+#else
+    gAlbedo = vec4(UNTEXTURED_DIFFUSE, 1.0);
+    gSpecular = vec4(UNTEXTURED_SPECULAR, material.shininess / 255.0);
+#endif
+
+#ifdef NORMAL_MAP
+    vec3 norm = texture(material.normal, TexCoords).rgb * 2.0 - 1.0;
+    gNormal = EncodeNormal(normalize(TBN * norm));
+#else
+    gNormal = EncodeNormal(normalize(Normal));
+#endif
+}
@@ -0,0 +1,13 @@
+#version 460 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+in vec4 Color;
+
+// Glyph coverage; solid quads sample a texel that is always set
+uniform sampler2D glyphAtlas;
+
+void main()
+{
+    FragColor = vec4(Color.rgb, Color.a * texture(glyphAtlas, TexCoords).r);
+}
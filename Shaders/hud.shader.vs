@@ -0,0 +1,16 @@
+#version 460 core
+layout (location = 0) in vec2 aPos;         // Pixels from the top left
+layout (location = 1) in vec2 aTexCoords;
+layout (location = 2) in vec4 aColor;
+
+out vec2 TexCoords;
+out vec4 Color;
+
+uniform vec2 screenSize;
+
+void main()
+{
+    TexCoords = aTexCoords;
+    Color = aColor;
+    gl_Position = vec4(aPos.x / screenSize.x * 2.0 - 1.0, 1.0 - aPos.y / screenSize.y * 2.0, 0.0, 1.0);
+}
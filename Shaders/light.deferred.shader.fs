@@ -0,0 +1,267 @@
+#version 460 core
+out vec4 FragColor;
+
+struct DirLight{
+    vec3 direction;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+// Matches GpuPointLight in lightClusters.h (std430)
+struct PointLight{
+    vec4 position;      // w = range
+    vec4 attenuation;   // constant, linear, quadratic
+
+    vec4 ambient;
+    vec4 diffuse;
+    vec4 specular;
+};
+
+struct SpotLight {
+    vec3 position;
+    vec3 direction;
+    float cutOff;
+    float outerCutOff;
+
+    float constant;
+    float linear;
+    float quadratic;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+#ifdef POINT_LIGHTS
+// Clustered point lights: every view-space cluster lists the lights that reach it
+layout(std430, binding = 0) readonly buffer PointLightBuffer {
+    PointLight pointLights[];
+};
+layout(std430, binding = 1) readonly buffer ClusterBuffer {
+    uvec2 clusters[];   // offset, count into clusterLightIndices
+};
+layout(std430, binding = 2) readonly buffer ClusterIndexBuffer {
+    uint clusterLightIndices[];
+};
+#endif
+
+// G-buffer (see gBuffer.h)
+uniform sampler2D gAlbedo;
+uniform sampler2D gSpecular;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+
+uniform mat4 inverseProjection;
+uniform mat4 inverseView;
+
+uniform vec3 viewPos;
+uniform DirLight dirLight;
+uniform SpotLight spotLightRide;
+uniform SpotLight spotLightTorch;
+
+#ifdef SHADOWS
+// Shadows (see shadowMaps.h): layers 0-2 are the sun's cascades, 3 the ride spotlight, 4 the torch
+uniform sampler2DArrayShadow shadowMap;
+uniform mat4 shadowMatrices[5];
+uniform float shadowNormalOffsets[5];
+uniform vec3 cascadeSplits;     // Far distance of each cascade
+#endif
+
+#ifdef POINT_LIGHTS
+uniform uvec3 clusterCount;
+uniform vec2 clusterTileSize;
+uniform float clusterScale;
+uniform float clusterBias;
+#endif
+
+vec3 DecodeNormal(vec2 e);
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec3 diffuseColor, vec3 specularColor, float shininess, float shadow);
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 diffuseColor, vec3 specularColor, float shininess);
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 diffuseColor, vec3 specularColor, float shininess, float shadow);
+#ifdef SHADOWS
+float CalcShadow(int layer, vec3 fragPos, vec3 normal);
+float CalcDirShadow(float viewDepth, vec3 fragPos, vec3 normal);
+#endif
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    if(depth == 1.0){
+        discard;    // Background
+    }
+
+    // Rebuild the position from depth
+    vec2 uv = gl_FragCoord.xy / vec2(textureSize(gDepth, 0));
+    vec4 viewPosition = inverseProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    viewPosition /= viewPosition.w;
+    vec3 FragPos = vec3(inverseView * viewPosition);
+    float ViewDepth = -viewPosition.z;
+
+    vec3 norm = DecodeNormal(texelFetch(gNormal, pixel, 0).rg);
+    vec3 viewDir = normalize(viewPos - FragPos);
+
+    // Material
+    vec3 diffuseColor = texelFetch(gAlbedo, pixel, 0).rgb;
+    vec4 specularSample = texelFetch(gSpecular, pixel, 0);
+    vec3 specularColor = specularSample.rgb;
+    float shininess = specularSample.a * 255.0;
+
+    vec3 result = vec3(0.0);
+
+    // Directional
+#ifdef DIR_LIGHT
+#ifdef SHADOWS
+    float dirShadow = CalcDirShadow(ViewDepth, FragPos, norm);
+#else
+    float dirShadow = 0.0;
+#endif
+    result += CalcDirLight(dirLight, norm, viewDir, diffuseColor, specularColor, shininess, dirShadow);
+#endif
+
+    // Point (only the lights listed for this pixel's cluster)
+#ifdef POINT_LIGHTS
+    uvec2 tile = min(uvec2(gl_FragCoord.xy / clusterTileSize), clusterCount.xy - 1u);
+    uint slice = min(uint(max(log(ViewDepth) * clusterScale + clusterBias, 0.0)), clusterCount.z - 1u);
+    uvec2 cluster = clusters[tile.x + tile.y * clusterCount.x + slice * clusterCount.x * clusterCount.y];
+    for(uint i = 0u; i < cluster.y; i++){
+        result += CalcPointLight(pointLights[clusterLightIndices[cluster.x + i]], norm, FragPos, viewDir, diffuseColor, specularColor, shininess);
+    }
+#endif
+
+    // Spotlights
+#ifdef SPOT_RIDE
+#ifdef SHADOWS
+    float rideShadow = CalcShadow(3, FragPos, norm);
+#else
+    float rideShadow = 0.0;
+#endif
+    result += CalcSpotLight(spotLightRide, norm, FragPos, viewDir, diffuseColor, specularColor, shininess, rideShadow);
+#endif
+#ifdef SPOT_TORCH
+#ifdef SHADOWS
+    float torchShadow = CalcShadow(4, FragPos, norm);
+#else
+    float torchShadow = 0.0;
+#endif
+    result += CalcSpotLight(spotLightTorch, norm, FragPos, viewDir, diffuseColor, specularColor, shininess, torchShadow);
+#endif
+
+    FragColor = vec4(result, 1.0);
+}
+
+vec3 DecodeNormal(vec2 e){
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if(n.z < 0.0){
+        vec2 signs = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+        n.xy = (1.0 - abs(n.yx)) * signs;
+    }
+    return normalize(n);
+}
+
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec3 diffuseColor, vec3 specularColor, float shininess, float shadow){
+    vec3 lightDir = normalize(-light.direction);
+
+    // Diffuse
+    float diff = max(dot(normal, lightDir), 0.0);
+
+    // Specular
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+
+    // Results
+    vec3 ambient = light.ambient * diffuseColor;
+    vec3 diffuse = light.diffuse * diff * diffuseColor;
+    vec3 specular = light.specular * spec * specularColor;
+
+    return (ambient + (1.0 - shadow) * (diffuse + specular));
+}
+
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 diffuseColor, vec3 specularColor, float shininess){
+    vec3 lightDir = normalize(light.position.xyz - fragPos);
+
+    // Diffuse
+    float diff = max(dot(normal, lightDir), 0.0);
+
+    // Specular
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+
+    // Attenuation
+    float distance = length(light.position.xyz - fragPos);
+    float attenuation = 1.0 / (light.attenuation.x + light.attenuation.y * distance + light.attenuation.z * (distance * distance));
+
+    // Results
+    vec3 ambient = light.ambient.rgb * diffuseColor;
+    vec3 diffuse = light.diffuse.rgb * diff * diffuseColor;
+    vec3 specular = light.specular.rgb * spec * specularColor;
+
+    ambient  *= attenuation;
+    diffuse  *= attenuation;
+    specular *= attenuation;
+
+    return (ambient + diffuse + specular);
+}
+
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 diffuseColor, vec3 specularColor, float shininess, float shadow)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+
+    // Diffuse
+    float diff = max(dot(normal, lightDir), 0.0);
+
+    // Specular
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+
+    // Attenuation
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+
+    // Intensity
+    float theta = dot(lightDir, normalize(-light.direction));
+    float epsilon = light.cutOff - light.outerCutOff;
+    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+
+    // Results
+    vec3 ambient = light.ambient * diffuseColor;
+    vec3 diffuse = light.diffuse * diff * diffuseColor;
+    vec3 specular = light.specular * spec * specularColor;
+
+    ambient *= attenuation * intensity;
+    diffuse *= attenuation * intensity * (1.0 - shadow);
+    specular *= attenuation * intensity * (1.0 - shadow);
+
+    return (ambient + diffuse + specular);
+}
+
+#ifdef SHADOWS
+float CalcShadow(int layer, vec3 fragPos, vec3 normal){
+    vec4 lightSpace = shadowMatrices[layer] * vec4(fragPos + normal * shadowNormalOffsets[layer], 1.0);
+    vec3 coords = lightSpace.xyz / lightSpace.w * 0.5 + 0.5;
+    if(any(lessThan(coords, vec3(0.0))) || any(greaterThan(coords, vec3(1.0)))){
+        return 0.0;
+    }
+
+    // 3x3 PCF on top of the hardware's bilinear compare
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float lit = 0.0;
+    for(int x = -1; x <= 1; x++){
+        for(int y = -1; y <= 1; y++){
+            lit += texture(shadowMap, vec4(coords.xy + vec2(x, y) * texelSize, layer, coords.z));
+        }
+    }
+    return 1.0 - lit / 9.0;
+}
+
+float CalcDirShadow(float viewDepth, vec3 fragPos, vec3 normal){
+    for(int i = 0; i < 3; i++){
+        if(viewDepth < cascadeSplits[i]){
+            return CalcShadow(i, fragPos, normal);
+        }
+    }
+    return 0.0;
+}
+#endif
@@ -4,7 +4,9 @@ out vec4 FragColor;
 struct Material{
     sampler2D diffuse;
     sampler2D specular;
-    //sampler2D normal;
+#ifdef NORMAL_MAP
+    sampler2D normal;
+#endif
     float shininess;
 };
 
@@ -16,16 +18,14 @@ struct DirLight{
     vec3 specular;
 };
 
+// Matches GpuPointLight in lightClusters.h (std430)
 struct PointLight{
-    vec3 position;
+    vec4 position;      // w = range
+    vec4 attenuation;   // constant, linear, quadratic
 
-    float constant;
-    float linear;
-    float quadratic;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
+    vec4 ambient;
+    vec4 diffuse;
+    vec4 specular;
 };
 
 struct SpotLight {
@@ -43,45 +43,118 @@ struct SpotLight {
     vec3 specular;
 };
 
-#define NR_POINT_LIGHTS 4
-
+#ifdef POINT_LIGHTS
+// Clustered point lights: every view-space cluster lists the lights that reach it
+layout(std430, binding = 0) readonly buffer PointLightBuffer {
+    PointLight pointLights[];
+};
+layout(std430, binding = 1) readonly buffer ClusterBuffer {
+    uvec2 clusters[];   // offset, count into clusterLightIndices
+};
+layout(std430, binding = 2) readonly buffer ClusterIndexBuffer {
+    uint clusterLightIndices[];
+};
+#endif
 
 in vec3 Normal;
 in vec3 FragPos;
 in vec2 TexCoords;
-//in mat3 TBN;
+in float ViewDepth;
+#ifdef NORMAL_MAP
+in mat3 TBN;
+#endif
 
 uniform vec3 viewPos;
 uniform DirLight dirLight;
-uniform PointLight pointLights[NR_POINT_LIGHTS];
 uniform SpotLight spotLightRide;
 uniform SpotLight spotLightTorch;
 uniform Material material;
-uniform bool hasTexture;
 
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+// Meshes without a diffuse map
+const vec3 UNTEXTURED_DIFFUSE = vec3(0.8);
+const vec3 UNTEXTURED_SPECULAR = vec3(0.5);
+
+#ifdef SHADOWS
+// Shadows (see shadowMaps.h): layers 0-2 are the sun's cascades, 3 the ride spotlight, 4 the torch
+uniform sampler2DArrayShadow shadowMap;
+uniform mat4 shadowMatrices[5];
+uniform float shadowNormalOffsets[5];
+uniform vec3 cascadeSplits;     // Far distance of each cascade
+#endif
+
+#ifdef POINT_LIGHTS
+uniform uvec3 clusterCount;
+uniform vec2 clusterTileSize;
+uniform float clusterScale;
+uniform float clusterBias;
+#endif
+
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec3 diffuseColor, vec3 specularColor, float shadow);
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 diffuseColor, vec3 specularColor);
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 diffuseColor, vec3 specularColor, float shadow);
+#ifdef SHADOWS
+float CalcShadow(int layer, vec3 fragPos, vec3 normal);
+float CalcDirShadow(float viewDepth, vec3 fragPos, vec3 normal);
+#endif
 
 void main()
 {
+#ifdef NORMAL_MAP
+    vec3 norm = texture(material.normal, TexCoords).rgb * 2.0 - 1.0;
+    norm = normalize(TBN * norm);
+#else
     vec3 norm = normalize(Normal);
-//     vec3 norm = texture(material.normal, TexCoords).rgb;
-//     norm = norm * 2.0 - 1.0;
-//     vec3 worldNormal = normalize(TBN * norm);
+#endif
     vec3 viewDir = normalize(viewPos - FragPos);
 
-    // Directional
-    vec3 result = CalcDirLight(dirLight, norm, viewDir);
+    // Material (fetched once for every light)
+#ifdef TEXTURED
+    vec3 diffuseColor = vec3(texture(material.diffuse, TexCoords));
+    vec3 specularColor = vec3(texture(material.specular, TexCoords));
+#else
+    vec3 diffuseColor = UNTEXTURED_DIFFUSE;
+    vec3 specularColor = UNTEXTURED_SPECULAR;
+#endif
+
+    vec3 result = vec3(0.0);
 
-    // Point
-    for(int i = 0; i < NR_POINT_LIGHTS; i++){
-        result += CalcPointLight(pointLights[i], norm, FragPos, viewDir);
+    // Directional
+#ifdef DIR_LIGHT
+#ifdef SHADOWS
+    float dirShadow = CalcDirShadow(ViewDepth, FragPos, norm);
+#else
+    float dirShadow = 0.0;
+#endif
+    result += CalcDirLight(dirLight, norm, viewDir, diffuseColor, specularColor, dirShadow);
+#endif
+
+    // Point (only the lights listed for this fragment's cluster)
+#ifdef POINT_LIGHTS
+    uvec2 tile = min(uvec2(gl_FragCoord.xy / clusterTileSize), clusterCount.xy - 1u);
+    uint slice = min(uint(max(log(ViewDepth) * clusterScale + clusterBias, 0.0)), clusterCount.z - 1u);
+    uvec2 cluster = clusters[tile.x + tile.y * clusterCount.x + slice * clusterCount.x * clusterCount.y];
+    for(uint i = 0u; i < cluster.y; i++){
+        result += CalcPointLight(pointLights[clusterLightIndices[cluster.x + i]], norm, FragPos, viewDir, diffuseColor, specularColor);
     }
+#endif
 
     // Spotlights
-    result += CalcSpotLight(spotLightRide, norm, FragPos, viewDir);
-    result += CalcSpotLight(spotLightTorch, norm, FragPos, viewDir);
+#ifdef SPOT_RIDE
+#ifdef SHADOWS
+    float rideShadow = CalcShadow(3, FragPos, norm);
+#else
+    float rideShadow = 0.0;
+#endif
+    result += CalcSpotLight(spotLightRide, norm, FragPos, viewDir, diffuseColor, specularColor, rideShadow);
+#endif
+#ifdef SPOT_TORCH
+#ifdef SHADOWS
+    float torchShadow = CalcShadow(4, FragPos, norm);
+#else
+    float torchShadow = 0.0;
+#endif
+    result += CalcSpotLight(spotLightTorch, norm, FragPos, viewDir, diffuseColor, specularColor, torchShadow);
+#endif
 
     //result *= texture(material.diffuse, TexCoords).rgb;
     //result *= texture(material.specular, TexCoords).rgb;
@@ -89,7 +162,7 @@ void main()
     FragColor = vec4(result, 1.0);
 }
 
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir){
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec3 diffuseColor, vec3 specularColor, float shadow){
     vec3 lightDir = normalize(-light.direction);
 
     // Diffuse
@@ -100,15 +173,15 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir){
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
 
     // Results
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
+    vec3 ambient = light.ambient * diffuseColor;
+    vec3 diffuse = light.diffuse * diff * diffuseColor;
+    vec3 specular = light.specular * spec * specularColor;
 
-    return (ambient + diffuse + specular);
+    return (ambient + (1.0 - shadow) * (diffuse + specular));
 }
 
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir){
-    vec3 lightDir = normalize(light.position - fragPos);
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 diffuseColor, vec3 specularColor){
+    vec3 lightDir = normalize(light.position.xyz - fragPos);
 
     // Diffuse
     float diff = max(dot(normal, lightDir), 0.0);
@@ -118,13 +191,13 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir){
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
 
     // Attenuation
-    float distance = length(light.position - fragPos);
-    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+    float distance = length(light.position.xyz - fragPos);
+    float attenuation = 1.0 / (light.attenuation.x + light.attenuation.y * distance + light.attenuation.z * (distance * distance));
 
     // Results
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
+    vec3 ambient = light.ambient.rgb * diffuseColor;
+    vec3 diffuse = light.diffuse.rgb * diff * diffuseColor;
+    vec3 specular = light.specular.rgb * spec * specularColor;
 
     ambient  *= attenuation;
     diffuse  *= attenuation;
@@ -133,7 +206,7 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir){
     return (ambient + diffuse + specular);
 }
 
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 diffuseColor, vec3 specularColor, float shadow)
 {
     vec3 lightDir = normalize(light.position - fragPos);
 
@@ -154,13 +227,42 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
 
     // Results
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
+    vec3 ambient = light.ambient * diffuseColor;
+    vec3 diffuse = light.diffuse * diff * diffuseColor;
+    vec3 specular = light.specular * spec * specularColor;
 
     ambient *= attenuation * intensity;
-    diffuse *= attenuation * intensity;
-    specular *= attenuation * intensity;
+    diffuse *= attenuation * intensity * (1.0 - shadow);
+    specular *= attenuation * intensity * (1.0 - shadow);
 
     return (ambient + diffuse + specular);
-}
\ No newline at end of file
+}
+
+#ifdef SHADOWS
+float CalcShadow(int layer, vec3 fragPos, vec3 normal){
+    vec4 lightSpace = shadowMatrices[layer] * vec4(fragPos + normal * shadowNormalOffsets[layer], 1.0);
+    vec3 coords = lightSpace.xyz / lightSpace.w * 0.5 + 0.5;
+    if(any(lessThan(coords, vec3(0.0))) || any(greaterThan(coords, vec3(1.0)))){
+        return 0.0;
+    }
+
+    // 3x3 PCF on top of the hardware's bilinear compare
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float lit = 0.0;
+    for(int x = -1; x <= 1; x++){
+        for(int y = -1; y <= 1; y++){
+            lit += texture(shadowMap, vec4(coords.xy + vec2(x, y) * texelSize, layer, coords.z));
+        }
+    }
+    return 1.0 - lit / 9.0;
+}
+
+float CalcDirShadow(float viewDepth, vec3 fragPos, vec3 normal){
+    for(int i = 0; i < 3; i++){
+        if(viewDepth < cascadeSplits[i]){
+            return CalcShadow(i, fragPos, normal);
+        }
+    }
+    return 0.0;
+}
+#endif
@@ -2,28 +2,40 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
-//layout (location = 3) in vec3 aTangent;
-//layout (location = 4) in vec3 aBitangent;
+#ifdef NORMAL_MAP
+layout (location = 3) in vec3 aTangent;
+#endif
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoords;
-// out mat3 TBN;
+out float ViewDepth;
+#ifdef NORMAL_MAP
+out mat3 TBN;
+#endif
+
+// Bit-identical with depth.shader.vs for the depth pre-pass
+invariant gl_Position;
 
 uniform mat4 model;
+uniform mat3 normalMatrix;     // Inverse-transpose of model, from the CPU
 uniform mat4 view;
 uniform mat4 projection;
 
 void main()
 {
     FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;
+    Normal = normalMatrix * aNormal;
     TexCoords = aTexCoords;
 
-//    vec3 T = normalize(mat3(model) * aTangent);
-//    vec3 N = normalize(mat3(model) * aNormal);
-//    vec3 B = normalize(cross(N, T));
-//    TBN = mat3(T, B, N);
+#ifdef NORMAL_MAP
+    vec3 N = normalize(Normal);
+    vec3 T = normalize(mat3(model) * aTangent);
+    T = normalize(T - dot(T, N) * N);
+    TBN = mat3(T, cross(N, T), N);
+#endif
 
-    gl_Position = projection * view * vec4(FragPos, 1.0);
+    vec4 viewPosition = view * vec4(FragPos, 1.0);
+    ViewDepth = -viewPosition.z;
+    gl_Position = projection * viewPosition;
 }
\ No newline at end of file
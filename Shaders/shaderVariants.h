@@ -0,0 +1,195 @@
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+#include <glad/glad.h>
+
+#include <shader_s.h>
+#include <frameArena.h>
+#include <logger.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+// Feature keys; each one becomes a #define in the generated source
+enum Shader_Feature {
+    FEATURE_TEXTURED     = 1 << 0,
+    FEATURE_NORMAL_MAP   = 1 << 1,
+    FEATURE_DIR_LIGHT    = 1 << 2,
+    FEATURE_POINT_LIGHTS = 1 << 3,
+    FEATURE_SPOT_RIDE    = 1 << 4,
+    FEATURE_SPOT_TORCH   = 1 << 5,
+    FEATURE_SHADOWS      = 1 << 6
+};
+
+static const char* const SHADER_FEATURE_NAMES[] = {
+    "TEXTURED", "NORMAL_MAP", "DIR_LIGHT", "POINT_LIGHTS", "SPOT_RIDE", "SPOT_TORCH", "SHADOWS"
+};
+static const unsigned int SHADER_FEATURE_COUNT = sizeof(SHADER_FEATURE_NAMES) / sizeof(SHADER_FEATURE_NAMES[0]);
+
+// Compile-time specialisations of one vertex/fragment pair. A variant is built the first
+// time its feature set is selected, from the on-disk program binary when the driver still
+// accepts it, otherwise from source (and then saved for next time).
+class ShaderVariants {
+public:
+    // Stats
+    unsigned int compiledVariants = 0;
+    unsigned int cachedVariants = 0;
+
+    // supportedFeatures: the keys this source understands; others are masked off so they
+    // don't create duplicate programs
+    ShaderVariants(const char* vertexPath, const char* fragmentPath, unsigned int supportedFeatures)
+        : supported(supportedFeatures),
+          vertexSource(Shader::readFile(vertexPath)),
+          fragmentSource(Shader::readFile(fragmentPath)) {
+        sourceHash = hash(vertexSource, hash(fragmentSource));
+    }
+
+    ~ShaderVariants() {
+        for (auto& entry : variants) {
+            glState.forgetProgram(entry.second.shader.ID);
+            glDeleteProgram(entry.second.shader.ID);
+        }
+    }
+
+    ShaderVariants(const ShaderVariants&) = delete;
+    ShaderVariants& operator=(const ShaderVariants&) = delete;
+
+    // Starts a new frame; setup runs on each variant the first time it is selected in it.
+    // The callable is copied into the frame arena rather than a heap-allocating std::function.
+    template<typename Setup>
+    void beginFrame(const Setup& frameSetup) {
+        static_assert(std::is_trivially_destructible<Setup>::value, "frame setup is never destroyed");
+        setup = new (frameArena.allocate(sizeof(Setup), alignof(Setup))) Setup(frameSetup);
+        invokeSetup = [](const void* callable, Shader& shader) {
+            (*static_cast<const Setup*>(callable))(shader);
+        };
+        frame++;
+    }
+
+    // Variant for the given features, bound and set up for this frame
+    Shader& select(unsigned int features) {
+        features &= supported;
+        Variant& variant = variants[features];
+        if (!variant.built) {
+            build(variant, features);
+        }
+
+        variant.shader.use();
+        if (variant.frame != frame) {
+            variant.frame = frame;
+            if (setup) invokeSetup(setup, variant.shader);
+        }
+        return variant.shader;
+    }
+
+private:
+    struct Variant {
+        Shader shader;
+        unsigned int frame = 0;
+        bool built = false;
+    };
+
+    unsigned int supported;
+    std::string vertexSource;
+    std::string fragmentSource;
+    uint64_t sourceHash;
+    std::unordered_map<unsigned int, Variant> variants;
+    const void* setup = nullptr;
+    void (*invokeSetup)(const void*, Shader&) = nullptr;
+    unsigned int frame = 0;
+
+    static constexpr const char* CACHE_DIRECTORY = "ShaderCache";
+
+    void build(Variant& variant, unsigned int features) {
+        variant.built = true;
+
+        std::string defines;
+        for (unsigned int i = 0; i < SHADER_FEATURE_COUNT; i++) {
+            if (features & (1u << i)) {
+                defines += std::string("#define ") + SHADER_FEATURE_NAMES[i] + "\n";
+            }
+        }
+        std::string vertexCode = inject(vertexSource, defines);
+        std::string fragmentCode = inject(fragmentSource, defines);
+
+        // Binaries are only valid for the driver that produced them
+        int formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        std::string driver = std::string((const char*)glGetString(GL_RENDERER)) + (const char*)glGetString(GL_VERSION);
+        std::string cachePath = cacheFile(hash(defines, hash(driver, sourceHash)));
+
+        if (formats > 0 && loadCached(variant.shader, cachePath)) {
+            cachedVariants++;
+            return;
+        }
+
+        variant.shader.compile(vertexCode.c_str(), fragmentCode.c_str(), formats > 0);
+        compiledVariants++;
+        if (formats > 0) {
+            saveCached(variant.shader, cachePath);
+        }
+    }
+
+    // Defines go straight after the #version line
+    static std::string inject(const std::string& source, const std::string& defines) {
+        size_t lineEnd = source.find('\n');
+        if (lineEnd == std::string::npos) return source + "\n" + defines;
+        return source.substr(0, lineEnd + 1) + defines + source.substr(lineEnd + 1);
+    }
+
+    // FNV-1a
+    static uint64_t hash(const std::string& text, uint64_t seed = 14695981039346656037ull) {
+        for (unsigned char c : text) {
+            seed = (seed ^ c) * 1099511628211ull;
+        }
+        return seed;
+    }
+
+    static std::string cacheFile(uint64_t key) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+        return std::string(CACHE_DIRECTORY) + "/" + name;
+    }
+
+    static bool loadCached(Shader& shader, const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) return false;
+
+        GLenum format = 0;
+        file.read((char*)&format, sizeof(format));
+        std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (!file.good() && !file.eof()) return false;
+        if (binary.empty()) return false;
+
+        return shader.loadBinary(format, binary.data(), (int)binary.size());
+    }
+
+    static void saveCached(const Shader& shader, const std::string& path) {
+        int length = 0;
+        glGetProgramiv(shader.ID, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0) return;
+
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        glGetProgramBinary(shader.ID, length, NULL, &format, binary.data());
+
+        std::error_code error;
+        std::filesystem::create_directories(CACHE_DIRECTORY, error);
+        std::ofstream file(path, std::ios::binary);
+        if (!file) {
+            logger.log(LOG_ERROR, "ERROR::SHADER::CACHE_NOT_WRITABLE %s", path.c_str());
+            return;
+        }
+        file.write((const char*)&format, sizeof(format));
+        file.write(binary.data(), binary.size());
+    }
+};
+
+#endif
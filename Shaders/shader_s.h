@@ -2,59 +2,44 @@
 #define SHADER_H
 
 #include <glad/glad.h>
+#include <glState.h>
+#include <logger.h>
 
 #include <string>
 #include <fstream>
 #include <sstream>
-#include <iostream>
 
 class Shader{
 public:
     // Program ID
-    unsigned int ID;
+    unsigned int ID = 0;
+
+    // Empty; compile() or loadBinary() fills it in
+    Shader() = default;
 
     // Constructor
     Shader(const char* vertexPath, const char* fragmentPath){
 
         // VERTEX AND FRAGMENT SOURCE CODE //
-        std::string vertexCode;
-        std::string fragmentCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-
-        // Check ifstream Objects Can Throw Exceptions
-        vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        try{
-            // Open
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-
-            // Read Buffer Contents into Stream
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();
-
-            // Close
-            vShaderFile.close();
-            fShaderFile.close();
-
-            // Convert Stream to String
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();
-        }
-        catch(std::ifstream::failure e){
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
-        }
+        std::string vertexCode = readFile(vertexPath);
+        std::string fragmentCode = readFile(fragmentPath);
 
-        const char* vShaderCode = vertexCode.c_str();
-        const char* fShaderCode = fragmentCode.c_str();
+        compile(vertexCode.c_str(), fragmentCode.c_str());
+    }
 
+    // Compile and link from source; returns false (after logging) on failure
+    bool compile(const char* vShaderCode, const char* fShaderCode, bool retrievable = false){
         // COMPILE SHADERS //
         unsigned int vertex, fragment;
         int success;
         char infoLog[512];
 
+        // The shaders are written for 4.6 but use nothing newer than 4.5
+        std::string vertexSource = matchContextVersion(vShaderCode);
+        std::string fragmentSource = matchContextVersion(fShaderCode);
+        vShaderCode = vertexSource.c_str();
+        fShaderCode = fragmentSource.c_str();
+
         // Vertex
         vertex = glCreateShader(GL_VERTEX_SHADER);
         glShaderSource(vertex, 1, &vShaderCode, NULL);
@@ -63,7 +48,7 @@ public:
         glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
         if(!success){
             glGetShaderInfoLog(vertex, 512, NULL, infoLog);
-            std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
+            logger.log(LOG_ERROR, "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n%s", infoLog);
         }
 
         // Fragment
@@ -74,11 +59,14 @@ public:
         glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
         if(!success){
             glGetShaderInfoLog(fragment, 512, NULL, infoLog);
-            std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
+            logger.log(LOG_ERROR, "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n%s", infoLog);
         }
 
         // Shader Program
         ID = glCreateProgram();
+        if(retrievable){
+            glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
         glAttachShader(ID, vertex);
         glAttachShader(ID, fragment);
         glLinkProgram(ID);
@@ -86,37 +74,98 @@ public:
         glGetProgramiv(ID, GL_LINK_STATUS, &success);
         if(!success){
             glGetProgramInfoLog(ID, 512, NULL, infoLog);
-            std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+            logger.log(LOG_ERROR, "ERROR::SHADER::PROGRAM::LINKING_FAILED\n%s", infoLog);
         }
 
         glDeleteShader(vertex);
         glDeleteShader(fragment);
+        return success;
+    }
+
+    // Link from a driver binary saved earlier; fails quietly if the driver rejects it
+    bool loadBinary(GLenum format, const void* binary, int length){
+        ID = glCreateProgram();
+        glProgramBinary(ID, format, binary, length);
+
+        int success;
+        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+        if(!success){
+            glDeleteProgram(ID);
+            ID = 0;
+        }
+        return success;
+    }
+
+    // On a 4.5 context (Mesa's llvmpipe, for headless runs) #version 460 becomes 450
+    static std::string matchContextVersion(const char* source){
+        static const int contextVersion = [] {
+            int major = 0, minor = 0;
+            glGetIntegerv(GL_MAJOR_VERSION, &major);
+            glGetIntegerv(GL_MINOR_VERSION, &minor);
+            return major * 100 + minor * 10;
+        }();
+
+        std::string code = source;
+        const std::string version460 = "#version 460";
+        if (contextVersion < 460 && code.compare(0, version460.size(), version460) == 0) {
+            code.replace(0, version460.size(), "#version 450");
+        }
+        return code;
+    }
+
+    // Whole file as a string (empty, after logging, if it cannot be read)
+    static std::string readFile(const char* path){
+        std::ifstream file;
+
+        // Check ifstream Objects Can Throw Exceptions
+        file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+        try{
+            file.open(path);
+            std::stringstream stream;
+            stream << file.rdbuf();
+            file.close();
+            return stream.str();
+        }
+        catch(std::ifstream::failure& e){
+            logger.log(LOG_ERROR, "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ %s", path);
+        }
+        return "";
     }
 
     // Activate Shader
     void use(){
-        glUseProgram(ID);
+        glState.useProgram(ID);
     }
 
-    // Utility Uniform Functions
-    void setBool(const std::string &name, bool value) const{
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+    // Utility Uniform Functions (C string names, so literals don't build a std::string per call)
+    void setBool(const char* name, bool value) const{
+        glUniform1i(glGetUniformLocation(ID, name), (int)value);
     }
-    void setInt(const std::string &name, int value) const{
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+    void setInt(const char* name, int value) const{
+        glUniform1i(glGetUniformLocation(ID, name), (int)value);
     }
-    void setFloat(const std::string &name, float value) const{
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+    void setFloat(const char* name, float value) const{
+        glUniform1f(glGetUniformLocation(ID, name), value);
     }
-    void setMat4(const std::string &name, const glm::mat4 &mat) const
+    void setMat3(const char* name, const glm::mat3 &mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix3fv(glGetUniformLocation(ID, name), 1, GL_FALSE, &mat[0][0]);
+    }
+    void setMat4(const char* name, const glm::mat4 &mat) const
+    {
+        glUniformMatrix4fv(glGetUniformLocation(ID, name), 1, GL_FALSE, &mat[0][0]);
+    }
+    void setVec2(const char* name, glm::vec2 value) const {
+        glUniform2f(glGetUniformLocation(ID, name), value.x, value.y);
+    }
+    void setUVec3(const char* name, unsigned int v0, unsigned int v1, unsigned int v2) const {
+        glUniform3ui(glGetUniformLocation(ID, name), v0, v1, v2);
     }
-    void setVec3(const std::string &name, float v0, float v1, float v2) const {
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), v0, v1, v2);
+    void setVec3(const char* name, float v0, float v1, float v2) const {
+        glUniform3f(glGetUniformLocation(ID, name), v0, v1, v2);
     }
-    void setVec3(const std::string &name, glm::vec3 value) const {
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), value.x, value.y, value.z);
+    void setVec3(const char* name, glm::vec3 value) const {
+        glUniform3f(glGetUniformLocation(ID, name), value.x, value.y, value.z);
     }
 
 };
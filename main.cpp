@@ -1,9 +1,17 @@
 #include <iostream>
 #include <cmath>
+#include <algorithm>
+#include <string>
+#include <cstdlib>
+#include <chrono>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
+// Counting operator new (before anything else includes the header)
+#define HEAP_COUNTERS_IMPLEMENTATION
+#include "heapCounters.h"
+
 #include <glm.hpp>
 #include <gtc/matrix_transform.hpp>
 #include <gtc/type_ptr.hpp>
@@ -13,22 +21,93 @@
 #include "fixedCamera.h"
 #include "orbitCamera.h"
 #include "model.h"
+#include "glState.h"
+#include "frustum.h"
+#include "bvh.h"
+#include "occlusion.h"
+#include "lightClusters.h"
+#include "gBuffer.h"
+#include "depthPrepass.h"
+#include "shadowMaps.h"
+#include "headlessContext.h"
+#include "sceneGraph.h"
+#include "rideKinematics.h"
+#include "rideSimulation.h"
+#include "stressScene.h"
+#include "jobSystem.h"
+#include "frameArena.h"
+#include "frameStats.h"
+#include "profiler.h"
+#include "gpuProfiler.h"
+#include "perfHud.h"
+#include "statsExporter.h"
+#include "hitchDetector.h"
+#include "logger.h"
+#include "inputRecorder.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-bool isInsideBox(glm::vec3 position, glm::vec3 boxMin, glm::vec3 boxMax);
+bool isBlocked(glm::vec3 position);
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void zoom_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
 void processInput(GLFWwindow *window);
-void processPositions(vector<Model>&(carts));
+void processPositions(vector<Model>&(carts), float rideAngle);
+void setLightUniforms(Shader& shader);
+const char* cameraName(const Camera* camera);
+std::string formatVec3(const glm::vec3& v);
 unsigned int loadTexture(const char *path);
 
 // Settings
 const unsigned int SCR_WIDTH = 1920;
 const unsigned int SCR_HEIGHT = 1080;
+const float NEAR_PLANE = 0.1f;
+const float FAR_PLANE = 100.0f;
+int framebufferWidth = SCR_WIDTH;
+int framebufferHeight = SCR_HEIGHT;
+
+// Renderer (forward by default, --deferred on the command line for the G-buffer path)
+bool deferredShading = false;
+Prepass_Mode prepassMode = PREPASS_AUTO;    // --prepass / --no-prepass override the overdraw measurement
+bool shadowsEnabled = true;                 // --no-shadows
+double simulationRate = 60.0;               // --sim-hz N: ride ticks per second
+bool simulationThread = false;              // --sim-thread: tick on a separate thread
+int workerCount = -1;                       // --workers N: job system threads besides the main one
+
+// Benchmark (--headless: offscreen, scripted timeline, timings written as JSON)
+bool headless = false;
+unsigned int benchmarkFrames = 600;         // --frames N
+unsigned int warmupFrames = 30;             // --warmup N: not recorded (shader builds, caches)
+std::string benchmarkOutput = "benchmark.json";     // --json FILE
+
+// Profiler captures (--trace N, or P in the window): N frames as a Chrome trace
+const unsigned int TRACE_KEY_FRAMES = 120;
+unsigned int traceFrames = 0;
+std::string traceOutput = "trace.json";     // --trace-file FILE
+
+// Performance HUD (H in the window, --hud to start with it on)
+bool hudVisible = false;
+bool keyHPressed = false;
+
+// Stats export for unattended machines (see StatsExporter)
+std::string statsFile;                      // --stats-file FILE: memory-mapped stats page
+unsigned int statsPort = 0;                 // --stats-port N: Prometheus text on 127.0.0.1:N/metrics
+double hitchThresholdMs = 50.0;             // --hitch-ms MS
+std::string hitchCaptureDir;                // --hitch-capture DIR: a trace of the seconds before each hitch (see HitchDetector)
+
+// Logging (written by a background thread; stdout unless redirected)
+const char* logOutput = nullptr;            // --log-file FILE
+const char* metricsOutput = nullptr;        // --metrics-file FILE: sampled frame stats, else with the log
+
+// Stress scene (--stress-wheels N, --stress-carts M, --stress-props K, --stress-lights L,
+// --stress-layout grid|random, --stress-seed S): extra instances around the hand-built scene
+StressSettings stressSettings;
+
+// Input recording (--record FILE, windowed only) and replay (--replay FILE: same frames again, frame stats as JSON)
+std::string inputRecordPath;
+std::string inputReplayPath;
 
 // Cameras
 Camera camera(glm::vec3(0.0f, 10.0f, 0.0f));
@@ -49,6 +128,18 @@ const float sensitivity = 0.5f;
 
 glm::vec3 boxMin = glm::vec3(-15.5f, -3, -20.5);
 glm::vec3 boxMax = glm::vec3(15.5f, 3, 20.5);
+const float cameraRadius = 0.3f;
+
+// Scene (world-space bounds of every instance, shared by culling and collision)
+BVH sceneBvh;
+std::vector<bool> solidInstances;
+
+// Lights (shared by the shading uniforms and the shadow maps)
+const glm::vec3 dirLightDirection = glm::vec3(-0.2f, -1.0f, -0.3f);
+const glm::vec3 spotLightRidePosition = glm::vec3(15.0f, 10.0f, 0.0f);
+const glm::vec3 spotLightRideDirection = glm::vec3(-0.5f, -1.0f, 0.0f);
+const float spotLightRideOuterCutOff = 20.0f;
+const float spotLightTorchOuterCutOff = 30.0f;
 
 // Torch
 bool spotLightOn = false;
@@ -58,94 +149,258 @@ bool torchKeyPress = false;
 float rideSpeed = 5.0f;
 bool rideStart = false;
 bool keyEPressed = false;
+bool keyPPressed = false;
 float rideRadius = 12.0f;
 float rideHeight = 18.0f;
 glm::vec3 rideCenter = glm::vec3(0.0f, 18.0f, 0.0f);
-float theta = 0.0f;
-float rideFixedCamAngle = 0.0f;
 
-// Timing
+// Timing (frame times in double so they stay precise after days of running)
 float deltaTime = 0.0f;
-float lastFrame = 0.0f;
+double lastFrame = 0.0;
 float m_secondCounter;
 float m_tempFps;
 float fps;
+unsigned long long frameAllocations = 0;    // Heap allocations made by the last frame's update and draw
+
+int main(int argc, char* argv[]) {
+    std::chrono::steady_clock::time_point processStart = std::chrono::steady_clock::now();
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--deferred") {
+            deferredShading = true;
+        }
+        else if (arg == "--prepass") {
+            prepassMode = PREPASS_ALWAYS;
+        }
+        else if (arg == "--no-prepass") {
+            prepassMode = PREPASS_NEVER;
+        }
+        else if (arg == "--no-shadows") {
+            shadowsEnabled = false;
+        }
+        else if (arg == "--sim-hz" && i + 1 < argc) {
+            simulationRate = std::max(std::atof(argv[++i]), 1.0);
+        }
+        else if (arg == "--sim-thread") {
+            simulationThread = true;
+        }
+        else if (arg == "--workers" && i + 1 < argc) {
+            workerCount = std::max(std::atoi(argv[++i]), 0);
+        }
+        else if (arg == "--headless") {
+            headless = true;
+        }
+        else if (arg == "--frames" && i + 1 < argc) {
+            benchmarkFrames = (unsigned int)std::max(std::atoi(argv[++i]), 1);
+        }
+        else if (arg == "--warmup" && i + 1 < argc) {
+            warmupFrames = (unsigned int)std::max(std::atoi(argv[++i]), 0);
+        }
+        else if (arg == "--json" && i + 1 < argc) {
+            benchmarkOutput = argv[++i];
+        }
+        else if (arg == "--trace" && i + 1 < argc) {
+            traceFrames = (unsigned int)std::max(std::atoi(argv[++i]), 1);
+        }
+        else if (arg == "--trace-file" && i + 1 < argc) {
+            traceOutput = argv[++i];
+        }
+        else if (arg == "--hud") {
+            hudVisible = true;
+        }
+        else if (arg == "--stats-file" && i + 1 < argc) {
+            statsFile = argv[++i];
+        }
+        else if (arg == "--stats-port" && i + 1 < argc) {
+            statsPort = (unsigned int)std::max(std::atoi(argv[++i]), 0);
+        }
+        else if (arg == "--hitch-ms" && i + 1 < argc) {
+            hitchThresholdMs = std::max(std::atof(argv[++i]), 1.0);
+        }
+        else if (arg == "--hitch-capture" && i + 1 < argc) {
+            hitchCaptureDir = argv[++i];
+        }
+        else if (arg == "--log-file" && i + 1 < argc) {
+            logOutput = argv[++i];
+        }
+        else if (arg == "--metrics-file" && i + 1 < argc) {
+            metricsOutput = argv[++i];
+        }
+        else if (arg == "--stress-wheels" && i + 1 < argc) {
+            stressSettings.wheels = (unsigned int)std::max(std::atoi(argv[++i]), 0);
+        }
+        else if (arg == "--stress-carts" && i + 1 < argc) {
+            stressSettings.cartsPerWheel = (unsigned int)std::max(std::atoi(argv[++i]), 0);
+        }
+        else if (arg == "--stress-props" && i + 1 < argc) {
+            stressSettings.props = (unsigned int)std::max(std::atoi(argv[++i]), 0);
+        }
+        else if (arg == "--stress-lights" && i + 1 < argc) {
+            stressSettings.lights = (unsigned int)std::max(std::atoi(argv[++i]), 0);
+        }
+        else if (arg == "--stress-layout" && i + 1 < argc) {
+            stressSettings.layout = std::string(argv[++i]) == "random" ? STRESS_RANDOM : STRESS_GRID;
+        }
+        else if (arg == "--stress-seed" && i + 1 < argc) {
+            stressSettings.seed = (unsigned int)std::atoi(argv[++i]);
+        }
+        else if (arg == "--record" && i + 1 < argc) {
+            inputRecordPath = argv[++i];
+        }
+        else if (arg == "--replay" && i + 1 < argc) {
+            inputReplayPath = argv[++i];
+        }
+    }
+
+    logger.open(logOutput, metricsOutput);
+    if (!inputReplayPath.empty()) {
+        if (!inputRecorder.startReplay(inputReplayPath)) return -1;
+        if (simulationThread) {
+            logger.log(LOG_WARNING, "Replay: --sim-thread ticks on real time, so runs will differ");
+        }
+    }
+    else if (!inputRecordPath.empty()) {
+        // Headless runs follow a camera script and start the ride on their own; neither is
+        // input, so a replay of the recording would run differently
+        if (headless) {
+            logger.log(LOG_ERROR, "ERROR::INPUT::RECORD_NOT_SUPPORTED_HEADLESS");
+            return -1;
+        }
+        inputRecorder.startRecording(inputRecordPath);
+    }
+
+    statsExporter.hitchThresholdMs = hitchThresholdMs;
+    if (!statsFile.empty()) {
+        statsExporter.openFile(statsFile);
+    }
+    if (statsPort > 0) {
+        statsExporter.listen(statsPort);
+    }
+
+    profiler.setThreadName("Main");
+    if (traceFrames > 0) {
+        profiler.capture(traceFrames, traceOutput);
+    }
+
+    HitchDetector hitchDetector;
+    hitchDetector.thresholdMs = hitchThresholdMs;
+    if (!hitchCaptureDir.empty()) {
+        hitchDetector.start(hitchCaptureDir);
+    }
+
+    HeadlessContext headlessContext(4, 6);
+    if (headless) {
+        HeadlessContext::selectPlatform();
+    }
 
-int main() {
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
-    // Create window in OS
-    GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Ferris Wheel", NULL, NULL);
+    // Create window in OS (or an offscreen context)
+    GLFWwindow* window = headless ? headlessContext.createWindow(SCR_WIDTH, SCR_HEIGHT, "Ferris Wheel")
+                                  : glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Ferris Wheel", NULL, NULL);
     if (window == NULL)
     {
-        std::cout << "Failed to create GLFW window" << std::endl;
+        logger.log(LOG_ERROR, "Failed to create GLFW window");
         glfwTerminate();
         return -1;
     }
-    glfwMakeContextCurrent(window);
+    if (!headless) {
+        glfwMakeContextCurrent(window);
+    }
 
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    if (!gladLoadGLLoader(headless ? headlessContext.loader() : (GLADloadproc)glfwGetProcAddress))
     {
-        std::cout << "Failed to initialize GLAD" << std::endl;
+        logger.log(LOG_ERROR, "Failed to initialize GLAD");
         return -1;
     }
 
+    glState.invalidate();
+    glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+    if (headless) {
+        framebufferWidth = SCR_WIDTH;
+        framebufferHeight = SCR_HEIGHT;
+        if (!headlessContext.createFramebuffer(framebufferWidth, framebufferHeight)) {
+            glfwTerminate();
+            return -1;
+        }
+    }
+
     // Callback
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-    glfwSetCursorPosCallback(window, mouse_callback);
-    glfwSetScrollCallback(window, scroll_callback);
-    glfwSetKeyCallback(window, zoom_callback);
+    inputRecorder.setCallbacks(window, mouse_callback, scroll_callback, zoom_callback);
 
     // GL Settings
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
     stbi_set_flip_vertically_on_load(true);
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
-
-    // Shader
-    Shader ourShader("Shaders/light.multiple.shader.vs", "Shaders/light.multiple.shader.fs");
+    glState.enable(GL_DEPTH_TEST);
+    glState.enable(GL_CULL_FACE);
+    glState.cullFace(GL_BACK);
+
+    // Shader (variants compile on first use, or load from ShaderCache/)
+    ShaderVariants forwardShaders("Shaders/light.multiple.shader.vs", "Shaders/light.multiple.shader.fs", ~0u);
+    ShaderVariants geometryShaders("Shaders/light.multiple.shader.vs", "Shaders/gbuffer.shader.fs", FEATURE_TEXTURED | FEATURE_NORMAL_MAP);
+    ShaderVariants lightingShaders("Shaders/light.deferred.shader.vs", "Shaders/light.deferred.shader.fs",
+                                   FEATURE_DIR_LIGHT | FEATURE_POINT_LIGHTS | FEATURE_SPOT_RIDE | FEATURE_SPOT_TORCH | FEATURE_SHADOWS);
+    GBuffer gBuffer;
+    DepthPrepass depthPrepass;
+    depthPrepass.mode = prepassMode;
+    ShadowMaps shadowMaps;
+    shadowMaps.enabled = shadowsEnabled;
+    PerfHud perfHud;
+
+    // Jobs (the main thread takes part and runs the GL jobs)
+    JobSystem jobs(workerCount >= 0 ? (unsigned int)workerCount : JobSystem::defaultWorkerCount());
 
     // LOAD SCENE //
+    std::chrono::steady_clock::time_point loadStart = std::chrono::steady_clock::now();
+
+    // Textures decode on the workers while the models load
+    JobCounter texturesLoaded;
+
+    // Transforms (base -> wheel -> spokes -> carts; props are roots)
+    SceneGraph sceneGraph;
 
     // Extra Models
-    Model ourModel("Resources/Models/backpack/backpack.obj");
+    Model ourModel("Resources/Models/backpack/backpack.obj", &jobs, &texturesLoaded);
     ourModel.setRotation(glm::vec3(-90.0f, 20.0f, 0.0f));
     ourModel.setPosition(glm::vec3(-9.0f, 3.2f, 14.0f));
+    ourModel.attach(sceneGraph, sceneGraph.addNode());
 
 
     // Ride
-    Model base("Resources/Models/ferris_wheel_base/ferris_wheel_base.obj");
-    Model wheel("Resources/Models/ferris_wheel/ferris_wheel.obj");
+    Model base("Resources/Models/ferris_wheel_base/ferris_wheel_base.obj", &jobs, &texturesLoaded);
+    Model wheel("Resources/Models/ferris_wheel/ferris_wheel.obj", &jobs, &texturesLoaded);
     base.setPosition(glm::vec3(0.0f, 0.0f, 0.0f));
     wheel.setPosition(glm::vec3(0.0f, 18.0f, 0.0f));
     wheel.setRotation(glm::vec3(0.0f, 0.0f, 0.0f));
+    base.occluder = true;
+    wheel.occluder = true;
+    base.attach(sceneGraph, sceneGraph.addNode());
+    wheel.attach(sceneGraph, sceneGraph.addNode(base.getNode()));
 
 
-    // Carts
-    std::vector<glm::vec3> cartPos = {
-            glm::vec3(0.0f, 5.0f, 0.0f),
-            glm::vec3(0.0f, 17.0f, -12.0f),
-            glm::vec3(0.0f, 29.0f, 0.0f),
-            glm::vec3(0.0f, 17.0f, 12.0f)
-    };
-    std::vector<float> cartAngles = {
-            0.0f,
-            90.0f,
-            180.0f,
-            270.0f
-    };
+    // Carts (hang level below the spoke tips; the kinematics sweep places them)
     std::vector<Model> carts = {
-            Model ("Resources/Models/ferris_wheel_cart/Crate1.obj"),
-            Model ("Resources/Models/ferris_wheel_cart/Crate1.obj"),
-            Model ("Resources/Models/ferris_wheel_cart/Crate1.obj"),
-            Model ("Resources/Models/ferris_wheel_cart/Crate1.obj")
+            Model ("Resources/Models/ferris_wheel_cart/Crate1.obj", &jobs, &texturesLoaded),
+            Model ("Resources/Models/ferris_wheel_cart/Crate1.obj", &jobs, &texturesLoaded),
+            Model ("Resources/Models/ferris_wheel_cart/Crate1.obj", &jobs, &texturesLoaded),
+            Model ("Resources/Models/ferris_wheel_cart/Crate1.obj", &jobs, &texturesLoaded)
     };
-    for (int i = 0; i < cartPos.size(); i++){
-        carts[i].setPosition(cartPos[i]);
+    RideKinematics rideKinematics;
+    unsigned int firstCartNode = sceneGraph.addDrivenNodes(wheel.getNode(), carts.size());
+    for (int i = 0; i < carts.size(); i++){
+        carts[i].attach(sceneGraph, firstCartNode + i);
+    }
+    rideKinematics.addRide(wheel.getNode(), firstCartNode, carts.size(), rideRadius, 0.0f, 1.0f);
+
+    // Ride motion runs at a fixed tick rate; frames draw a blend of the last two ticks
+    RideSimulation rideSimulation(simulationRate, rideSpeed);
+    if (simulationThread) {
+        rideSimulation.startThread();
     }
 
     // Containers
@@ -164,44 +419,126 @@ int main() {
             glm::vec3(0.00f, -30.0f, 0.0f),
     };
     std::vector<Model> containers = {
-            Model ("Resources/Models/container/Crate1.obj"),
-            Model ("Resources/Models/container/Crate1.obj"),
-            Model ("Resources/Models/container/Crate1.obj"),
-            Model ("Resources/Models/container/Crate1.obj"),
-            Model ("Resources/Models/container/Crate1.obj"),
+            Model ("Resources/Models/container/Crate1.obj", &jobs, &texturesLoaded),
+            Model ("Resources/Models/container/Crate1.obj", &jobs, &texturesLoaded),
+            Model ("Resources/Models/container/Crate1.obj", &jobs, &texturesLoaded),
+            Model ("Resources/Models/container/Crate1.obj", &jobs, &texturesLoaded),
+            Model ("Resources/Models/container/Crate1.obj", &jobs, &texturesLoaded),
     };
     for(int i = 0; i < containerPos.size(); i++){
         containers[i].setPosition(containerPos[i]);
         containers[i].setRotation(containerRot[i]);
+        containers[i].attach(sceneGraph, sceneGraph.addNode());
     }
 
+    // Stress Scene (instances of the models above)
+    StressScene stressScene;
+    if (stressSettings.enabled()) {
+        stressScene.build(stressSettings, base, wheel, carts[0], containers[0], rideRadius, sceneGraph, rideKinematics);
+        logger.log(LOG_INFO, "Stress scene: %s (%zu instances)", stressSettings.describe().c_str(), stressScene.models.size());
+    }
+    sceneGraph.update();
+    rideKinematics.update(sceneGraph, jobs);
+    jobs.wait(texturesLoaded);
+
     glm::vec3 lightColor(1.0f, 1.0f, 1.0f); // white light
 
-    // Point Lights
-    ourShader.use();
-    for (int i = 0; i < cartPos.size(); i++) {
-        std::string base = "pointLights[" + std::to_string(i) + "]";
-        ourShader.setVec3(base + ".position", cartPos[i]);
-        ourShader.setVec3(base + ".ambient", 0.1f * lightColor);
-        ourShader.setVec3(base + ".diffuse", 0.8f * lightColor);
-        ourShader.setVec3(base + ".specular", 1.0f * lightColor);
-        ourShader.setFloat(base + ".constant", 1.0f);
-        ourShader.setFloat(base + ".linear", 0.09f);
-        ourShader.setFloat(base + ".quadratic", 0.032f);
-    }
-
-    // Camera Settings
-    orbitCamera.setRadius(30.0f);
+    // Point Lights (one per cart, culled into view-space clusters every frame)
+    LightClusters lightClusters;
+    for (int i = 0; i < carts.size(); i++) {
+        PointLight light;
+        light.position = carts[i].getWorldPosition();
+        light.ambient = 0.1f * lightColor;
+        light.diffuse = 0.8f * lightColor;
+        light.specular = 1.0f * lightColor;
+        light.constant = 1.0f;
+        light.linear = 0.09f;
+        light.quadratic = 0.032f;
+        lightClusters.lights.push_back(light);
+    }
+    lightClusters.lights.insert(lightClusters.lights.end(), stressScene.lights.begin(), stressScene.lights.end());
+
+    // Every drawable instance, in draw order
+    std::vector<Model*> sceneModels = {&base, &wheel, &ourModel};
+    std::vector<unsigned int> movingModels = {1};
+    std::vector<unsigned int> solidModels;
+    for (Model& container : containers) {
+        solidModels.push_back(sceneModels.size());
+        sceneModels.push_back(&container);
+    }
+    for (Model& cart : carts) {
+        movingModels.push_back(sceneModels.size());
+        sceneModels.push_back(&cart);
+    }
+    for (unsigned int i = 0; i < stressScene.models.size(); i++) {
+        if (stressScene.isMoving(i)) movingModels.push_back(sceneModels.size());
+        if (stressScene.isSolid(i)) solidModels.push_back(sceneModels.size());
+        sceneModels.push_back(&stressScene.models[i]);
+    }
+
+    // Props block the free camera; the ride itself is covered by the collision box
+    std::vector<AABB> instanceBounds;
+    for (Model* model : sceneModels) {
+        instanceBounds.push_back(model->getWorldBounds());
+    }
+    solidInstances.assign(sceneModels.size(), false);
+    for (unsigned int index : solidModels) {
+        solidInstances[index] = true;
+    }
+
+    // Only moving instances are redrawn into the shadow maps each update
+    std::vector<bool> dynamicInstances(sceneModels.size(), false);
+    for (unsigned int index : movingModels) {
+        dynamicInstances[index] = true;
+    }
+    sceneBvh.build(instanceBounds);
+
+    // Model and normal matrices of every instance, rebuilt in one batch each frame
+    std::vector<glm::mat4> modelMatrices(sceneModels.size());
+    std::vector<glm::mat3> normalMatrices(sceneModels.size());
+    const unsigned int INSTANCES_PER_JOB = 1024;
+    OcclusionCuller occlusionCuller(jobs);
+
+    // Camera Settings (the orbit takes in as much of a stress scene as the far plane allows)
+    orbitCamera.setRadius(std::clamp(stressScene.extent, 30.0f, FAR_PLANE * 0.6f));
     orbitCamera.setHeight(30.0f);
 
+    // Benchmark: the ride runs from the start and the cameras take turns (a replay drives both itself)
+    bool replaying = inputRecorder.isReplaying();
+    bool recordStats = headless || replaying;
+    FrameStats frameStats(replaying ? inputRecorder.replayFrames() : benchmarkFrames);
+    unsigned int frameIndex = 0;
+    Camera* benchmarkCameras[] = {&camera, &fixedCamera, &rideFreeCamera, &orbitCamera};
+    if (headless && !replaying) {
+        rideStart = true;
+    }
+
+    std::chrono::steady_clock::time_point loopStart = std::chrono::steady_clock::now();
+    statsExporter.setLoadTimes(std::chrono::duration<double>(loopStart - processStart).count(),
+                               std::chrono::duration<double>(loopStart - loadStart).count());
+
     // Main Loop
     while(!glfwWindowShouldClose(window))
     {
+        profiler.beginFrame();
+        gpuProfiler.beginFrame();
+        hitchDetector.beginFrame();
+        PROFILE_PASS("Frame");
+
         // Per-Frame Logic
-        float currentFrame = static_cast<float>(glfwGetTime());
-        deltaTime = currentFrame - lastFrame;
+        double currentFrame = glfwGetTime();
+        double frameSeconds = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
+        // Benchmark steps are fixed, so every run renders the same frames
+        if (headless && !replaying) {
+            frameSeconds = 1.0 / simulationRate;
+            currentCamera = benchmarkCameras[std::min(frameIndex * 4 / (warmupFrames + benchmarkFrames), 3u)];
+        }
+        if (!inputRecorder.beginFrame(frameSeconds)) break;
+        deltaTime = static_cast<float>(frameSeconds);
+        frameStats.beginFrame();
+
         if (m_secondCounter <= 1) {
             m_secondCounter += deltaTime;
             m_tempFps++;
@@ -212,103 +549,265 @@ int main() {
             fps = m_tempFps;
             m_secondCounter = 0;
             m_tempFps = 0;
+
+            // Sampled once a second; the last frame's counters stand for the rest
+            if (!headless) {
+                logger.metric("frame", {{"fps", fps}, {"frameMs", fps > 0.0f ? 1000.0 / fps : 0.0},
+                                        {"drawCalls", (double)glState.drawCalls}, {"heapAllocations", (double)frameAllocations},
+                                        {"droppedLogMessages", (double)logger.droppedMessages.load(std::memory_order_relaxed)}});
+            }
         }
 
-        //Do something with the fps
-        std::cout << "FPS: " << fps << std::endl;
+        glState.resetCounters();
+        frameArena.beginFrame();
+        unsigned long long allocationsBefore = HeapCounters::allocations.load(std::memory_order_relaxed);
+
+        // Render lists for this frame (arena memory, no heap)
+        FrameVector<unsigned int> visibleModels{ArenaAllocator<unsigned int>(frameArena)};
+        FrameVector<unsigned int> casterModels{ArenaAllocator<unsigned int>(frameArena)};
+        visibleModels.reserve(sceneModels.size());
+        casterModels.reserve(sceneModels.size());
 
         // Input
         processInput(window);
-        processPositions(carts);
+
+        // Simulation
+        rideSimulation.setRunning(rideStart);
+        rideSimulation.advance(frameSeconds);
+        float rideAngle = rideSimulation.wheelAngle();
+        if (rideAngle != wheel.getRotation().x) {
+            // Only dirty the wheel's subtree (and its carts) when the ride actually turned
+            wheel.setRotation(glm::vec3(rideAngle, 0.0f, 0.0f));
+        }
+        stressScene.update(rideAngle);
+
+        // World matrices (only the wheel's subtree moves), carts carry their lights
+        frameStats.beginStage(STAGE_SCENE);
+        sceneGraph.update();
+        rideKinematics.update(sceneGraph, jobs);
+        for (int i = 0; i < carts.size(); i++){
+            lightClusters.lights[i].position = carts[i].getWorldPosition();
+        }
+
+        // Cameras follow this frame's cart
+        processPositions(carts, rideAngle);
 
         // Background
         glClearColor(0.2f, 0.3f, 0.3f, 1.0f); // Set clear colour
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // Clear to colour previously set
 
-        // Start Shader
-        ourShader.use();
-        ourShader.setVec3("viewPos", currentCamera->Position);
-        ourShader.setFloat("material.shininess", 64.0f);
-
-
         // View and Projection Transformation
-        glm::mat4 projection = glm::perspective(glm::radians(currentCamera->Fov), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+        glm::mat4 projection = glm::perspective(glm::radians(currentCamera->Fov), (float)SCR_WIDTH / (float)SCR_HEIGHT, NEAR_PLANE, FAR_PLANE);
         glm::mat4 view = currentCamera->GetViewMatrix();
-        ourShader.setMat4("projection", projection);
-        ourShader.setMat4("view", view);
 
-        if(rideStart){
-            wheel.rotate(glm::vec3(rideSpeed * deltaTime, 0.0f, 0.0f));
-        }
+        lightClusters.build(view, projection, NEAR_PLANE, FAR_PLANE, framebufferWidth, framebufferHeight);
 
-        base.Draw(ourShader);
-        wheel.Draw(ourShader);
-        ourModel.Draw(ourShader);
+        // Only the lights that can reach something this frame are compiled into the shaders
+        unsigned int lightFeatures = FEATURE_DIR_LIGHT | FEATURE_SPOT_RIDE;
+        if (lightClusters.assignedLights > 0) lightFeatures |= FEATURE_POINT_LIGHTS;
+        if (spotLightOn) lightFeatures |= FEATURE_SPOT_TORCH;
+        if (shadowMaps.enabled) lightFeatures |= FEATURE_SHADOWS;
+
+        JobCounter matricesBuilt;
+        jobs.parallelFor(sceneModels.size(), INSTANCES_PER_JOB, [&](unsigned int begin, unsigned int end) {
+            PROFILE_SCOPE("Instance Matrices");
+            for (unsigned int i = begin; i < end; i++) {
+                modelMatrices[i] = sceneModels[i]->getModelMatrix();
+            }
+            computeNormalMatrices(modelMatrices.data() + begin, normalMatrices.data() + begin, end - begin);
+        }, matricesBuilt);
+        jobs.wait(matricesBuilt);
 
-        for(int i = 0; i < containerPos.size(); i++){
-            containers[i].Draw(ourShader);
+        // Refit the moving instances, then cull through the BVH
+        frameStats.beginStage(STAGE_CULLING);
+        {
+            PROFILE_SCOPE("BVH Refit");
+            for (unsigned int index : movingModels) {
+                sceneBvh.update(index, sceneModels[index]->getWorldBounds());
+            }
+            sceneBvh.refit();
         }
 
-        // Move Carts
-        for (int i = 0; i < cartPos.size(); i++){
-            std::string base = "pointLights[" + std::to_string(i) + "]";
-            if(rideStart){
-                cartAngles[i] += deltaTime * rideSpeed;
+        // Occluders are rasterised on the worker while the BVH is traversed
+        {
+            PROFILE_SCOPE("Occluder Setup");
+            occlusionCuller.clearOccluders();
+            for (Model* model : sceneModels) {
+                if (!model->occluder) continue;
+                glm::mat4 modelMatrix = model->getModelMatrix();
+                for (const Mesh& mesh : model->meshes) {
+                    if (mesh.indices.empty()) continue;
+                    occlusionCuller.addOccluder(&mesh.vertices[0].Position.x, sizeof(Vertex), mesh.indices.data(), mesh.indices.size(), modelMatrix);
+                }
+            }
+            occlusionCuller.beginFrame(projection * view);
+        }
 
-                glm::vec3 cartPosition;
-                cartPosition.x = 0.0f;
-                cartPosition.y = (rideCenter.y - 1.0f) + rideRadius * sin(glm::radians(-cartAngles[i]));
-                cartPosition.z = rideCenter.z + rideRadius * cos(glm::radians(-cartAngles[i]));
+        Frustum frustum = currentCamera->GetFrustum(projection);
+        sceneBvh.queryFrustum(frustum, visibleModels);
+        std::sort(visibleModels.begin(), visibleModels.end());
+
+        // Drop instances hidden behind the occluders
+        occlusionCuller.finishFrame();
+        visibleModels.erase(std::remove_if(visibleModels.begin(), visibleModels.end(), [&](unsigned int index) {
+            return !sceneModels[index]->occluder && !occlusionCuller.isVisible(sceneBvh.objectBounds(index));
+        }), visibleModels.end());
+
+        // Shadows (static casters come from each layer's cache)
+        frameStats.beginStage(STAGE_SHADOWS);
+        shadowMaps.setCascades(view, currentCamera->Fov, (float)SCR_WIDTH / (float)SCR_HEIGHT, NEAR_PLANE, dirLightDirection);
+        shadowMaps.setSpot(ShadowMaps::SPOT_RIDE_LAYER, spotLightRidePosition, spotLightRideDirection, spotLightRideOuterCutOff, true);
+        shadowMaps.setSpot(ShadowMaps::SPOT_TORCH_LAYER, currentCamera->Position, currentCamera->Front, spotLightTorchOuterCutOff, spotLightOn);
+        shadowMaps.update([&](const Frustum& lightFrustum, Shader& shader, bool dynamicCasters) {
+            casterModels.clear();
+            sceneBvh.queryFrustum(lightFrustum, casterModels);
+            for (unsigned int index : casterModels) {
+                if (dynamicInstances[index] == dynamicCasters) {
+                    sceneModels[index]->DrawDepth(shader, &lightFrustum);
+                }
+            }
+        }, framebufferWidth, framebufferHeight);
 
-                ourShader.setVec3(base + ".position", cartPosition);
+        frameStats.beginStage(STAGE_PREPASS);
+        if (deferredShading) {
+            gBuffer.resize(framebufferWidth, framebufferHeight);
+            gBuffer.beginGeometryPass();
+        }
 
-                carts[i].setPosition(cartPosition);
+        // Depth Pre-Pass (positions only, so the shading pass runs each pixel once)
+        if (depthPrepass.beginFrame()) {
+            PROFILE_PASS("Depth Prepass");
+            depthPrepass.beginDepthPass(projection, view);
+            for (unsigned int index : visibleModels) {
+                sceneModels[index]->DrawDepth(depthPrepass.depthShader, &frustum);
             }
+            depthPrepass.endDepthPass();
+        }
 
-            carts[i].Draw(ourShader);
+        // Per-frame uniforms, applied to each variant the first time it is used this frame
+        frameStats.beginStage(STAGE_SHADING);
+        forwardShaders.beginFrame([&](Shader& shader) {
+            PROFILE_SCOPE("Frame Uniforms");
+            shader.setVec3("viewPos", currentCamera->Position);
+            shader.setFloat("material.shininess", 64.0f);
+            shader.setMat4("projection", projection);
+            shader.setMat4("view", view);
+            lightClusters.bind(shader);
+            shadowMaps.bind(shader);
+            setLightUniforms(shader);
+        });
+        geometryShaders.beginFrame([&](Shader& shader) {
+            PROFILE_SCOPE("Frame Uniforms");
+            shader.setFloat("material.shininess", 64.0f);
+            shader.setMat4("projection", projection);
+            shader.setMat4("view", view);
+        });
+        lightingShaders.beginFrame([&](Shader& shader) {
+            PROFILE_SCOPE("Frame Uniforms");
+            shader.setVec3("viewPos", currentCamera->Position);
+            shader.setMat4("inverseProjection", glm::inverse(projection));
+            shader.setMat4("inverseView", glm::inverse(view));
+            lightClusters.bind(shader);
+            shadowMaps.bind(shader);
+            setLightUniforms(shader);
+        });
+
+        // Shading Pass (G-buffer writes when deferred)
+        ShaderVariants& sceneShaders = deferredShading ? geometryShaders : forwardShaders;
+        depthPrepass.beginShadingPass();
+        {
+            PROFILE_PASS("Shading Pass");
+            for (unsigned int index : visibleModels) {
+                sceneModels[index]->Draw(sceneShaders, lightFeatures, modelMatrices[index], normalMatrices[index], &frustum);
+            }
+        }
+        depthPrepass.endShadingPass();
+
+        frameStats.beginStage(STAGE_LIGHTING);
+        if (deferredShading) {
+            // Lighting Pass (once per pixel, only the lights of that pixel's cluster)
+            PROFILE_PASS("Lighting Pass");
+            gBuffer.beginLightingPass(lightingShaders.select(lightFeatures));
+            gBuffer.drawFullscreen();
         }
 
-        // LIGHTS //
+        // Performance HUD (the CPU stages are the last frame's, the counters this frame's)
+        frameStats.beginStage(STAGE_OVERLAY);
+        // Measured, not frameSeconds: headless and replay runs step the simulation at a fixed rate
+        if (frameStats.lastFrameMs() > 0.0) perfHud.addFrameTime(frameStats.lastFrameMs());
+        perfHud.visible = hudVisible;
+        if (perfHud.visible) {
+            PROFILE_PASS("HUD");
+            perfHud.draw(frameStats, frameAllocations, framebufferWidth, framebufferHeight);
+        }
 
-        // Directional
-        ourShader.setVec3("dirLight.direction", -0.2f, -1.0f, -0.3f);
-        ourShader.setVec3("dirLight.ambient", 0.1f, 0.1f, 0.1f);
-        ourShader.setVec3("dirLight.diffuse", 0.4f, 0.4f, 0.4f);
-        ourShader.setVec3("dirLight.specular", 0.5f, 0.5f, 0.5f);
+        frameAllocations = HeapCounters::allocations.load(std::memory_order_relaxed) - allocationsBefore;
 
-        // Spotlight (Ride)
-        ourShader.setVec3("spotLightRide.position", glm::vec3(15.0f, 10.0f, 0.0f));
-        ourShader.setVec3("spotLightRide.direction", glm::vec3(-0.5f, -1.0f, 0.0f));
-        ourShader.setVec3("spotLightRide.ambient", 0.0f, 0.0f, 0.0f);
-        ourShader.setVec3("spotLightRide.diffuse", 4.0f, 4.0f, 4.0f);
-        ourShader.setVec3("spotLightRide.specular", 0.5f, 0.5f, 0.5f);
-        ourShader.setFloat("spotLightRide.constant", 1.0f);
-        ourShader.setFloat("spotLightRide.linear", 0.09f);
-        ourShader.setFloat("spotLightRide.quadratic", 0.032f);
-        ourShader.setFloat("spotLightRide.cutOff", glm::cos(glm::radians(15.0f)));
-        ourShader.setFloat("spotLightRide.outerCutOff", glm::cos(glm::radians(20.0f)));
+        frameStats.beginStage(STAGE_FINISH);
+        glfwPollEvents();
+        inputRecorder.endFrame(window);
+        if (headless) {
+            PROFILE_SCOPE("GPU Finish");
+            headlessContext.endFrame();
+        }
+        else {
+            PROFILE_SCOPE("Swap");
+            glfwSwapBuffers(window);
+        }
 
-        // Spotlight (Torch)
-        ourShader.setVec3("spotLightTorch.position", currentCamera->Position);
-        ourShader.setVec3("spotLightTorch.direction", currentCamera->Front);
-        ourShader.setVec3("spotLightTorch.ambient", 0.0f, 0.0f, 0.0f);
-        ourShader.setVec3("spotLightTorch.diffuse", 4.0f, 4.0f, 4.0f);
-        ourShader.setVec3("spotLightTorch.specular", 0.5f, 0.5f, 0.5f);
-        ourShader.setFloat("spotLightTorch.constant", 1.0f);
-        ourShader.setFloat("spotLightTorch.linear", 0.09f);
-        ourShader.setFloat("spotLightTorch.quadratic", 0.032f);
-        if(spotLightOn){
+        frameStats.endFrame(glState.drawCalls, frameAllocations, recordStats && frameIndex >= warmupFrames);
+        if (statsExporter.isEnabled()) {
+            // Measured time: in headless and replay runs frameSeconds is the simulation step
+            statsExporter.recordFrame(frameStats.lastFrameMs() / 1000.0, glState.drawCalls, lightClusters.lights.size(), GpuMemory::textureBytes,
+                                      GpuMemory::bufferBytes, HeapCounters::allocations.load(std::memory_order_relaxed));
+        }
 
-            ourShader.setFloat("spotLightTorch.cutOff", glm::cos(glm::radians(25.0f)));
-            ourShader.setFloat("spotLightTorch.outerCutOff", glm::cos(glm::radians(30.0f)));
+        // Hitch Capture (the frames before this one, and what the scene looked like)
+        if (hitchDetector.endFrame(frameStats, glState, frameAllocations)) {
+            hitchDetector.capture({
+                {"camera", cameraName(currentCamera)},
+                {"cameraPosition", formatVec3(currentCamera->Position)},
+                {"cameraFront", formatVec3(currentCamera->Front)},
+                {"cameraFov", std::to_string(currentCamera->Fov)},
+                {"rideAngle", std::to_string(rideAngle)},
+                {"rideRunning", rideSimulation.isRunning() ? "yes" : "no"},
+                {"torch", spotLightOn ? "on" : "off"},
+                {"renderer", deferredShading ? "deferred" : "forward"},
+                {"shadows", shadowMaps.enabled ? "on" : "off"},
+                {"prepass", depthPrepass.mode == PREPASS_AUTO ? (depthPrepass.enabled ? "auto, on" : "auto, off")
+                                                              : (depthPrepass.mode == PREPASS_ALWAYS ? "on" : "off")},
+                {"overdraw", std::to_string(depthPrepass.overdraw)},
+                {"resolution", std::to_string(framebufferWidth) + "x" + std::to_string(framebufferHeight)},
+                {"instances", std::to_string(sceneModels.size())},
+                {"visibleInstances", std::to_string(visibleModels.size())},
+                {"pointLights", std::to_string(lightClusters.lights.size())},
+                {"stressScene", stressSettings.enabled() ? stressSettings.describe() : "off"},
+                {"threads", std::to_string(jobs.threadCount())},
+                {"glRenderer", (const char*)glGetString(GL_RENDERER)},
+            });
         }
-        else{
-            ourShader.setFloat("spotLightTorch.cutOff", glm::cos(glm::radians(0.0f)));
-            ourShader.setFloat("spotLightTorch.outerCutOff", glm::cos(glm::radians(0.0f)));
+        if (recordStats) {
+            if (++frameIndex >= warmupFrames + benchmarkFrames && !replaying) break;
+        }
+    }
+    inputRecorder.stop();
+    statsExporter.stop();
+
+    if (recordStats) {
+        frameStats.setInfo("renderer", deferredShading ? "deferred" : "forward");
+        frameStats.setInfo("shadows", shadowMaps.enabled ? "on" : "off");
+        frameStats.setInfo("resolution", std::to_string(framebufferWidth) + "x" + std::to_string(framebufferHeight));
+        frameStats.setInfo("threads", std::to_string(jobs.threadCount()));
+        frameStats.setInfo("glRenderer", (const char*)glGetString(GL_RENDERER));
+        frameStats.setInfo("stressScene", stressSettings.enabled() ? stressSettings.describe() : "off");
+        frameStats.setInfo("instances", std::to_string(sceneModels.size()));
+        frameStats.setInfo("pointLights", std::to_string(lightClusters.lights.size()));
+        for (const GpuProfiler::Timing& timing : gpuProfiler.timings()) {
+            frameStats.setGpuTiming(timing.name, timing.averageMs);
+        }
+        if (frameStats.writeJson(benchmarkOutput.c_str())) {
+            logger.log(LOG_INFO, "Benchmark: %u frames written to %s", frameStats.recordedFrames(), benchmarkOutput.c_str());
         }
-
-        glfwPollEvents();
-        glfwSwapBuffers(window);
     }
 
     glfwTerminate(); // Properly cleans up resources
@@ -317,13 +816,15 @@ int main() {
 
 void processInput(GLFWwindow *window)
 {
+    PROFILE_SCOPE("Input");
+
     // Exit
-    if(glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
+    if(inputRecorder.getKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
         glfwSetWindowShouldClose(window, true);
     }
 
     // Start-Stop Ride
-    if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
+    if (inputRecorder.getKey(window, GLFW_KEY_E) == GLFW_PRESS)
     {
         if(!keyEPressed)
         {
@@ -331,13 +832,41 @@ void processInput(GLFWwindow *window)
             keyEPressed = true;
         }
     }
-    else if (glfwGetKey(window, GLFW_KEY_E) == GLFW_RELEASE)
+    else if (inputRecorder.getKey(window, GLFW_KEY_E) == GLFW_RELEASE)
     {
         keyEPressed = false;
     }
 
+    // Profiler Capture
+    if (inputRecorder.getKey(window, GLFW_KEY_P) == GLFW_PRESS)
+    {
+        if(!keyPPressed)
+        {
+            profiler.capture(TRACE_KEY_FRAMES, traceOutput);
+            keyPPressed = true;
+        }
+    }
+    else if (inputRecorder.getKey(window, GLFW_KEY_P) == GLFW_RELEASE)
+    {
+        keyPPressed = false;
+    }
+
+    // Performance HUD
+    if (inputRecorder.getKey(window, GLFW_KEY_H) == GLFW_PRESS)
+    {
+        if(!keyHPressed)
+        {
+            hudVisible = !hudVisible;
+            keyHPressed = true;
+        }
+    }
+    else if (inputRecorder.getKey(window, GLFW_KEY_H) == GLFW_RELEASE)
+    {
+        keyHPressed = false;
+    }
+
     // Switching Cameras
-    if (glfwGetKey(window, GLFW_KEY_0) == GLFW_PRESS) {
+    if (inputRecorder.getKey(window, GLFW_KEY_0) == GLFW_PRESS) {
         key0Pressed = true;
     } else if (key0Pressed) {
         if (currentCamera == &camera) {
@@ -355,55 +884,55 @@ void processInput(GLFWwindow *window)
 
     if(currentCamera == &camera){
         // Camera: Move
-        if(glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS){
+        if(inputRecorder.getKey(window, GLFW_KEY_W) == GLFW_PRESS){
             glm::vec3 newPosition = currentCamera->Position + currentCamera->Front * deltaTime * currentCamera->MovementSpeed;
-            if (!isInsideBox(newPosition, boxMin, boxMax)) {
+            if (!isBlocked(newPosition)) {
                 currentCamera->ProcessKeyboard(FORWARD, deltaTime);
             }
         }
-        if(glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS){
+        if(inputRecorder.getKey(window, GLFW_KEY_S) == GLFW_PRESS){
             glm::vec3 newPosition = currentCamera->Position - currentCamera->Front * deltaTime * currentCamera->MovementSpeed;
-            if (!isInsideBox(newPosition, boxMin, boxMax)) {
+            if (!isBlocked(newPosition)) {
                 currentCamera->ProcessKeyboard(BACKWARD, deltaTime);
             }
         }
-        if(glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS){
+        if(inputRecorder.getKey(window, GLFW_KEY_A) == GLFW_PRESS){
             glm::vec3 newPosition = currentCamera->Position - currentCamera->Right * deltaTime * currentCamera->MovementSpeed;
-            if (!isInsideBox(newPosition, boxMin, boxMax)) {
+            if (!isBlocked(newPosition)) {
                 currentCamera->ProcessKeyboard(LEFT, deltaTime);
             }
         }
-        if(glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS){
+        if(inputRecorder.getKey(window, GLFW_KEY_D) == GLFW_PRESS){
             glm::vec3 newPosition = currentCamera->Position + currentCamera->Right * deltaTime * currentCamera->MovementSpeed;
-            if (!isInsideBox(newPosition, boxMin, boxMax)) {
+            if (!isBlocked(newPosition)) {
                 currentCamera->ProcessKeyboard(RIGHT, deltaTime);
             }
         }
 
         // Sprinting
-        if(glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS){
+        if(inputRecorder.getKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS){
             currentCamera->MovementSpeed = cameraSpeed * 2;
         }
-        if(glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_RELEASE){
+        if(inputRecorder.getKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_RELEASE){
             currentCamera->MovementSpeed = cameraSpeed;
         }
 
         // Camera: Up - Down
-        if(glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS){
+        if(inputRecorder.getKey(window, GLFW_KEY_SPACE) == GLFW_PRESS){
             glm::vec3 newPosition = currentCamera->Position + currentCamera->Up * deltaTime * currentCamera->MovementSpeed;
-            if (!isInsideBox(newPosition, boxMin, boxMax)) {
+            if (!isBlocked(newPosition)) {
                 currentCamera->ProcessKeyboard(UP, deltaTime);
             }
         }
-        if(glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS){
+        if(inputRecorder.getKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS){
             glm::vec3 newPosition = currentCamera->Position - currentCamera->Up * deltaTime * currentCamera->MovementSpeed;
-            if (!isInsideBox(newPosition, boxMin, boxMax)) {
+            if (!isBlocked(newPosition)) {
                 currentCamera->ProcessKeyboard(DOWN, deltaTime);
             }
         }
 
         // Torch
-        if (glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS)
+        if (inputRecorder.getKey(window, GLFW_KEY_T) == GLFW_PRESS)
         {
             if(!torchKeyPress)
             {
@@ -411,7 +940,7 @@ void processInput(GLFWwindow *window)
                 torchKeyPress = true;
             }
         }
-        else if (glfwGetKey(window, GLFW_KEY_T) == GLFW_RELEASE)
+        else if (inputRecorder.getKey(window, GLFW_KEY_T) == GLFW_RELEASE)
         {
             torchKeyPress = false;
         }
@@ -420,34 +949,34 @@ void processInput(GLFWwindow *window)
     if(currentCamera == &orbitCamera){
         OrbitCamera* orbitPtr = dynamic_cast<OrbitCamera*>(currentCamera);
         if (orbitPtr) {
-            if(glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS ){
+            if(inputRecorder.getKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS ){
                 orbitPtr->moveAroundCenter(deltaTime * 2);
             }
 
-            if(glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_RELEASE ){
+            if(inputRecorder.getKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_RELEASE ){
                 orbitPtr->moveAroundCenter(deltaTime);
             }
         }
 
-        if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS) {
+        if (inputRecorder.getKey(window, GLFW_KEY_UP) == GLFW_PRESS) {
             orbitCamera.moveUp(deltaTime * cameraSpeed);
         }
 
-        if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS) {
+        if (inputRecorder.getKey(window, GLFW_KEY_DOWN) == GLFW_PRESS) {
             orbitCamera.moveDown(deltaTime * cameraSpeed);
         }
 
-        if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS) {
+        if (inputRecorder.getKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS) {
             orbitCamera.increaseRadius(deltaTime * radiusSpeed);
         }
 
-        if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS) {
+        if (inputRecorder.getKey(window, GLFW_KEY_LEFT) == GLFW_PRESS) {
             orbitCamera.decreaseRadius(deltaTime * radiusSpeed);
         }
     }
 }
 
-void processPositions(vector<Model>& carts){
+void processPositions(vector<Model>& carts, float rideAngle){
     if(rideStart){
         // Ground Fixed Camera - LookAt
         FixedCamera* fixedPtr = dynamic_cast<FixedCamera*>(&fixedCamera);
@@ -460,31 +989,78 @@ void processPositions(vector<Model>& carts){
 //            lookAt.y = (rideCenter.y - 1.0) + rideRadius * sin(glm::radians(-theta));
 //            lookAt.z = rideCenter.z + rideRadius * cos(glm::radians(-theta));
 
-            glm::vec3 lookAtPos = carts[0].getPosition();
+            glm::vec3 lookAtPos = carts[0].getWorldPosition();
 
             fixedPtr->setLookAt(lookAtPos);
         }
 
-        // Ride Fixed Camera - Position
-        rideFixedCamAngle += deltaTime * rideSpeed;
-
+        // Ride Fixed Camera - Position (rides with the first cart)
         glm::vec3 cartCamPosition;
         cartCamPosition.x = 0.0f;
-        cartCamPosition.y = (rideCenter.y - 1.0f) + rideRadius * sin(glm::radians(-rideFixedCamAngle));
-        cartCamPosition.z = rideCenter.z + rideRadius * cos(glm::radians(-rideFixedCamAngle));
+        cartCamPosition.y = (rideCenter.y - 1.0f) + rideRadius * sin(glm::radians(-rideAngle));
+        cartCamPosition.z = rideCenter.z + rideRadius * cos(glm::radians(-rideAngle));
 
         rideFreeCamera.setPosition(cartCamPosition);
     }
 }
 
-bool isInsideBox(glm::vec3 position, glm::vec3 boxMin, glm::vec3 boxMax) {
-    return position.x >= boxMin.x && position.y >= boxMin.y && position.z >= boxMin.z
-           && position.x <= boxMax.x && position.y <= boxMax.y && position.z <= boxMax.z;
+// Directional light and spotlights (the point lights come from the light clusters)
+void setLightUniforms(Shader& shader){
+    // Directional
+    shader.setVec3("dirLight.direction", dirLightDirection);
+    shader.setVec3("dirLight.ambient", 0.1f, 0.1f, 0.1f);
+    shader.setVec3("dirLight.diffuse", 0.4f, 0.4f, 0.4f);
+    shader.setVec3("dirLight.specular", 0.5f, 0.5f, 0.5f);
+
+    // Spotlight (Ride)
+    shader.setVec3("spotLightRide.position", spotLightRidePosition);
+    shader.setVec3("spotLightRide.direction", spotLightRideDirection);
+    shader.setVec3("spotLightRide.ambient", 0.0f, 0.0f, 0.0f);
+    shader.setVec3("spotLightRide.diffuse", 4.0f, 4.0f, 4.0f);
+    shader.setVec3("spotLightRide.specular", 0.5f, 0.5f, 0.5f);
+    shader.setFloat("spotLightRide.constant", 1.0f);
+    shader.setFloat("spotLightRide.linear", 0.09f);
+    shader.setFloat("spotLightRide.quadratic", 0.032f);
+    shader.setFloat("spotLightRide.cutOff", glm::cos(glm::radians(15.0f)));
+    shader.setFloat("spotLightRide.outerCutOff", glm::cos(glm::radians(spotLightRideOuterCutOff)));
+
+    // Spotlight (Torch)
+    shader.setVec3("spotLightTorch.position", currentCamera->Position);
+    shader.setVec3("spotLightTorch.direction", currentCamera->Front);
+    shader.setVec3("spotLightTorch.ambient", 0.0f, 0.0f, 0.0f);
+    shader.setVec3("spotLightTorch.diffuse", 4.0f, 4.0f, 4.0f);
+    shader.setVec3("spotLightTorch.specular", 0.5f, 0.5f, 0.5f);
+    shader.setFloat("spotLightTorch.constant", 1.0f);
+    shader.setFloat("spotLightTorch.linear", 0.09f);
+    shader.setFloat("spotLightTorch.quadratic", 0.032f);
+    if(spotLightOn){
+        shader.setFloat("spotLightTorch.cutOff", glm::cos(glm::radians(25.0f)));
+        shader.setFloat("spotLightTorch.outerCutOff", glm::cos(glm::radians(spotLightTorchOuterCutOff)));
+    }
+}
+
+// Collision box around the ride, plus any solid instance the camera sphere touches
+bool isBlocked(glm::vec3 position) {
+    if (isInsideBox(position, boxMin, boxMax)) {
+        return true;
+    }
+
+    static std::vector<unsigned int> hits;
+    hits.clear();
+    sceneBvh.querySphere(position, cameraRadius, hits);
+    for (unsigned int index : hits) {
+        if (solidInstances[index]) {
+            return true;
+        }
+    }
+    return false;
 }
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
-    glViewport(0, 0, width, height);
+    framebufferWidth = width;
+    framebufferHeight = height;
+    glState.viewport(0, 0, width, height);
 }
 
 void mouse_callback(GLFWwindow* window, double xposIn, double yposIn){
@@ -519,4 +1095,15 @@ void zoom_callback(GLFWwindow* window, int key, int scancode, int action, int mo
     currentCamera->ProcessZoom(key, action);
 }
 
+const char* cameraName(const Camera* camera){
+    if (camera == &fixedCamera) return "fixed";
+    if (camera == &rideFreeCamera) return "ride";
+    if (camera == &orbitCamera) return "orbit";
+    return "free";
+}
 
+std::string formatVec3(const glm::vec3& v){
+    char text[96];
+    std::snprintf(text, sizeof(text), "%.3f %.3f %.3f", v.x, v.y, v.z);
+    return text;
+}